@@ -0,0 +1,986 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include "ivshmem.h"
+#include "ivshmem_host.h"
+
+/*
+ * LD_PRELOAD shim that lets the guest programs under uio/ and tests/ run
+ * unchanged as host processes.  Opening /dev/uioN or /dev/kvm_ivshmem
+ * connects the process to ivshmem_server as a peer, like a guest's qemu
+ * would, and the device is emulated on top of the server's shm object and
+ * eventfds:
+ *
+ *   UIO   mmap offset 0 is a read-only page of registers, IVPosition
+ *         filled in.  Stores to it fault; the SIGSEGV handler decodes the
+ *         mov, applies it and steps over it, so a store to Doorbell
+ *         becomes a write to the peer's eventfd.  Offset one page is the
+ *         region, offset two pages the per-vector counts.  read() blocks
+ *         for an interrupt and returns the total count, and the fd works
+ *         with poll() and epoll.  /sys/class/uio/uioN/maps/mapM/size is
+ *         answered too, for libivshmem.
+ *   KVM   mmap, read, write and lseek go to the region.  The ioctls
+ *         behave like the standard driver's, with channel c carried on
+ *         vector c % nvectors.
+ *
+ * A thread reads our own eventfds, bumps the counts and wakes whoever
+ * waits, and takes in peers as they come and go.
+ *
+ *   IVSHMEM_EMU_SOCKET   the server's socket (/tmp/ivshmem_socket)
+ *   IVSHMEM_EMU_VECTORS  the server's -n (1)
+ *
+ * Every device path is the same peer.  Decoding only covers the 32-bit
+ * and 16-bit mov stores compilers emit for register writes, on x86-64.
+ */
+
+#define EMU_MAX_FDS 1024
+#define EMU_MAX_PEERS 256
+#define EMU_MAX_VECTORS 64
+#define EMU_MAX_MAPS 16
+#define EMU_MAX_BATCH 256
+#define EMU_MAX_RETIRED 64         /* departed eventfds closed per pass */
+#define EMU_POLL_MAX_NS 200000     /* the standard driver's poll_max_ns */
+#define EMU_POLL_GROW_NS 10000     /* ... and poll_grow_start_ns */
+
+enum { EMU_NONE, EMU_UIO, EMU_KVM };
+
+struct emu_fd {
+    int type;
+    off_t pos;          /* KVM read/write/lseek */
+};
+
+/* the standard driver's per-channel busy polling */
+struct emu_poll {
+    uint32_t mode;
+    uint32_t ns;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_once_t once;
+    int err;                    /* errno of a failed connect */
+
+    struct ivshmem_dev dev;
+    int nvectors;
+    pthread_t thread;
+
+    /* our views; the program maps the same pages read-only */
+    int regs_fd;
+    volatile uint32_t * regs;
+    int counts_fd;
+    volatile struct ivshmem_vector_counts * counts;
+    uint32_t total;
+
+    /* a copy of dev.efds the signal handler can read without the lock */
+    int efds[EMU_MAX_PEERS * EMU_MAX_VECTORS];
+    int ringing;                /* doorbells between loading and writing */
+
+    uint32_t pending[EMU_MAX_VECTORS];  /* KVM events/semaphore counts */
+    int bound[EMU_MAX_VECTORS];         /* KVM BIND_EVENTFD */
+    struct emu_poll poll[IVSHMEM_NCHANNELS];
+
+    struct emu_fd fds[EMU_MAX_FDS];
+    int uio_fds[EMU_MAX_FDS];   /* the open EMU_UIO ones */
+    int nuio;
+
+    /* where the program mapped the registers */
+    struct {
+        uintptr_t start;
+        uintptr_t end;
+    } maps[EMU_MAX_MAPS];
+    struct sigaction old_segv;
+    int handler;
+} emu = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static off_t (*real_lseek)(int, off_t, int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static void * (*real_mmap)(void *, size_t, int, int, int, off_t);
+static void * (*real_mmap64)(void *, size_t, int, int, int, off64_t);
+static int (*real_munmap)(void *, size_t);
+static FILE * (*real_fopen)(const char *, const char *);
+static FILE * (*real_fopen64)(const char *, const char *);
+static int (*real_stat)(const char *, struct stat *);
+static int (*real_stat64)(const char *, struct stat64 *);
+static int (*real_xstat)(int, const char *, struct stat *);
+static int (*real_xstat64)(int, const char *, struct stat64 *);
+
+__attribute__((constructor))
+static void emu_resolve(void)
+{
+    if (real_open)
+        return;
+
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_lseek = dlsym(RTLD_NEXT, "lseek");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+    real_mmap64 = dlsym(RTLD_NEXT, "mmap64");
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+    real_fopen = dlsym(RTLD_NEXT, "fopen");
+    real_fopen64 = dlsym(RTLD_NEXT, "fopen64");
+    /* older glibc only has the __xstat flavours */
+    real_stat = dlsym(RTLD_NEXT, "stat");
+    real_stat64 = dlsym(RTLD_NEXT, "stat64");
+    real_xstat = dlsym(RTLD_NEXT, "__xstat");
+    real_xstat64 = dlsym(RTLD_NEXT, "__xstat64");
+}
+
+static uint64_t emu_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* which device path is this, if any */
+static int emu_path(const char * path)
+{
+    if (path == NULL)
+        return EMU_NONE;
+    if (strncmp(path, "/dev/uio", 8) == 0 && path[8] >= '0' && path[8] <= '9')
+        return EMU_UIO;
+    if (strcmp(path, "/dev/kvm_ivshmem") == 0)
+        return EMU_KVM;
+    return EMU_NONE;
+}
+
+static int emu_type(int fd)
+{
+    if (fd < 0 || fd >= EMU_MAX_FDS)
+        return EMU_NONE;
+    return emu.fds[fd].type;
+}
+
+/* refresh the handler's eventfd table and the live list, under the lock */
+static void emu_sync_peers(void)
+{
+    uint32_t live = 0;
+    int i, n = emu.dev.npeers * emu.nvectors;
+
+    for (i = 0; i < EMU_MAX_PEERS * emu.nvectors; i++)
+        __atomic_store_n(&emu.efds[i], i < n ? emu.dev.efds[i] : -1,
+                         __ATOMIC_RELEASE);
+
+    for (i = 0; i < emu.dev.npeers && i < 32; i++)
+        if (emu.dev.efds[i * emu.nvectors] >= 0)
+            live |= 1u << i;
+    emu.regs[IVLiveList / sizeof(uint32_t)] = live;
+}
+
+/* async-signal-safe: a doorbell to a peer we do not know is dropped */
+static int emu_ring(int peer, int vector)
+{
+    uint64_t one = 1;
+    int fd, rv;
+
+    if (peer < 0 || peer >= EMU_MAX_PEERS || vector < 0 ||
+            vector >= emu.nvectors) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* emu_update() does not close an eventfd while we may hold it */
+    __atomic_add_fetch(&emu.ringing, 1, __ATOMIC_SEQ_CST);
+    fd = __atomic_load_n(&emu.efds[peer * emu.nvectors + vector],
+                         __ATOMIC_SEQ_CST);
+    if (fd < 0) {
+        __atomic_sub_fetch(&emu.ringing, 1, __ATOMIC_RELEASE);
+        errno = ENOENT;
+        return -1;
+    }
+
+    rv = syscall(SYS_write, fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+    __atomic_sub_fetch(&emu.ringing, 1, __ATOMIC_RELEASE);
+
+    return rv;
+}
+
+/*
+ * Take peer updates from the server, under the lock.  The eventfds of
+ * peers that left are unpublished first and closed only once no doorbell
+ * that might have loaded them is still writing, so a number the program
+ * reuses for one of its own files never gets rung.
+ */
+static void emu_update(void)
+{
+
+    int retired[EMU_MAX_RETIRED];
+    int i, n;
+
+    do {
+        /* a server that went away shows up in the service thread's poll */
+        ivshmem_host_update_retire(&emu.dev, retired, EMU_MAX_RETIRED, &n);
+        emu_sync_peers();
+        if (n == 0)
+            break;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&emu.ringing, __ATOMIC_SEQ_CST))
+            sched_yield();
+        for (i = 0; i < n; i++)
+            real_close(retired[i]);
+    } while (n + emu.nvectors > EMU_MAX_RETIRED);   /* it stopped early */
+}
+
+/* what an interrupt on vector does, under the lock */
+static void emu_interrupt(int vector, uint32_t n)
+{
+    uint64_t one = 1;
+    int i;
+
+    __atomic_add_fetch(&emu.counts->count[vector], n, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&emu.total, n, __ATOMIC_RELEASE);
+    emu.pending[vector] += n;
+
+    /* every open UIO fd becomes readable, as with the UIO core */
+    for (i = 0; i < emu.nuio; i++)
+        real_write(emu.uio_fds[i], &one, sizeof(one));
+    if (emu.bound[vector] >= 0)
+        real_write(emu.bound[vector], &one, sizeof(one));
+
+    pthread_cond_broadcast(&emu.cond);
+}
+
+static void * emu_service(void * arg)
+{
+
+    struct pollfd pfd[1 + EMU_MAX_VECTORS];
+    uint64_t count;
+    int i;
+
+    pfd[0].fd = emu.dev.fd;
+    pfd[0].events = POLLIN;
+    for (i = 0; i < emu.nvectors; i++) {
+        pfd[1 + i].fd = emu.dev.efds[emu.dev.posn * emu.nvectors + i];
+        pfd[1 + i].events = POLLIN;
+    }
+
+    for (;;) {
+        if (poll(pfd, 1 + emu.nvectors, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+
+        pthread_mutex_lock(&emu.lock);
+        if (pfd[0].revents & (POLLHUP | POLLERR))
+            pfd[0].fd = -1;     /* the server went away */
+        else if (pfd[0].revents & POLLIN)
+            emu_update();
+        for (i = 0; i < emu.nvectors; i++)
+            if ((pfd[1 + i].revents & POLLIN) &&
+                    real_read(pfd[1 + i].fd, &count, sizeof(count)) == sizeof(count))
+                emu_interrupt(i, count);
+        pthread_mutex_unlock(&emu.lock);
+    }
+
+    return NULL;
+}
+
+static void * emu_page(int * fd, const char * name)
+{
+    void * p;
+
+    if ((*fd = memfd_create(name, MFD_CLOEXEC)) < 0)
+        return NULL;
+    if (ftruncate(*fd, getpagesize()) < 0)
+        return NULL;
+    p = real_mmap(NULL, getpagesize(), PROT_READ|PROT_WRITE, MAP_SHARED, *fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void emu_connect(void)
+{
+
+    const char * sock = getenv("IVSHMEM_EMU_SOCKET");
+    const char * nv = getenv("IVSHMEM_EMU_VECTORS");
+    sigset_t all, old;
+    int i;
+
+    emu.nvectors = nv ? atoi(nv) : 1;
+    if (emu.nvectors < 1 || emu.nvectors > EMU_MAX_VECTORS) {
+        fprintf(stderr, "ivshmem_emu: 1 to %d vectors\n", EMU_MAX_VECTORS);
+        emu.err = EINVAL;
+        return;
+    }
+
+    if (ivshmem_open(&emu.dev, sock ? sock : "/tmp/ivshmem_socket", 0,
+                     emu.nvectors) < 0) {
+        emu.err = errno;
+        perror("ivshmem_emu: cannot reach ivshmem_server");
+        return;
+    }
+
+    if ((emu.regs = emu_page(&emu.regs_fd, "ivshmem-regs")) == NULL ||
+            (emu.counts = emu_page(&emu.counts_fd, "ivshmem-counts")) == NULL) {
+        emu.err = errno;
+        return;
+    }
+    emu.regs[IVPosition / sizeof(uint32_t)] = emu.dev.posn;
+    emu.counts->nvectors = emu.nvectors;
+    for (i = 0; i < EMU_MAX_VECTORS; i++)
+        emu.bound[i] = -1;
+    emu_sync_peers();
+
+    /* signals are for the program's threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if ((i = pthread_create(&emu.thread, NULL, emu_service, NULL)))
+        emu.err = i;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static int emu_ready(void)
+{
+    emu_resolve();
+    pthread_once(&emu.once, emu_connect);
+    if (emu.err) {
+        errno = emu.err;
+        return 0;
+    }
+    return 1;
+}
+
+static int emu_open(const char * path, int flags)
+{
+    int type = emu_path(path), fd;
+
+    if (!emu_ready())
+        return -1;
+
+    /* an eventfd, so the UIO fd can be polled */
+    fd = eventfd(0, EFD_CLOEXEC | (flags & O_NONBLOCK ? EFD_NONBLOCK : 0));
+    if (fd < 0)
+        return -1;
+    if (fd >= EMU_MAX_FDS) {
+        real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    if (!(flags & O_CLOEXEC))
+        fcntl(fd, F_SETFD, 0);
+
+    pthread_mutex_lock(&emu.lock);
+    emu.fds[fd].pos = 0;
+    emu.fds[fd].type = type;
+    if (type == EMU_UIO)
+        emu.uio_fds[emu.nuio++] = fd;
+    pthread_mutex_unlock(&emu.lock);
+
+    return fd;
+}
+
+/*
+ * Length of the mov at ip and the value it stores, or -1 for anything
+ * else: 89 /r (from a register) and c7 /0 (an immediate), with operand
+ * size, segment and REX prefixes.
+ */
+static int emu_decode(const uint8_t * ip, const greg_t * gregs, uint32_t * value)
+{
+
+    static const int reg[16] = {
+        REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+        REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+    };
+    const uint8_t * p = ip;
+    int rex = 0, word = 0, op, modrm, mod, rm;
+
+    for (;; p++) {
+        if (*p == 0x66)
+            word = 1;
+        else if (*p != 0x26 && *p != 0x2e && *p != 0x36 && *p != 0x3e &&
+                 *p != 0x64 && *p != 0x65)
+            break;
+    }
+    if ((*p & 0xf0) == 0x40)
+        rex = *p++;
+
+    op = *p++;
+    if (op != 0x89 && op != 0xc7)
+        return -1;
+
+    modrm = *p++;
+    mod = modrm >> 6;
+    rm = modrm & 7;
+    if (mod == 3)
+        return -1;
+    if (rm == 4 && (*p++ & 7) == 5 && mod == 0)
+        p += 4;                 /* SIB without a base */
+    else if (rm == 5 && mod == 0)
+        p += 4;                 /* RIP-relative */
+    p += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+
+    if (op == 0x89)
+        *value = gregs[reg[((modrm >> 3) & 7) | ((rex & 4) << 1)]];
+    else if ((modrm >> 3) & 7)
+        return -1;
+    else if (word) {
+        *value = p[0] | p[1] << 8;
+        p += 2;
+    } else {
+        memcpy(value, p, sizeof(*value));
+        p += 4;
+    }
+    if (word)
+        *value &= 0xffff;
+
+    return p - ip;
+}
+
+static void emu_segv(int sig, siginfo_t * si, void * ctx)
+{
+
+    ucontext_t * uc = ctx;
+    greg_t * gregs = uc->uc_mcontext.gregs;
+    uintptr_t addr = (uintptr_t)si->si_addr;
+    uint32_t value, off;
+    int i, len = -1;
+
+    for (i = 0; i < EMU_MAX_MAPS; i++)
+        if (addr >= emu.maps[i].start && addr < emu.maps[i].end)
+            break;
+    if (i < EMU_MAX_MAPS)
+        len = emu_decode((const uint8_t *)gregs[REG_RIP], gregs, &value);
+
+    if (len < 0) {
+        /* not ours: whatever would have happened without us */
+        if (emu.old_segv.sa_flags & SA_SIGINFO)
+            emu.old_segv.sa_sigaction(sig, si, ctx);
+        else if (emu.old_segv.sa_handler != SIG_DFL &&
+                 emu.old_segv.sa_handler != SIG_IGN)
+            emu.old_segv.sa_handler(sig);
+        else
+            signal(SIGSEGV, SIG_DFL);   /* the fault repeats and kills us */
+        return;
+    }
+
+    off = (addr - emu.maps[i].start) & ~3u;
+    if (off < 256) {
+        if (off == Doorbell)
+            emu_ring(value >> 16, value & 0xffff);
+        else if (off == IntrMask || off == IntrStatus)
+            emu.regs[off / sizeof(uint32_t)] = value;
+    }
+    gregs[REG_RIP] += len;
+}
+
+static void emu_add_map(void * p, size_t len)
+{
+
+    struct sigaction sa;
+    int i;
+
+    pthread_mutex_lock(&emu.lock);
+    for (i = 0; i < EMU_MAX_MAPS && emu.maps[i].end; i++)
+        ;
+    if (i < EMU_MAX_MAPS) {
+        emu.maps[i].start = (uintptr_t)p;
+        __atomic_store_n(&emu.maps[i].end, (uintptr_t)p + len, __ATOMIC_RELEASE);
+    }
+
+    if (!emu.handler) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = emu_segv;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &emu.old_segv);
+        emu.handler = 1;
+    }
+    pthread_mutex_unlock(&emu.lock);
+}
+
+/* another view of the region's pages, from offset off */
+static void * emu_map_region(void * addr, size_t len, int prot, int flags,
+                             off_t off)
+{
+    void * p;
+
+    if (off < 0 || off + len > emu.dev.size || (off & (getpagesize() - 1))) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    /* mremap() of a shared mapping with old size 0 maps the same pages again */
+    if (flags & MAP_FIXED)
+        p = mremap((char *)emu.dev.mem + off, 0, len,
+                   MREMAP_MAYMOVE | MREMAP_FIXED, addr);
+    else
+        p = mremap((char *)emu.dev.mem + off, 0, len, MREMAP_MAYMOVE);
+    if (p != MAP_FAILED && !(prot & PROT_WRITE))
+        mprotect(p, len, prot);
+
+    return p;
+}
+
+static void * emu_mmap(void * addr, size_t len, int prot, int flags, int fd,
+                       off_t off)
+{
+
+    int page = getpagesize();
+    void * p;
+
+    if (emu_type(fd) == EMU_KVM)
+        return emu_map_region(addr, len, prot, flags, off);
+
+    /* UIO: the offset selects the map, one page each */
+    switch (off / page) {
+    case 0:
+        if (len > page)
+            break;
+        p = real_mmap(addr, len, prot & ~PROT_WRITE, flags, emu.regs_fd, 0);
+        if (p != MAP_FAILED && (prot & PROT_WRITE))
+            emu_add_map(p, len);
+        return p;
+    case 1:
+        return emu_map_region(addr, len, prot, flags, 0);
+    case 2:
+        if (len > page)
+            break;
+        return real_mmap(addr, len, prot & ~PROT_WRITE, flags, emu.counts_fd, 0);
+    }
+
+    errno = EINVAL;
+    return MAP_FAILED;
+}
+
+/* the standard driver's wait_event/down_sema, channel on vector */
+static int emu_kvm_wait(int channel, int sema)
+{
+
+    struct emu_poll * pl = &emu.poll[channel];
+    uint32_t * pending = &emu.pending[channel % emu.nvectors];
+    uint64_t start = emu_now(), waited;
+
+    if (pl->mode != POLL_OFF)
+        while (!__atomic_load_n(pending, __ATOMIC_ACQUIRE) &&
+               emu_now() - start < pl->ns)
+            ivshmem_relax();
+
+    pthread_mutex_lock(&emu.lock);
+    while (*pending == 0)
+        pthread_cond_wait(&emu.cond, &emu.lock);
+    if (sema)
+        (*pending)--;
+    else
+        *pending = 0;
+
+    waited = emu_now() - start;
+    if (pl->mode == POLL_ADAPTIVE) {
+        if (waited <= EMU_POLL_MAX_NS)
+            pl->ns = pl->ns ? pl->ns * 2 : EMU_POLL_GROW_NS;
+        else
+            pl->ns /= 2;
+        if (pl->ns > EMU_POLL_MAX_NS)
+            pl->ns = EMU_POLL_MAX_NS;
+    }
+    pthread_mutex_unlock(&emu.lock);
+
+    return 0;
+}
+
+/* peers we have not heard of yet may be waiting in the socket */
+static int emu_kvm_ring(int peer, int channel)
+{
+    if (emu_ring(peer, channel % emu.nvectors) == 0)
+        return 0;
+
+    pthread_mutex_lock(&emu.lock);
+    emu_update();
+    pthread_mutex_unlock(&emu.lock);
+
+    return emu_ring(peer, channel % emu.nvectors);
+}
+
+static int emu_kvm_batch(struct ivshmem_batch * batch)
+{
+
+    struct ivshmem_doorbell * db = (void *)(unsigned long)batch->entries;
+    uint32_t i, j;
+    int rung = 0;
+
+    if (batch->count > EMU_MAX_BATCH) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        db[i].error = 0;
+        if (db[i].peer > 0xff || (db[i].vector >> 8) >= IVSHMEM_NCHANNELS) {
+            db[i].error = -EINVAL;
+            continue;
+        }
+        for (j = 0; j < i; j++)
+            if (db[j].error == 0 && db[j].peer == db[i].peer &&
+                    db[j].vector == db[i].vector) {
+                db[i].error = -EALREADY;
+                break;
+            }
+        if (db[i].error)
+            continue;
+        if (emu_kvm_ring(db[i].peer, db[i].vector >> 8) < 0)
+            db[i].error = -errno;
+        else
+            rung++;
+    }
+
+    return rung;
+}
+
+static int emu_kvm_ioctl(unsigned long cmd, unsigned long arg)
+{
+
+    struct ivshmem_irqfd * irqfd = (void *)arg;
+    struct ivshmem_poll * pl = (void *)arg;
+    int channel = (arg >> 16) & 0xff, old;
+
+    if (channel >= IVSHMEM_NCHANNELS && cmd != GET_POSN && cmd != MULTI_IRQ &&
+            cmd != BIND_EVENTFD && cmd != SET_POLL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (cmd) {
+    case SET_SEMA:
+        pthread_mutex_lock(&emu.lock);
+        emu.pending[channel % emu.nvectors] = arg & 0xffff;
+        pthread_mutex_unlock(&emu.lock);
+        return 0;
+    case DOWN_SEMA:
+        return emu_kvm_wait(channel, 1);
+    case WAIT_EVENT:
+        return emu_kvm_wait(channel, 0);
+    case WAIT_EVENT_IRQ:
+    case SEMA_IRQ:
+        return emu_kvm_ring(arg & 0xff, channel);
+    case GET_POSN:
+        *(uint32_t *)arg = emu.dev.posn;
+        return 0;
+    case MULTI_IRQ:
+        return emu_kvm_batch((struct ivshmem_batch *)arg);
+    case BIND_EVENTFD:
+        if (irqfd->vector >= emu.nvectors) {
+            errno = EINVAL;
+            return -1;
+        }
+        pthread_mutex_lock(&emu.lock);
+        old = emu.bound[irqfd->vector];
+        emu.bound[irqfd->vector] = irqfd->fd < 0 ? -1 :
+                                   fcntl(irqfd->fd, F_DUPFD_CLOEXEC, 0);
+        pthread_mutex_unlock(&emu.lock);
+        if (old >= 0)
+            real_close(old);
+        return 0;
+    case SET_POLL:
+        if (pl->channel >= IVSHMEM_NCHANNELS || pl->mode > POLL_ADAPTIVE) {
+            errno = EINVAL;
+            return -1;
+        }
+        emu.poll[pl->channel].mode = pl->mode;
+        emu.poll[pl->channel].ns = pl->budget_ns < EMU_POLL_MAX_NS ?
+                                   pl->budget_ns : EMU_POLL_MAX_NS;
+        return 0;
+    default:
+        /* EMPTY and GET_LIVELIST do nothing in the driver either */
+        return 0;
+    }
+}
+
+/* the interposed calls */
+
+int open(const char * path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+
+    emu_resolve();
+    if (emu_path(path))
+        return emu_open(path, flags);
+    return real_open(path, flags, mode);
+}
+
+int open64(const char * path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+
+    emu_resolve();
+    if (emu_path(path))
+        return emu_open(path, flags);
+    return real_open64(path, flags, mode);
+}
+
+int close(int fd)
+{
+    int i;
+
+    emu_resolve();
+    if (emu_type(fd)) {
+        pthread_mutex_lock(&emu.lock);
+        if (emu.fds[fd].type == EMU_UIO)
+            for (i = 0; i < emu.nuio; i++)
+                if (emu.uio_fds[i] == fd)
+                    emu.uio_fds[i] = emu.uio_fds[--emu.nuio];
+        emu.fds[fd].type = EMU_NONE;
+        pthread_mutex_unlock(&emu.lock);
+    }
+    return real_close(fd);
+}
+
+ssize_t read(int fd, void * buf, size_t count)
+{
+
+    uint64_t n;
+    uint32_t total;
+
+    emu_resolve();
+    switch (emu_type(fd)) {
+    case EMU_UIO:
+        /* like the UIO core: block until an interrupt, return the total */
+        if (count != sizeof(total)) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (real_read(fd, &n, sizeof(n)) < 0)
+            return -1;
+        total = __atomic_load_n(&emu.total, __ATOMIC_ACQUIRE);
+        memcpy(buf, &total, sizeof(total));
+        return sizeof(total);
+    case EMU_KVM:
+        if (emu.fds[fd].pos >= emu.dev.size)
+            return 0;
+        if (count > emu.dev.size - emu.fds[fd].pos)
+            count = emu.dev.size - emu.fds[fd].pos;
+        memcpy(buf, (char *)emu.dev.mem + emu.fds[fd].pos, count);
+        emu.fds[fd].pos += count;
+        return count;
+    default:
+        return real_read(fd, buf, count);
+    }
+}
+
+ssize_t write(int fd, const void * buf, size_t count)
+{
+    emu_resolve();
+    switch (emu_type(fd)) {
+    case EMU_UIO:
+        /* interrupt enable/disable: there is nothing to mask */
+        return count;
+    case EMU_KVM:
+        if (emu.fds[fd].pos >= emu.dev.size) {
+            errno = ENOSPC;
+            return -1;
+        }
+        if (count > emu.dev.size - emu.fds[fd].pos)
+            count = emu.dev.size - emu.fds[fd].pos;
+        memcpy((char *)emu.dev.mem + emu.fds[fd].pos, buf, count);
+        emu.fds[fd].pos += count;
+        return count;
+    default:
+        return real_write(fd, buf, count);
+    }
+}
+
+off_t lseek(int fd, off_t off, int whence)
+{
+    emu_resolve();
+    if (emu_type(fd) != EMU_KVM)
+        return real_lseek(fd, off, whence);
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        off += emu.fds[fd].pos;
+        break;
+    case SEEK_END:
+        off += emu.dev.size;
+        break;
+    default:
+        off = -1;
+    }
+    if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return emu.fds[fd].pos = off;
+}
+
+int ioctl(int fd, unsigned long cmd, ...)
+{
+    va_list ap;
+    unsigned long arg;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, unsigned long);
+    va_end(ap);
+
+    emu_resolve();
+    if (emu_type(fd) == EMU_KVM)
+        return emu_kvm_ioctl(cmd, arg);
+    if (emu_type(fd) == EMU_UIO) {
+        errno = ENOTTY;
+        return -1;
+    }
+    return real_ioctl(fd, cmd, arg);
+}
+
+void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+    emu_resolve();
+    if (emu_type(fd))
+        return emu_mmap(addr, len, prot, flags, fd, off);
+    return real_mmap(addr, len, prot, flags, fd, off);
+}
+
+void * mmap64(void * addr, size_t len, int prot, int flags, int fd, off64_t off)
+{
+    emu_resolve();
+    if (emu_type(fd))
+        return emu_mmap(addr, len, prot, flags, fd, off);
+    return real_mmap64(addr, len, prot, flags, fd, off);
+}
+
+int munmap(void * addr, size_t len)
+{
+    int i;
+
+    emu_resolve();
+    for (i = 0; i < EMU_MAX_MAPS; i++)
+        if (emu.maps[i].start == (uintptr_t)addr) {
+            __atomic_store_n(&emu.maps[i].end, 0, __ATOMIC_RELEASE);
+            emu.maps[i].start = 0;
+        }
+    return real_munmap(addr, len);
+}
+
+/* /sys/class/uio/uioN/maps/mapM/size for libivshmem's open_uio() */
+static FILE * emu_sysfs(const char * path)
+{
+    unsigned long size;
+    int n, map;
+    FILE * f;
+
+    if (sscanf(path, "/sys/class/uio/uio%d/maps/map%d/size", &n, &map) != 2)
+        return NULL;
+    if (!emu_ready())
+        return NULL;
+
+    size = map == 1 ? emu.dev.size : getpagesize();
+    if ((f = fmemopen(NULL, 32, "w+")) == NULL)
+        return NULL;
+    fprintf(f, "0x%lx\n", size);
+    rewind(f);
+
+    return f;
+}
+
+FILE * fopen(const char * path, const char * mode)
+{
+    FILE * f;
+
+    emu_resolve();
+    if (strncmp(path, "/sys/class/uio/", 15) == 0 && (f = emu_sysfs(path)))
+        return f;
+    return real_fopen(path, mode);
+}
+
+FILE * fopen64(const char * path, const char * mode)
+{
+    FILE * f;
+
+    emu_resolve();
+    if (strncmp(path, "/sys/class/uio/", 15) == 0 && (f = emu_sysfs(path)))
+        return f;
+    return real_fopen64(path, mode);
+}
+
+/* the device nodes exist as far as the program can tell */
+static void emu_fake_stat(struct stat * st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFCHR | 0666;
+}
+
+int stat(const char * path, struct stat * st)
+{
+    emu_resolve();
+    if (emu_path(path)) {
+        emu_fake_stat(st);
+        return 0;
+    }
+    if (real_stat)
+        return real_stat(path, st);
+    return real_xstat(1, path, st);
+}
+
+int stat64(const char * path, struct stat64 * st)
+{
+    emu_resolve();
+    if (emu_path(path)) {
+        emu_fake_stat((struct stat *)st);
+        return 0;
+    }
+    if (real_stat64)
+        return real_stat64(path, st);
+    return real_xstat64(1, path, st);
+}
+
+int __xstat(int ver, const char * path, struct stat * st)
+{
+    emu_resolve();
+    if (emu_path(path)) {
+        emu_fake_stat(st);
+        return 0;
+    }
+    return real_xstat(ver, path, st);
+}
+
+int __xstat64(int ver, const char * path, struct stat64 * st)
+{
+    emu_resolve();
+    if (emu_path(path)) {
+        emu_fake_stat((struct stat *)st);
+        return 0;
+    }
+    return real_xstat64(ver, path, st);
+}
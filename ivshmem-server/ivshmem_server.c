@@ -194,7 +194,7 @@ void add_new_guest(server_state_t * s) {
 
     s->live_vms[new_posn].posn = new_posn;
     printf("[NC] Live_vms[%ld]\n", new_posn);
-    s->live_vms[new_posn].efd = (int *) malloc(sizeof(int));
+    s->live_vms[new_posn].efd = (int *) malloc(s->msi_vectors * sizeof(int));
     for (i = 0; i < s->msi_vectors; i++) {
         s->live_vms[new_posn].efd[i] = eventfd(0, 0);
         printf("\tefd[%ld] = %d\n", i, s->live_vms[new_posn].efd[i]);
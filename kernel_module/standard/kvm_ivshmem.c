@@ -18,11 +18,42 @@
 #include <asm/uaccess.h>
 #include <linux/interrupt.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/eventfd.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+#define CREATE_TRACE_POINTS
+#include "kvm_ivshmem_trace.h"
 
 #define TRUE 1
 #define FALSE 0
 #define KVM_IVSHMEM_DEVICE_MINOR_NUM 0
 
+/* MSI-X vectors requested at probe */
+#define KVM_IVSHMEM_NVECTORS 4
+
+/* upper bound on the number of doorbells rung by one multi_irq call */
+#define KVM_IVSHMEM_MAX_BATCH 256
+
+/*
+ * The driver keeps a table of independent semaphore/event channels.  The
+ * channel index travels in bits 16-23 of the ioctl argument (the low 16 bits
+ * keep their old meaning: destination peer or initial semaphore count) and in
+ * bits 3-7 of the doorbell message, next to the 3-bit command.  Index 0 is
+ * what older binaries get, so they keep working unchanged.
+ */
+#define KVM_IVSHMEM_NCHANNELS 32
+#define KVM_IVSHMEM_CMD_BITS 3
+#define KVM_IVSHMEM_CMD_MASK ((1 << KVM_IVSHMEM_CMD_BITS) - 1)
+
+#define KVM_IVSHMEM_ARG_VALUE(arg) ((arg) & 0xffff)
+#define KVM_IVSHMEM_ARG_INDEX(arg) (((arg) >> 16) & 0xff)
+#define KVM_IVSHMEM_MSG(peer, index, cmd) ((((peer) & 0xff) << 8) + \
+		((index) << KVM_IVSHMEM_CMD_BITS) + ((cmd) & KVM_IVSHMEM_CMD_MASK))
+
 enum {
 	/* KVM Inter-VM shared memory device register offsets */
 	IntrMask        = 0x00,    /* Interrupt Mask */
@@ -31,6 +62,27 @@ enum {
 	Doorbell        = 0x0c,    /* Doorbell */
 };
 
+struct kvm_ivshmem_device;
+
+/* per-vector interrupt context, an eventfd may be bound to each vector */
+typedef struct kvm_ivshmem_vector {
+	struct kvm_ivshmem_device *dev;
+	int index;
+	struct eventfd_ctx *eventfd;
+	struct file *owner;
+} kvm_ivshmem_vector;
+
+/*
+ * Per-CPU, per-vector interrupt statistics, summed up by the irq_stats
+ * attribute.  spurious counts pin-based interrupts that found IntrStatus
+ * clear; last_ns is the ktime_get() time of the last interrupt on that CPU.
+ */
+typedef struct kvm_ivshmem_irq_stats {
+	u64 irqs;
+	u64 spurious;
+	u64 last_ns;
+} kvm_ivshmem_irq_stats;
+
 typedef struct kvm_ivshmem_device {
 	void __iomem * regs;
 
@@ -47,14 +99,46 @@ typedef struct kvm_ivshmem_device {
 	char (*msix_names)[256];
 	struct msix_entry *msix_entries;
 	int nvectors;
+	bool msix_enabled;
+
+	kvm_ivshmem_vector *vectors;
+	spinlock_t eventfd_lock;
+
+	kvm_ivshmem_irq_stats __percpu *stats;
 
 	bool		 enabled;
 
 } kvm_ivshmem_device;
 
-static int event_num;
-static struct semaphore sema;
-static wait_queue_head_t wait_queue;
+typedef struct kvm_ivshmem_channel {
+	struct semaphore sema;
+	wait_queue_head_t wait_queue;
+	int event_num;
+
+	/* busy-poll state for wait_event/down_sema, see kvm_ivshmem_poll() */
+	int poll_mode;
+	unsigned int poll_ns;
+} kvm_ivshmem_channel;
+
+/*
+ * Before sleeping, wait_event and down_sema can spin on the channel's pending
+ * flag (event_num or the semaphore count) for a budget of poll_ns.  With
+ * POLL_FIXED the budget is whatever set_poll asked for.  With POLL_ADAPTIVE it
+ * follows the observed time between a wait starting and its wakeup, the way
+ * KVM's halt polling does: it doubles when a waiter slept for less than
+ * poll_max_ns and halves when a waiter slept for longer.
+ */
+enum { POLL_OFF, POLL_FIXED, POLL_ADAPTIVE };
+
+static unsigned int poll_max_ns = 200000;
+module_param(poll_max_ns, uint, 0644);
+MODULE_PARM_DESC(poll_max_ns, "upper bound of the busy-poll budget (ns)");
+
+static unsigned int poll_grow_start_ns = 10000;
+module_param(poll_grow_start_ns, uint, 0644);
+MODULE_PARM_DESC(poll_grow_start_ns, "first non-zero adaptive budget (ns)");
+
+static kvm_ivshmem_channel channels[KVM_IVSHMEM_NCHANNELS];
 
 static kvm_ivshmem_device kvm_ivshmem_dev;
 
@@ -68,7 +152,45 @@ static ssize_t kvm_ivshmem_read(struct file *, char *, size_t, loff_t *);
 static ssize_t kvm_ivshmem_write(struct file *, const char *, size_t, loff_t *);
 static loff_t kvm_ivshmem_lseek(struct file * filp, loff_t offset, int origin);
 
-enum ivshmem_ioctl { set_sema, down_sema, empty, wait_event, wait_event_irq, read_ivposn, read_livelist, sema_irq };
+enum ivshmem_ioctl { set_sema, down_sema, empty, wait_event, wait_event_irq, read_ivposn, read_livelist, sema_irq, multi_irq, bind_eventfd, set_poll };
+
+/*
+ * bind_eventfd takes a pointer to a kvm_ivshmem_irqfd.  The interrupt
+ * handler signals the eventfd every time the given vector fires (with
+ * pin-based interrupts there is only vector 0).  An fd of -1 unbinds the
+ * vector; bindings are also dropped when the binding file is closed.
+ */
+struct kvm_ivshmem_irqfd {
+	__s32 fd;
+	__u32 vector;
+};
+
+/* set_poll takes a pointer to a kvm_ivshmem_poll */
+struct kvm_ivshmem_poll {
+	__u32 channel;
+	__u32 mode;		/* POLL_OFF, POLL_FIXED or POLL_ADAPTIVE */
+	__u32 budget_ns;	/* the fixed budget, or the adaptive start */
+};
+
+/*
+ * multi_irq takes a pointer to a kvm_ivshmem_batch describing an array of
+ * (peer, vector) pairs, where vector carries the command (sema_irq,
+ * wait_event_irq) in its low byte and the channel index in its high byte.
+ * Every distinct pair is rung once; the result of each entry is written back
+ * to its error field (0 when the doorbell was rung, -EALREADY for a repeat of
+ * an earlier entry, -EINVAL when the pair does not fit in a doorbell message).
+ */
+struct kvm_ivshmem_doorbell {
+	__u16 peer;
+	__u16 vector;
+	__s32 error;
+};
+
+struct kvm_ivshmem_batch {
+	__u32 count;
+	__u32 pad;
+	__u64 entries;	/* user pointer to count kvm_ivshmem_doorbell */
+};
 
 static const struct file_operations kvm_ivshmem_ops = {
 	.owner   = THIS_MODULE,
@@ -98,55 +220,250 @@ static struct pci_driver kvm_ivshmem_pci_driver = {
 	.remove	  = kvm_ivshmem_remove_device,
 };
 
+static int kvm_ivshmem_ring_batch(unsigned long arg)
+{
+	struct kvm_ivshmem_batch batch;
+	struct kvm_ivshmem_doorbell *db;
+	uint32_t msg;
+	size_t size;
+	int rung = 0;
+	int i, j;
+
+	if (copy_from_user(&batch, (void __user *) arg, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.count == 0)
+		return 0;
+	if (batch.count > KVM_IVSHMEM_MAX_BATCH)
+		return -E2BIG;
+
+	size = batch.count * sizeof(*db);
+	db = kmalloc(size, GFP_KERNEL);
+	if (!db)
+		return -ENOMEM;
+
+	if (copy_from_user(db, (void __user *)(unsigned long) batch.entries, size)) {
+		kfree(db);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		db[i].error = 0;
+
+		if (db[i].peer > 0xff ||
+				(db[i].vector & 0xff) > KVM_IVSHMEM_CMD_MASK ||
+				(db[i].vector >> 8) >= KVM_IVSHMEM_NCHANNELS) {
+			db[i].error = -EINVAL;
+			continue;
+		}
+
+		/* the batch is small, so a quadratic scan is cheaper than a set */
+		for (j = 0; j < i; j++) {
+			if (db[j].error == 0 && db[j].peer == db[i].peer &&
+					db[j].vector == db[i].vector) {
+				db[i].error = -EALREADY;
+				break;
+			}
+		}
+		if (db[i].error)
+			continue;
+
+		msg = KVM_IVSHMEM_MSG(db[i].peer, db[i].vector >> 8, db[i].vector);
+		trace_kvm_ivshmem_doorbell(db[i].peer, db[i].vector >> 8,
+				db[i].vector & KVM_IVSHMEM_CMD_MASK, msg);
+		writel(msg, kvm_ivshmem_dev.regs + Doorbell);
+		rung++;
+	}
+
+	if (copy_to_user((void __user *)(unsigned long) batch.entries, db, size))
+		rung = -EFAULT;
+
+	kfree(db);
+	return rung;
+}
+
+/* unbind v, or only if owner bound it when owner is not NULL */
+static void kvm_ivshmem_unbind_vector(kvm_ivshmem_vector *v,
+						struct file *owner)
+{
+	struct eventfd_ctx *old = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&kvm_ivshmem_dev.eventfd_lock, flags);
+	if (!owner || v->owner == owner) {
+		old = v->eventfd;
+		v->eventfd = NULL;
+		v->owner = NULL;
+	}
+	spin_unlock_irqrestore(&kvm_ivshmem_dev.eventfd_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+}
+
+static int kvm_ivshmem_bind_eventfd(struct file *filp, unsigned long arg)
+{
+	struct kvm_ivshmem_irqfd irqfd;
+	struct eventfd_ctx *ctx, *old;
+	kvm_ivshmem_vector *v;
+	unsigned long flags;
+
+	if (copy_from_user(&irqfd, (void __user *) arg, sizeof(irqfd)))
+		return -EFAULT;
+
+	if (irqfd.vector >= kvm_ivshmem_dev.nvectors)
+		return -EINVAL;
+	v = &kvm_ivshmem_dev.vectors[irqfd.vector];
+
+	if (irqfd.fd < 0) {
+		kvm_ivshmem_unbind_vector(v, NULL);
+		return 0;
+	}
+
+	ctx = eventfd_ctx_fdget(irqfd.fd);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	spin_lock_irqsave(&kvm_ivshmem_dev.eventfd_lock, flags);
+	old = v->eventfd;
+	v->eventfd = ctx;
+	v->owner = filp;
+	spin_unlock_irqrestore(&kvm_ivshmem_dev.eventfd_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+
+	return 0;
+}
+
+static int kvm_ivshmem_set_poll(unsigned long arg)
+{
+	struct kvm_ivshmem_poll poll;
+	kvm_ivshmem_channel *ch;
+
+	if (copy_from_user(&poll, (void __user *) arg, sizeof(poll)))
+		return -EFAULT;
+
+	if (poll.channel >= KVM_IVSHMEM_NCHANNELS || poll.mode > POLL_ADAPTIVE)
+		return -EINVAL;
+
+	ch = &channels[poll.channel];
+	ch->poll_mode = poll.mode;
+	ch->poll_ns = min(poll.budget_ns, poll_max_ns);
+
+	return 0;
+}
+
+/* true when cmd's pending flag is already set (and consumed) */
+static bool kvm_ivshmem_pending(kvm_ivshmem_channel *ch, unsigned int cmd)
+{
+	if (cmd == down_sema)
+		return down_trylock(&ch->sema) == 0;
+
+	return ACCESS_ONCE(ch->event_num) == 1;
+}
+
+/* spin on the pending flag for the channel's budget before sleeping */
+static bool kvm_ivshmem_poll(kvm_ivshmem_channel *ch, unsigned int cmd,
+						u64 start)
+{
+	unsigned int budget = ch->poll_ns;
+
+	if (ch->poll_mode == POLL_OFF || budget == 0)
+		return false;
+
+	do {
+		if (kvm_ivshmem_pending(ch, cmd))
+			return true;
+		if (need_resched() || signal_pending(current))
+			break;
+		cpu_relax();
+	} while (ktime_to_ns(ktime_get()) - start < budget);
+
+	return false;
+}
+
+/* grow or shrink the adaptive budget after a waiter had to sleep */
+static void kvm_ivshmem_adapt_poll(kvm_ivshmem_channel *ch, u64 waited)
+{
+	unsigned int budget = ch->poll_ns;
+
+	if (ch->poll_mode != POLL_ADAPTIVE)
+		return;
+
+	if (waited <= poll_max_ns) {
+		budget = budget ? budget * 2 : poll_grow_start_ns;
+		if (budget > poll_max_ns)
+			budget = poll_max_ns;
+	} else {
+		budget /= 2;
+	}
+
+	ch->poll_ns = budget;
+}
+
 static int kvm_ivshmem_ioctl(struct inode * ino, struct file * filp,
 			unsigned int cmd, unsigned long arg)
 {
 
 	int rv;
 	uint32_t msg;
+	kvm_ivshmem_channel *ch;
+	unsigned int index = KVM_IVSHMEM_ARG_INDEX(arg);
+	u64 start;
+
+	/* read_ivposn, multi_irq, bind_eventfd and set_poll pass a pointer,
+	 * not a channel argument */
+	if (index >= KVM_IVSHMEM_NCHANNELS && cmd != read_ivposn &&
+			cmd != multi_irq && cmd != bind_eventfd && cmd != set_poll)
+		return -EINVAL;
+	ch = &channels[index % KVM_IVSHMEM_NCHANNELS];
 
-	printk("KVM_IVSHMEM: args is %ld\n", arg);
 #if 1
 	switch (cmd) {
 		case set_sema:
-			printk("KVM_IVSHMEM: initialize semaphore\n");
-			printk("KVM_IVSHMEM: args is %ld\n", arg);
-			sema_init(&sema, arg);
+			sema_init(&ch->sema, KVM_IVSHMEM_ARG_VALUE(arg));
 			break;
 		case down_sema:
-			printk("KVM_IVSHMEM: sleeping on semaphore (cmd = %d)\n", cmd);
-			rv = down_interruptible(&sema);
-			printk("KVM_IVSHMEM: waking\n");
+			start = ktime_to_ns(ktime_get());
+			if (kvm_ivshmem_poll(ch, cmd, start)) {
+				trace_kvm_ivshmem_wakeup(index, cmd, 0);
+				break;
+			}
+			rv = down_interruptible(&ch->sema);
+			kvm_ivshmem_adapt_poll(ch, ktime_to_ns(ktime_get()) - start);
+			trace_kvm_ivshmem_wakeup(index, cmd, rv);
 			break;
 		case empty:
-			msg = ((arg & 0xff) << 8) + (cmd & 0xff);
-			printk("KVM_IVSHMEM: args is %ld\n", arg);
-			printk("KVM_IVSHMEM: ringing sema doorbell\n");
+		case wait_event_irq:
+		case sema_irq:
+			msg = KVM_IVSHMEM_MSG(arg, index, cmd);
+			trace_kvm_ivshmem_doorbell(arg & 0xff, index, cmd, msg);
 			writel(msg, kvm_ivshmem_dev.regs + Doorbell);
 			break;
 		case wait_event:
-			printk("KVM_IVSHMEM: sleeping on event (cmd = %d)\n", cmd);
-			wait_event_interruptible(wait_queue, (event_num == 1));
-			printk("KVM_IVSHMEM: waking\n");
-			event_num = 0;
-			break;
-		case wait_event_irq:
-			msg = ((arg & 0xff) << 8) + (cmd & 0xff);
-			printk("KVM_IVSHMEM: ringing wait_event doorbell on %d (msg = %d)\n", arg, msg);
-			writel(msg, kvm_ivshmem_dev.regs + Doorbell);
+			start = ktime_to_ns(ktime_get());
+			if (kvm_ivshmem_poll(ch, cmd, start)) {
+				trace_kvm_ivshmem_wakeup(index, cmd, 0);
+				ch->event_num = 0;
+				break;
+			}
+			rv = wait_event_interruptible(ch->wait_queue,
+						(ch->event_num == 1));
+			kvm_ivshmem_adapt_poll(ch, ktime_to_ns(ktime_get()) - start);
+			trace_kvm_ivshmem_wakeup(index, cmd, rv);
+			ch->event_num = 0;
 			break;
 		case read_ivposn:
 			msg = readl( kvm_ivshmem_dev.regs + IVPosition);
-			printk("KVM_IVSHMEM: my posn is %d\n", msg);
 			rv = copy_to_user(arg, &msg, sizeof(msg));
 			break;
-		case sema_irq:
-			// 2 is the actual code, but we use 7 from the user
-			msg = ((arg & 0xff) << 8) + (cmd & 0xff);
-			printk("KVM_IVSHMEM: args is %ld\n", arg);
-			printk("KVM_IVSHMEM: ringing sema doorbell\n");
-			writel(msg, kvm_ivshmem_dev.regs + Doorbell);
-			break;
+		case multi_irq:
+			return kvm_ivshmem_ring_batch(arg);
+		case bind_eventfd:
+			return kvm_ivshmem_bind_eventfd(filp, arg);
+		case set_poll:
+			return kvm_ivshmem_set_poll(arg);
 		default:
 			printk("KVM_IVSHMEM: bad ioctl (\n");
 	}
@@ -236,28 +553,94 @@ static ssize_t kvm_ivshmem_write(struct file * filp, const char * buffer,
 	return len;
 }
 
+static void kvm_ivshmem_signal_vector(kvm_ivshmem_vector *v)
+{
+	spin_lock(&v->dev->eventfd_lock);
+	if (v->eventfd)
+		eventfd_signal(v->eventfd, 1);
+	spin_unlock(&v->dev->eventfd_lock);
+}
+
+static void kvm_ivshmem_count_irq(struct kvm_ivshmem_device *dev, int index)
+{
+	this_cpu_inc(dev->stats[index].irqs);
+	this_cpu_write(dev->stats[index].last_ns, ktime_to_ns(ktime_get()));
+}
+
+/* one line per vector: "<vector> <irqs> <spurious> <last_ns>" */
+static ssize_t kvm_ivshmem_irq_stats_show(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	kvm_ivshmem_irq_stats *st;
+	u64 irqs, spurious, last;
+	ssize_t len = 0;
+	int i, cpu;
+
+	for (i = 0; i < max(kvm_ivshmem_dev.nvectors, 1); i++) {
+		irqs = spurious = last = 0;
+		for_each_possible_cpu(cpu) {
+			st = per_cpu_ptr(kvm_ivshmem_dev.stats, cpu) + i;
+			irqs += st->irqs;
+			spurious += st->spurious;
+			last = max(last, st->last_ns);
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %llu %llu %llu\n",
+				i, (unsigned long long)irqs,
+				(unsigned long long)spurious,
+				(unsigned long long)last);
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR(irq_stats, S_IRUGO, kvm_ivshmem_irq_stats_show, NULL);
+
 static irqreturn_t kvm_ivshmem_interrupt (int irq, void *dev_instance)
 {
 	struct kvm_ivshmem_device * dev = dev_instance;
+	kvm_ivshmem_channel *ch;
 	u32 status;
 
 	if (unlikely(dev == NULL))
 		return IRQ_NONE;
 
 	status = readl(dev->regs + IntrStatus);
-	if (!status || (status == 0xFFFFFFFF))
+	trace_kvm_ivshmem_irq(irq, status);
+	if (!status || (status == 0xFFFFFFFF)) {
+		if (!dev->msix_enabled)
+			this_cpu_inc(dev->stats[0].spurious);
 		return IRQ_NONE;
+	}
 
-	/* depending on the message we wake different structures */
-	if (status == sema_irq) {
-		up(&sema);
-	} else if (status == wait_event_irq) {
-		event_num = 1;
-		wake_up_interruptible(&wait_queue);
+	/* pin-based interrupts all arrive on vector 0 */
+	if (!dev->msix_enabled) {
+		kvm_ivshmem_count_irq(dev, 0);
+		if (dev->nvectors)
+			kvm_ivshmem_signal_vector(&dev->vectors[0]);
 	}
 
-	printk(KERN_INFO "KVM_IVSHMEM: interrupt (status = 0x%04x)\n",
-		   status);
+	/* the channel index selects the structure, the command what to do */
+	ch = &channels[(status >> KVM_IVSHMEM_CMD_BITS) % KVM_IVSHMEM_NCHANNELS];
+
+	if ((status & KVM_IVSHMEM_CMD_MASK) == sema_irq) {
+		up(&ch->sema);
+	} else if ((status & KVM_IVSHMEM_CMD_MASK) == wait_event_irq) {
+		ch->event_num = 1;
+		wake_up_interruptible(&ch->wait_queue);
+	}
+
+	return IRQ_HANDLED;
+}
+
+static irqreturn_t kvm_ivshmem_msix_interrupt (int irq, void *opaque)
+{
+	kvm_ivshmem_vector *v = opaque;
+
+	kvm_ivshmem_count_irq(v->dev, v->index);
+	kvm_ivshmem_signal_vector(v);
+
+	/* MSI-X vectors are not shared, whatever the status register says */
+	kvm_ivshmem_interrupt(irq, v->dev);
 
 	return IRQ_HANDLED;
 }
@@ -275,9 +658,16 @@ static int request_msix_vectors(struct kvm_ivshmem_device *ivs_info, int nvector
 					   GFP_KERNEL);
 	ivs_info->msix_names = kmalloc(nvectors * sizeof *ivs_info->msix_names,
 					 GFP_KERNEL);
+	ivs_info->vectors = kzalloc(nvectors * sizeof *ivs_info->vectors,
+					 GFP_KERNEL);
+	if (!ivs_info->vectors)
+		return -ENOMEM;
 
-	for (i = 0; i < nvectors; ++i)
+	for (i = 0; i < nvectors; ++i) {
 		ivs_info->msix_entries[i].entry = i;
+		ivs_info->vectors[i].dev = ivs_info;
+		ivs_info->vectors[i].index = i;
+	}
 
 	err = pci_enable_msix(ivs_info->dev, ivs_info->msix_entries,
 					ivs_info->nvectors);
@@ -297,8 +687,8 @@ static int request_msix_vectors(struct kvm_ivshmem_device *ivs_info, int nvector
 		 "%s-config", name);
 
 		err = request_irq(ivs_info->msix_entries[i].vector,
-				  kvm_ivshmem_interrupt, 0,
-				  ivs_info->msix_names[i], ivs_info);
+				  kvm_ivshmem_msix_interrupt, 0,
+				  ivs_info->msix_names[i], &ivs_info->vectors[i]);
 
 		if (err) {
 			printk(KERN_INFO "couldn't allocate irq for msi-x entry %d with vector %d\n", i, ivs_info->msix_entries[i].vector);
@@ -306,13 +696,14 @@ static int request_msix_vectors(struct kvm_ivshmem_device *ivs_info, int nvector
 		}
 	}
 
+	ivs_info->msix_enabled = TRUE;
 	return 0;
 }
 
 static int kvm_ivshmem_probe_device (struct pci_dev *pdev,
 					const struct pci_device_id * ent) {
 
-	int result;
+	int result, i;
 
 	printk("KVM_IVSHMEM: Probing for KVM_IVSHMEM Device\n");
 
@@ -360,14 +751,28 @@ static int kvm_ivshmem_probe_device (struct pci_dev *pdev,
 	/* set all masks to on */
 	writel(0xffffffff, kvm_ivshmem_dev.regs + IntrMask);
 
-	/* by default initialize semaphore to 0 */
-	sema_init(&sema, 0);
+	/* by default initialize semaphores to 0 */
+	for (i = 0; i < KVM_IVSHMEM_NCHANNELS; i++) {
+		sema_init(&channels[i].sema, 0);
+		init_waitqueue_head(&channels[i].wait_queue);
+		channels[i].event_num = 0;
+		channels[i].poll_mode = POLL_OFF;
+		channels[i].poll_ns = 0;
+	}
 
-	init_waitqueue_head(&wait_queue);
-	event_num = 0;
+	spin_lock_init(&kvm_ivshmem_dev.eventfd_lock);
 
-	if (request_msix_vectors(&kvm_ivshmem_dev, 4) != 0) {
+	kvm_ivshmem_dev.stats = __alloc_percpu(KVM_IVSHMEM_NVECTORS *
+			sizeof(kvm_ivshmem_irq_stats),
+			__alignof__(kvm_ivshmem_irq_stats));
+	if (!kvm_ivshmem_dev.stats) {
+		printk(KERN_ERR "KVM_IVSHMEM: cannot allocate irq statistics\n");
+		goto regs_unmap;
+	}
+
+	if (request_msix_vectors(&kvm_ivshmem_dev, KVM_IVSHMEM_NVECTORS) != 0) {
 		printk(KERN_INFO "regular IRQs\n");
+		kvm_ivshmem_dev.nvectors = kvm_ivshmem_dev.vectors ? 1 : 0;
 		if (request_irq(pdev->irq, kvm_ivshmem_interrupt, IRQF_SHARED,
 							"kvm_ivshmem", &kvm_ivshmem_dev)) {
 			printk(KERN_ERR "KVM_IVSHMEM: cannot get interrupt %d\n", pdev->irq);
@@ -378,9 +783,14 @@ static int kvm_ivshmem_probe_device (struct pci_dev *pdev,
 		printk(KERN_INFO "MSI-X enabled\n");
 	}
 
+	if (device_create_file(&pdev->dev, &dev_attr_irq_stats))
+		printk(KERN_ERR "KVM_IVSHMEM: cannot create irq_stats attribute\n");
+
 	return 0;
 
 
+regs_unmap:
+	pci_iounmap(pdev, kvm_ivshmem_dev.regs);
 reg_release:
 	pci_iounmap(pdev, kvm_ivshmem_dev.base_addr);
 pci_release:
@@ -394,12 +804,32 @@ pci_disable:
 static void kvm_ivshmem_remove_device(struct pci_dev* pdev)
 {
 
+	int i;
+
 	printk(KERN_INFO "Unregister kvm_ivshmem device.\n");
-	free_irq(pdev->irq,&kvm_ivshmem_dev);
+	device_remove_file(&pdev->dev, &dev_attr_irq_stats);
+	for (i = 0; i < kvm_ivshmem_dev.nvectors; i++)
+		kvm_ivshmem_unbind_vector(&kvm_ivshmem_dev.vectors[i], NULL);
+	if (kvm_ivshmem_dev.msix_enabled) {
+		for (i = 0; i < kvm_ivshmem_dev.nvectors; i++)
+			free_irq(kvm_ivshmem_dev.msix_entries[i].vector,
+				 &kvm_ivshmem_dev.vectors[i]);
+		pci_disable_msix(pdev);
+		kvm_ivshmem_dev.msix_enabled = FALSE;
+	} else
+		free_irq(pdev->irq,&kvm_ivshmem_dev);
+	kfree(kvm_ivshmem_dev.vectors);
+	kfree(kvm_ivshmem_dev.msix_entries);
+	kfree(kvm_ivshmem_dev.msix_names);
+	kvm_ivshmem_dev.vectors = NULL;
+	kvm_ivshmem_dev.msix_entries = NULL;
+	kvm_ivshmem_dev.msix_names = NULL;
+	kvm_ivshmem_dev.nvectors = 0;
 	pci_iounmap(pdev, kvm_ivshmem_dev.regs);
 	pci_iounmap(pdev, kvm_ivshmem_dev.base_addr);
 	pci_release_regions(pdev);
 	pci_disable_device(pdev);
+	free_percpu(kvm_ivshmem_dev.stats);
 
 }
 
@@ -453,6 +883,12 @@ static int kvm_ivshmem_open(struct inode * inode, struct file * filp)
 static int kvm_ivshmem_release(struct inode * inode, struct file * filp)
 {
 
+   int i;
+
+   /* drop the eventfds this file bound */
+   for (i = 0; i < kvm_ivshmem_dev.nvectors; i++)
+	  kvm_ivshmem_unbind_vector(&kvm_ivshmem_dev.vectors[i], filp);
+
    return 0;
 }
 
@@ -0,0 +1,101 @@
+/*
+ * Tracepoints for the kvm_ivshmem doorbell and interrupt paths.
+ *
+ * The doorbell-to-wakeup latency can be measured by enabling
+ * kvm_ivshmem:kvm_ivshmem_doorbell in the sending guest and
+ * kvm_ivshmem:kvm_ivshmem_irq/kvm_ivshmem_wakeup in the receiving one.  The
+ * ts field is CLOCK_MONOTONIC in nanoseconds.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kvm_ivshmem
+
+#if !defined(_KVM_IVSHMEM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KVM_IVSHMEM_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+TRACE_EVENT(kvm_ivshmem_doorbell,
+
+	TP_PROTO(unsigned int peer, unsigned int channel, unsigned int cmd,
+		 u32 msg),
+
+	TP_ARGS(peer, channel, cmd, msg),
+
+	TP_STRUCT__entry(
+		__field(unsigned int,	peer)
+		__field(unsigned int,	channel)
+		__field(unsigned int,	cmd)
+		__field(u32,		msg)
+		__field(u64,		ts)
+	),
+
+	TP_fast_assign(
+		__entry->peer = peer;
+		__entry->channel = channel;
+		__entry->cmd = cmd;
+		__entry->msg = msg;
+		__entry->ts = ktime_to_ns(ktime_get());
+	),
+
+	TP_printk("peer=%u channel=%u cmd=%u msg=0x%04x ts=%llu",
+		  __entry->peer, __entry->channel, __entry->cmd, __entry->msg,
+		  (unsigned long long)__entry->ts)
+);
+
+TRACE_EVENT(kvm_ivshmem_irq,
+
+	TP_PROTO(int irq, u32 status),
+
+	TP_ARGS(irq, status),
+
+	TP_STRUCT__entry(
+		__field(int,		irq)
+		__field(u32,		status)
+		__field(u64,		ts)
+	),
+
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->status = status;
+		__entry->ts = ktime_to_ns(ktime_get());
+	),
+
+	TP_printk("irq=%d status=0x%04x ts=%llu",
+		  __entry->irq, __entry->status,
+		  (unsigned long long)__entry->ts)
+);
+
+TRACE_EVENT(kvm_ivshmem_wakeup,
+
+	TP_PROTO(unsigned int channel, unsigned int cmd, int rv),
+
+	TP_ARGS(channel, cmd, rv),
+
+	TP_STRUCT__entry(
+		__field(unsigned int,	channel)
+		__field(unsigned int,	cmd)
+		__field(int,		rv)
+		__field(u64,		ts)
+	),
+
+	TP_fast_assign(
+		__entry->channel = channel;
+		__entry->cmd = cmd;
+		__entry->rv = rv;
+		__entry->ts = ktime_to_ns(ktime_get());
+	),
+
+	TP_printk("channel=%u cmd=%u rv=%d ts=%llu",
+		  __entry->channel, __entry->cmd, __entry->rv,
+		  (unsigned long long)__entry->ts)
+);
+
+#endif /* _KVM_IVSHMEM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE kvm_ivshmem_trace
+#include <trace/define_trace.h>
@@ -9,33 +9,158 @@
  */
 
 #include <linux/device.h>
+#include <linux/huge_mm.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/percpu.h>
+#include <linux/pfn_t.h>
 #include <linux/uio_driver.h>
+#include <linux/version.h>
 
 #include <asm/io.h>
 
+#define CREATE_TRACE_POINTS
+#include "uio_ivshmem_trace.h"
+
 #define IntrStatus 0x04
 #define IntrMask 0x00
 
+#define IVSHMEM_MAX_VECTORS 64
+
+static int nvectors = 4;
+module_param(nvectors, int, 0444);
+MODULE_PARM_DESC(nvectors, "number of MSI-X vectors to request (default 4)");
+
+/* vector_cpus=2,2,3 hints vector 0 and 1 to CPU 2 and vector 2 to CPU 3 */
+static int vector_cpus[IVSHMEM_MAX_VECTORS];
+static int nr_vector_cpus;
+module_param_array(vector_cpus, int, &nr_vector_cpus, 0444);
+MODULE_PARM_DESC(vector_cpus, "per-vector CPU affinity hints");
+
+static bool threaded;
+module_param(threaded, bool, 0444);
+MODULE_PARM_DESC(threaded, "handle MSI-X vectors in IRQ threads");
+
+/*
+ * BAR2 is RAM on the host side, so there is no reason for userspace to map
+ * it uncached the way the UIO core maps every UIO_MEM_PHYS region.
+ * bar2_cached=0 restores the old uncached mapping for comparison.
+ */
+static bool bar2_cached = true;
+module_param(bar2_cached, bool, 0444);
+MODULE_PARM_DESC(bar2_cached, "map BAR2 write-back into userspace (default 1)");
+
+/*
+ * Huge PFN mappings need vmf_insert_pfn_pmd()/_pud() taking the vm_fault,
+ * which appeared in 5.2.  huge_fault takes a page order instead of an
+ * enum page_entry_size from 6.6, and vm_flags is set through
+ * vm_flags_set() from 6.3.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0) && \
+	defined(CONFIG_TRANSPARENT_HUGEPAGE)
+#define IVSHMEM_HUGE_FAULT
+#endif
+
+static bool bar2_huge = true;
+module_param(bar2_huge, bool, 0444);
+MODULE_PARM_DESC(bar2_huge, "map BAR2 with 2M/1G entries where aligned (default 1)");
+
+/*
+ * Every vector counts its interrupts in a page that userspace maps as the
+ * third UIO region (mmap offset 2 * getpagesize()).  Word 0 holds the number
+ * of vectors, word 1 + i the running interrupt count of vector i, so one load
+ * per vector tells a reader which vectors fired since it last looked.
+ */
+struct ivshmem_vector_counts {
+	u32 nvectors;
+	u32 count[];
+};
+
+struct ivshmem_vector {
+	struct ivshmem_info *ivs;
+	int index;
+};
+
+/*
+ * Per-CPU, per-vector interrupt statistics, summed up by the irq_stats
+ * attribute.  spurious counts pin-based interrupts that found IntrStatus
+ * clear; last_ns is the ktime_get() time of the last interrupt on that CPU.
+ */
+struct ivshmem_irq_stats {
+	u64 irqs;
+	u64 spurious;
+	u64 last_ns;
+};
+
 struct ivshmem_info {
 	struct uio_info *uio;
 	struct pci_dev *dev;
 	char (*msix_names)[256];
 	struct msix_entry *msix_entries;
+	struct ivshmem_vector *vectors;
+	struct ivshmem_vector_counts *counts;
+	struct ivshmem_irq_stats __percpu *stats;
+	int nstats;
 	int nvectors;
 };
 
+static void ivshmem_count_vector(struct ivshmem_info *ivs, int index)
+{
+	u32 *count = &ivs->counts->count[index];
+
+	/* one writer per vector, readers only ever load the word */
+	WRITE_ONCE(*count, *count + 1);
+
+	this_cpu_inc(ivs->stats[index].irqs);
+	this_cpu_write(ivs->stats[index].last_ns, ktime_get_ns());
+}
+
+/* one line per vector: "<vector> <irqs> <spurious> <last_ns>" */
+static ssize_t irq_stats_show(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	struct uio_info *info = pci_get_drvdata(to_pci_dev(d));
+	struct ivshmem_info *ivs = info->priv;
+	struct ivshmem_irq_stats *st;
+	u64 irqs, spurious, last;
+	ssize_t len = 0;
+	int i, cpu;
+
+	for (i = 0; i < ivs->nvectors; i++) {
+		irqs = spurious = last = 0;
+		for_each_possible_cpu(cpu) {
+			st = per_cpu_ptr(ivs->stats, cpu) + i;
+			irqs += st->irqs;
+			spurious += st->spurious;
+			last = max(last, st->last_ns);
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %llu %llu %llu\n",
+				i, irqs, spurious, last);
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(irq_stats);
+
 static irqreturn_t ivshmem_handler(int irq, struct uio_info *dev_info)
 {
 
 	void __iomem *plx_intscr = dev_info->mem[0].internal_addr
 					+ IntrStatus;
+	struct ivshmem_info *ivs = dev_info->priv;
 	u32 val;
 
 	val = readl(plx_intscr);
-	if (val == 0)
+	trace_uio_ivshmem_irq(irq, 0, val);
+	if (val == 0) {
+		this_cpu_inc(ivs->stats[0].spurious);
 		return IRQ_NONE;
+	}
+
+	/* pin-based interrupts all count against vector 0 */
+	ivshmem_count_vector(ivs, 0);
 
 	return IRQ_HANDLED;
 }
@@ -43,20 +168,149 @@ static irqreturn_t ivshmem_handler(int irq, struct uio_info *dev_info)
 static irqreturn_t ivshmem_msix_handler(int irq, void *opaque)
 {
 
-	struct uio_info * dev_info = (struct uio_info *) opaque;
+	struct ivshmem_vector * vector = (struct ivshmem_vector *) opaque;
+	struct ivshmem_info * ivs = vector->ivs;
+
+	trace_uio_ivshmem_irq(irq, vector->index, 0);
+
+	ivshmem_count_vector(ivs, vector->index);
 
 	/* we have to do this explicitly when using MSI-X */
-	uio_event_notify(dev_info);
+	uio_event_notify(ivs->uio);
 	return IRQ_HANDLED;
 }
 
+#ifdef IVSHMEM_HUGE_FAULT
+/*
+ * Fault BAR2 in with the largest entry the alignment of both the user
+ * address and the BAR allows; the core retries with the next smaller size
+ * on VM_FAULT_FALLBACK.  vm_pgoff holds the UIO region index, not an offset,
+ * so the offset into the BAR comes from vm_start.
+ */
+static vm_fault_t ivshmem_bar2_map(struct vm_fault *vmf, unsigned long size)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct uio_info *info = vma->vm_private_data;
+	unsigned long addr;
+	phys_addr_t phys;
+
+	addr = vmf->address & ~(size - 1);
+	phys = info->mem[1].addr + (addr - vma->vm_start);
+
+	if (addr < vma->vm_start || addr + size > vma->vm_end ||
+	    (phys & (size - 1)))
+		return VM_FAULT_FALLBACK;
+
+	if (size == PMD_SIZE)
+		return vmf_insert_pfn_pmd(vmf, phys_to_pfn_t(phys, PFN_DEV),
+					vmf->flags & FAULT_FLAG_WRITE);
+#ifdef CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD
+	if (size == PUD_SIZE)
+		return vmf_insert_pfn_pud(vmf, phys_to_pfn_t(phys, PFN_DEV),
+					vmf->flags & FAULT_FLAG_WRITE);
+#endif
+	return vmf_insert_pfn(vma, addr, phys >> PAGE_SHIFT);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+static vm_fault_t ivshmem_bar2_huge_fault(struct vm_fault *vmf,
+					unsigned int order)
+{
+	if (order == 0)
+		return ivshmem_bar2_map(vmf, PAGE_SIZE);
+	if (order == PMD_SHIFT - PAGE_SHIFT)
+		return ivshmem_bar2_map(vmf, PMD_SIZE);
+#ifdef CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD
+	if (order == PUD_SHIFT - PAGE_SHIFT)
+		return ivshmem_bar2_map(vmf, PUD_SIZE);
+#endif
+	return VM_FAULT_FALLBACK;
+}
+#else
+static vm_fault_t ivshmem_bar2_huge_fault(struct vm_fault *vmf,
+					enum page_entry_size pe_size)
+{
+	switch (pe_size) {
+	case PE_SIZE_PTE:
+		return ivshmem_bar2_map(vmf, PAGE_SIZE);
+	case PE_SIZE_PMD:
+		return ivshmem_bar2_map(vmf, PMD_SIZE);
+#ifdef CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD
+	case PE_SIZE_PUD:
+		return ivshmem_bar2_map(vmf, PUD_SIZE);
+#endif
+	default:
+		return VM_FAULT_FALLBACK;
+	}
+}
+#endif
+
+static vm_fault_t ivshmem_bar2_fault(struct vm_fault *vmf)
+{
+	return ivshmem_bar2_map(vmf, PAGE_SIZE);
+}
+
+static const struct vm_operations_struct ivshmem_bar2_vm_ops = {
+	.fault = ivshmem_bar2_fault,
+	.huge_fault = ivshmem_bar2_huge_fault,
+};
+#endif
+
+/*
+ * Replaces the UIO core's mmap so BAR2 can be mapped write-back.  The
+ * ioremap_cache() mapping made in probe holds the write-back memtype
+ * reservation for the BAR, so the user mapping agrees with it.
+ */
+static int ivshmem_mmap(struct uio_info *info, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int mi = vma->vm_pgoff;
+
+	switch (mi) {
+	case 0:
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		return io_remap_pfn_range(vma, vma->vm_start,
+				info->mem[0].addr >> PAGE_SHIFT, size,
+				vma->vm_page_prot);
+	case 1:
+		if (!bar2_cached)
+			vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+#ifdef IVSHMEM_HUGE_FAULT
+		else if (bar2_huge) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+			vm_flags_set(vma, VM_PFNMAP | VM_IO | VM_DONTEXPAND |
+					  VM_DONTDUMP | VM_HUGEPAGE);
+#else
+			vma->vm_flags |= VM_PFNMAP | VM_IO | VM_DONTEXPAND |
+					 VM_DONTDUMP | VM_HUGEPAGE;
+#endif
+			vma->vm_private_data = info;
+			vma->vm_ops = &ivshmem_bar2_vm_ops;
+			return 0;
+		}
+#endif
+		return io_remap_pfn_range(vma, vma->vm_start,
+				info->mem[1].addr >> PAGE_SHIFT, size,
+				vma->vm_page_prot);
+	case 2:
+		return remap_pfn_range(vma, vma->vm_start,
+				virt_to_phys((void *)info->mem[2].addr) >> PAGE_SHIFT,
+				size, vma->vm_page_prot);
+	default:
+		return -EINVAL;
+	}
+}
+
 static void free_msix_vectors(struct ivshmem_info *ivs_info,
 							const int max_vector)
 {
 	int i;
 
-	for (i = 0; i < max_vector; i++)
-		free_irq(ivs_info->msix_entries[i].vector, ivs_info->uio);
+	for (i = 0; i < max_vector; i++) {
+		irq_set_affinity_hint(ivs_info->msix_entries[i].vector, NULL);
+		free_irq(ivs_info->msix_entries[i].vector,
+					&ivs_info->vectors[i]);
+	}
 }
 
 static int request_msix_vectors(struct ivshmem_info *ivs_info, int nvectors)
@@ -64,6 +318,9 @@ static int request_msix_vectors(struct ivshmem_info *ivs_info, int nvectors)
 	int i, err;
 	const char *name = "ivshmem";
 
+	if (nvectors < 1 || nvectors > IVSHMEM_MAX_VECTORS)
+		return -EINVAL;
+
 	ivs_info->nvectors = nvectors;
 
 	ivs_info->msix_entries = kmalloc(nvectors * sizeof *
@@ -79,8 +336,19 @@ static int request_msix_vectors(struct ivshmem_info *ivs_info, int nvectors)
 		return -ENOSPC;
 	}
 
-	for (i = 0; i < nvectors; ++i)
+	ivs_info->vectors = kmalloc(nvectors * sizeof *ivs_info->vectors,
+			GFP_KERNEL);
+	if (ivs_info->vectors == NULL) {
+		kfree(ivs_info->msix_entries);
+		kfree(ivs_info->msix_names);
+		return -ENOSPC;
+	}
+
+	for (i = 0; i < nvectors; ++i) {
 		ivs_info->msix_entries[i].entry = i;
+		ivs_info->vectors[i].ivs = ivs_info;
+		ivs_info->vectors[i].index = i;
+	}
 
 	err = pci_enable_msix(ivs_info->dev, ivs_info->msix_entries,
 					ivs_info->nvectors);
@@ -101,23 +369,41 @@ static int request_msix_vectors(struct ivshmem_info *ivs_info, int nvectors)
 	for (i = 0; i < ivs_info->nvectors; i++) {
 
 		snprintf(ivs_info->msix_names[i], sizeof *ivs_info->msix_names,
-			"%s-config", name);
+			"%s-%s-%d", name, pci_name(ivs_info->dev), i);
 
-		err = request_irq(ivs_info->msix_entries[i].vector,
-			ivshmem_msix_handler, 0,
-			ivs_info->msix_names[i], ivs_info->uio);
+		if (threaded)
+			err = request_threaded_irq(ivs_info->msix_entries[i].vector,
+				NULL, ivshmem_msix_handler, IRQF_ONESHOT,
+				ivs_info->msix_names[i], &ivs_info->vectors[i]);
+		else
+			err = request_irq(ivs_info->msix_entries[i].vector,
+				ivshmem_msix_handler, 0,
+				ivs_info->msix_names[i], &ivs_info->vectors[i]);
 
 		if (err) {
-			free_msix_vectors(ivs_info, i - 1);
+			free_msix_vectors(ivs_info, i);
+			pci_disable_msix(ivs_info->dev);
 			goto error;
 		}
 
+		if (i >= nr_vector_cpus)
+			continue;
+		if (vector_cpus[i] < 0 || vector_cpus[i] >= nr_cpu_ids ||
+				!cpu_online(vector_cpus[i])) {
+			dev_warn(&ivs_info->dev->dev,
+				 "vector %d: cpu %d is not online, no affinity hint\n",
+				 i, vector_cpus[i]);
+			continue;
+		}
+		irq_set_affinity_hint(ivs_info->msix_entries[i].vector,
+				      cpumask_of(vector_cpus[i]));
 	}
 
 	return 0;
 error:
 	kfree(ivs_info->msix_entries);
 	kfree(ivs_info->msix_names);
+	kfree(ivs_info->vectors);
 	return err;
 
 }
@@ -127,7 +413,6 @@ static int ivshmem_pci_probe(struct pci_dev *dev,
 {
 	struct uio_info *info;
 	struct ivshmem_info * ivshmem_info;
-	int nvectors = 4;
 
 	info = kzalloc(sizeof(struct uio_info), GFP_KERNEL);
 	if (!info)
@@ -175,8 +460,26 @@ static int ivshmem_pci_probe(struct pci_dev *dev,
 	info->mem[1].size = pci_resource_len(dev, 2);
 	info->mem[1].memtype = UIO_MEM_PHYS;
 
+	ivshmem_info->counts = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!ivshmem_info->counts)
+		goto out_unmap2;
+
+	info->mem[2].name = "vector_counts";
+	info->mem[2].addr = (unsigned long)ivshmem_info->counts;
+	info->mem[2].size = PAGE_SIZE;
+	info->mem[2].memtype = UIO_MEM_LOGICAL;
+
 	ivshmem_info->uio = info;
 	ivshmem_info->dev = dev;
+	info->priv = ivshmem_info;
+
+	/* sized for every vector that may be requested, or vector 0 on INTx */
+	ivshmem_info->nstats = clamp(nvectors, 1, IVSHMEM_MAX_VECTORS);
+	ivshmem_info->stats = __alloc_percpu(ivshmem_info->nstats *
+			sizeof(struct ivshmem_irq_stats),
+			__alignof__(struct ivshmem_irq_stats));
+	if (!ivshmem_info->stats)
+		goto out_free_counts;
 
 	if (request_msix_vectors(ivshmem_info, nvectors) != 0) {
 		printk(KERN_INFO "regular IRQs\n");
@@ -184,23 +487,33 @@ static int ivshmem_pci_probe(struct pci_dev *dev,
 		info->irq_flags = IRQF_SHARED;
 		info->handler = ivshmem_handler;
 		writel(0xffffffff, info->mem[0].internal_addr + IntrMask);
+		ivshmem_info->nvectors = 1;
 	} else {
 		printk(KERN_INFO "MSI-X enabled\n");
 		info->irq = -1;
 	}
 
+	ivshmem_info->counts->nvectors = ivshmem_info->nvectors;
+
 	info->name = "ivshmem";
 	info->version = "0.0.1";
+	info->mmap = ivshmem_mmap;
 
 	if (uio_register_device(&dev->dev, info))
-		goto out_unmap2;
+		goto out_free_stats;
 
 	pci_set_drvdata(dev, info);
 
+	if (device_create_file(&dev->dev, &dev_attr_irq_stats))
+		dev_warn(&dev->dev, "cannot create irq_stats attribute\n");
 
 	return 0;
+out_free_stats:
+	free_percpu(ivshmem_info->stats);
+out_free_counts:
+	free_page((unsigned long)ivshmem_info->counts);
 out_unmap2:
-	iounmap(info->mem[2].internal_addr);
+	iounmap(info->mem[1].internal_addr);
 out_unmap:
 	iounmap(info->mem[0].internal_addr);
 out_release:
@@ -216,10 +529,23 @@ static void ivshmem_pci_remove(struct pci_dev *dev)
 {
 	struct uio_info *info = pci_get_drvdata(dev);
 
+	struct ivshmem_info *ivshmem_info = info->priv;
+
+	device_remove_file(&dev->dev, &dev_attr_irq_stats);
 	uio_unregister_device(info);
+	if (info->irq == UIO_IRQ_CUSTOM) {
+		free_msix_vectors(ivshmem_info, ivshmem_info->nvectors);
+		pci_disable_msix(dev);
+		kfree(ivshmem_info->msix_entries);
+		kfree(ivshmem_info->msix_names);
+		kfree(ivshmem_info->vectors);
+	}
 	pci_release_regions(dev);
 	pci_disable_device(dev);
 	iounmap(info->mem[0].internal_addr);
+	iounmap(info->mem[1].internal_addr);
+	free_page((unsigned long)ivshmem_info->counts);
+	free_percpu(ivshmem_info->stats);
 
 	kfree (info);
 }
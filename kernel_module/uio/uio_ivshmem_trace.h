@@ -0,0 +1,49 @@
+/*
+ * Tracepoints for the uio_ivshmem interrupt path.
+ *
+ * Doorbells are rung from userspace through the mapped registers, so only
+ * interrupt entry is visible here.  The ts field is CLOCK_MONOTONIC in
+ * nanoseconds.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM uio_ivshmem
+
+#if !defined(_UIO_IVSHMEM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _UIO_IVSHMEM_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+TRACE_EVENT(uio_ivshmem_irq,
+
+	TP_PROTO(int irq, int vector, u32 status),
+
+	TP_ARGS(irq, vector, status),
+
+	TP_STRUCT__entry(
+		__field(int,		irq)
+		__field(int,		vector)
+		__field(u32,		status)
+		__field(u64,		ts)
+	),
+
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->vector = vector;
+		__entry->status = status;
+		__entry->ts = ktime_to_ns(ktime_get());
+	),
+
+	TP_printk("irq=%d vector=%d status=0x%04x ts=%llu",
+		  __entry->irq, __entry->vector, __entry->status,
+		  (unsigned long long)__entry->ts)
+);
+
+#endif /* _UIO_IVSHMEM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE uio_ivshmem_trace
+#include <trace/define_trace.h>
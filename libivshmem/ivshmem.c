@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include "ivshmem.h"
+#include "ivshmem_host.h"
+
+const char * ivshmem_strings[] = { "SET_SEMA", "DOWN_SEMA", "EMPTY", "WAIT_EVENT", "WAIT_EVENT_IRQ", "GET_POSN", "GET_LIVELIST", "SEMA_IRQ", "MULTI_IRQ", "BIND_EVENTFD", "SET_POLL" };
+
+/* the region size uio_ivshmem registered, from /sys/class/uio/uioN/maps */
+static size_t uio_region_size(const char * path)
+{
+
+    char name[256], buf[64];
+    char * copy;
+    size_t size = 0;
+    FILE * f;
+
+    copy = strdup(path);
+    snprintf(name, sizeof(name), "/sys/class/uio/%s/maps/map1/size",
+                basename(copy));
+    free(copy);
+
+    if ((f = fopen(name, "r")) == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), f))
+        size = strtoul(buf, NULL, 0);
+    fclose(f);
+
+    return size;
+}
+
+static int open_uio(struct ivshmem_dev * dev, const char * path, size_t size)
+{
+
+    void * map;
+    int i;
+
+    if ((dev->fd = open(path, O_RDWR)) < 0)
+        return -1;
+
+    map = mmap(NULL, 256, PROT_READ|PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    dev->regs = (volatile uint32_t *) map;
+    dev->posn = dev->regs[IVPosition / sizeof(uint32_t)];
+
+    if (size == 0 && (size = uio_region_size(path)) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* With UIO drivers, the offset selects the memory region beginning at 0 and counting by page offsets */
+    dev->mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, dev->fd,
+                        1 * getpagesize());
+    if (dev->mem == MAP_FAILED) {
+        dev->mem = NULL;
+        return -1;
+    }
+    dev->size = size;
+
+    /* drivers without the counts page only have read()'s total */
+    map = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, dev->fd,
+                        2 * getpagesize());
+    if (map == MAP_FAILED) {
+        dev->nvectors = 1;
+    } else {
+        dev->counts = (volatile struct ivshmem_vector_counts *) map;
+        dev->nvectors = dev->counts->nvectors;
+    }
+
+    if ((dev->last = calloc(dev->nvectors, sizeof(uint32_t))) == NULL)
+        return -1;
+    for (i = 0; dev->counts && i < dev->nvectors; i++)
+        dev->last[i] = dev->counts->count[i];
+
+    return 0;
+}
+
+static int open_kvm(struct ivshmem_dev * dev, const char * path, size_t size)
+{
+
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((dev->fd = open(path, O_RDWR)) < 0)
+        return -1;
+
+    dev->mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (dev->mem == MAP_FAILED) {
+        dev->mem = NULL;
+        return -1;
+    }
+    dev->size = size;
+
+    if ((dev->posn = ivshmem_recv(dev->fd, GET_POSN)) < 0)
+        return -1;
+    dev->nvectors = IVSHMEM_NCHANNELS;
+
+    return 0;
+}
+
+int ivshmem_open(struct ivshmem_dev * dev, const char * path, size_t size,
+                 int nvectors)
+{
+
+    struct stat st;
+    char * copy;
+    int rv;
+
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = -1;
+
+    if (stat(path, &st) < 0)
+        return -1;
+
+    copy = strdup(path);
+    if (S_ISSOCK(st.st_mode)) {
+        dev->type = IVSHMEM_HOST;
+        rv = ivshmem_host_open(dev, path, size, nvectors > 0 ? nvectors : 1);
+    } else if (strncmp(basename(copy), "uio", 3) == 0) {
+        dev->type = IVSHMEM_UIO;
+        rv = open_uio(dev, path, size);
+    } else {
+        dev->type = IVSHMEM_KVM;
+        rv = open_kvm(dev, path, size);
+    }
+    free(copy);
+
+    if (rv < 0) {
+        int err = errno;
+
+        ivshmem_close(dev);
+        errno = err;
+    }
+
+    return rv;
+}
+
+void ivshmem_close(struct ivshmem_dev * dev)
+{
+
+    if (dev->type == IVSHMEM_HOST)
+        ivshmem_host_close(dev);
+
+    if (dev->mem)
+        munmap(dev->mem, dev->size);
+    if (dev->regs)
+        munmap((void *)dev->regs, 256);
+    if (dev->counts)
+        munmap((void *)dev->counts, getpagesize());
+    free(dev->last);
+    if (dev->fd >= 0)
+        close(dev->fd);
+
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = -1;
+}
+
+int ivshmem_doorbell_slow(struct ivshmem_dev * dev, int peer, int vector)
+{
+
+    switch (dev->type) {
+    case IVSHMEM_KVM:
+        return ivshmem_send(dev->fd, WAIT_EVENT_IRQ, IVSHMEM_ARG(vector, peer));
+    case IVSHMEM_HOST:
+        return ivshmem_host_doorbell(dev, peer, vector);
+    default:
+        errno = ENODEV;
+        return -1;
+    }
+}
+
+static int uio_wait(struct ivshmem_dev * dev, int vector, int block)
+{
+
+    uint32_t now;
+    int buf, rv;
+
+    if (vector < 0 || vector >= dev->nvectors) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* without the counts page every interrupt counts for vector 0 */
+    if (dev->counts == NULL) {
+        if (!block) {
+            errno = ENOSYS;
+            return -1;
+        }
+        if (read(dev->fd, &buf, sizeof(buf)) != sizeof(buf))
+            return -1;
+        rv = buf - dev->last[0];
+        dev->last[0] = buf;
+        return rv;
+    }
+
+    for (;;) {
+        now = dev->counts->count[vector];
+        if (now != dev->last[vector] || !block)
+            break;
+
+        /* read() returns as soon as any vector fires after our last read,
+         * so an interrupt between the load above and here is not lost */
+        if (read(dev->fd, &buf, sizeof(buf)) < 0 && errno != EINTR)
+            return -1;
+    }
+
+    rv = now - dev->last[vector];
+    dev->last[vector] = now;
+
+    return rv;
+}
+
+int ivshmem_wait(struct ivshmem_dev * dev, int vector)
+{
+
+    switch (dev->type) {
+    case IVSHMEM_UIO:
+        return uio_wait(dev, vector, 1);
+    case IVSHMEM_KVM:
+        if (ivshmem_send(dev->fd, WAIT_EVENT, IVSHMEM_ARG(vector, 0)) < 0)
+            return -1;
+        return 1;
+    case IVSHMEM_HOST:
+        return ivshmem_host_wait(dev, vector, 1);
+    default:
+        errno = ENODEV;
+        return -1;
+    }
+}
+
+int ivshmem_trywait(struct ivshmem_dev * dev, int vector)
+{
+
+    switch (dev->type) {
+    case IVSHMEM_UIO:
+        return uio_wait(dev, vector, 0);
+    case IVSHMEM_HOST:
+        return ivshmem_host_wait(dev, vector, 0);
+    default:
+        errno = ENOSYS;
+        return -1;
+    }
+}
+
+int ivshmem_update(struct ivshmem_dev * dev)
+{
+
+    if (dev->type != IVSHMEM_HOST)
+        return 0;
+
+    return ivshmem_host_update(dev, 0);
+}
+
+/* the standard driver's ioctls */
+
+int ivshmem_recv(int fd, int ivshmem_cmd)
+{
+
+    int rv, buf;
+
+    buf = 0;
+
+#ifdef DEBUG
+    printf("[RECVIOCTL] %s\n", ivshmem_strings[ivshmem_cmd]);
+#endif
+    rv = ioctl(fd, ivshmem_cmd, &buf);
+
+    if (rv < 0)
+        return rv;
+
+    return buf;
+
+}
+
+int ivshmem_send(int fd, int ivshmem_cmd, int arg)
+{
+
+    int rv;
+
+    rv = ioctl(fd, ivshmem_cmd, arg);
+
+#ifdef DEBUG
+    printf("[SENDIOCTL] %s rv is %d\n", ivshmem_strings[ivshmem_cmd], rv);
+#endif
+
+    return rv;
+}
+
+/* ring every (peer, vector) pair in db with a single ioctl.  Returns the
+ * number of doorbells rung, per-entry results are left in db[i].error */
+int ivshmem_send_batch(int fd, struct ivshmem_doorbell * db, int count)
+{
+
+    struct ivshmem_batch batch;
+    int rv;
+
+    batch.count = count;
+    batch.pad = 0;
+    batch.entries = (uint64_t)(unsigned long)db;
+
+    rv = ioctl(fd, MULTI_IRQ, &batch);
+
+#ifdef DEBUG
+    printf("[SENDIOCTL] %s rv is %d\n", ivshmem_strings[MULTI_IRQ], rv);
+#endif
+
+    return rv;
+}
+
+int ivshmem_print_opts(void)
+{
+
+    int i;
+
+    for (i = 0; i <= SET_POLL; i++) {
+        printf ("%s: %d\n", ivshmem_strings[i], i);
+    }
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#ifndef IVSHMEM_HDR
+#define IVSHMEM_HDR
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libivshmem: one way to open the shared memory device, whichever of the
+ * three ways it is reached:
+ *
+ *   IVSHMEM_UIO   /dev/uioN from uio_ivshmem; registers at mmap offset 0,
+ *                 the region at one page, per-vector counts at two pages
+ *   IVSHMEM_KVM   /dev/kvm_ivshmem from the standard driver; doorbells and
+ *                 waits go through the ioctls below, vector n is channel n
+ *   IVSHMEM_HOST  a host process connected to ivshmem_server's unix socket;
+ *                 the region is the server's shm object and doorbells are
+ *                 writes to the peers' eventfds
+ *
+ * ivshmem_open() tells them apart from the path.  After that, ringing a peer
+ * is ivshmem_doorbell() and waiting for one is ivshmem_wait(), whatever the
+ * type.
+ */
+
+enum ivshmem_type { IVSHMEM_UIO, IVSHMEM_KVM, IVSHMEM_HOST };
+
+/* BAR0 register offsets, see device_spec.txt */
+enum ivshmem_registers {
+    IntrMask = 0,
+    IntrStatus = 4,
+    IVPosition = 8,
+    Doorbell = 12,
+    IVLiveList = 16
+};
+
+/* per-vector interrupt counts, mapped from uio_ivshmem's third UIO region */
+struct ivshmem_vector_counts {
+    uint32_t nvectors;
+    uint32_t count[];
+};
+
+struct ivshmem_dev {
+    int type;
+    int fd;                 /* the device, or the server socket */
+    int posn;               /* our peer number */
+    int nvectors;
+
+    volatile uint32_t * regs;   /* UIO only, NULL otherwise */
+    void * mem;
+    size_t size;
+
+    /* UIO: the driver's counts and what ivshmem_wait() has consumed */
+    volatile struct ivshmem_vector_counts * counts;
+    uint32_t * last;
+
+    /* HOST: eventfds of every peer, efds[peer * nvectors + vector] */
+    int * efds;
+    int npeers;
+};
+
+/*
+ * Open path and map size bytes of the region (0 maps all of it; the
+ * standard driver cannot report its size, so it needs an explicit one).
+ * nvectors only matters for IVSHMEM_HOST, where it has to match the
+ * server's -n.  Returns 0, or -1 with errno set.
+ */
+int ivshmem_open(struct ivshmem_dev * dev, const char * path, size_t size,
+                 int nvectors);
+void ivshmem_close(struct ivshmem_dev * dev);
+
+static inline int ivshmem_posn(const struct ivshmem_dev * dev)
+{
+    return dev->posn;
+}
+
+int ivshmem_doorbell_slow(struct ivshmem_dev * dev, int peer, int vector);
+
+/*
+ * Interrupt vector on peer.  With UIO this is one store to the doorbell
+ * register; the release fence keeps the compiler from sinking earlier
+ * stores to the region below it (x86 does not reorder stores, so no
+ * instruction is emitted).
+ */
+static inline int ivshmem_doorbell(struct ivshmem_dev * dev, int peer,
+                                   int vector)
+{
+    if (dev->regs) {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        dev->regs[Doorbell / sizeof(uint32_t)] =
+                    ((uint32_t)peer << 16) | (vector & 0xffff);
+        return 0;
+    }
+
+    return ivshmem_doorbell_slow(dev, peer, vector);
+}
+
+/* body of spin-wait loops on the region */
+static inline void ivshmem_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#else
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+/*
+ * Block until vector has fired at least once since the last call and
+ * return how many times it did, or -1 on error.  ivshmem_trywait() is the
+ * same without blocking and returns 0 when nothing arrived; the standard
+ * driver has no way to do that and fails with ENOSYS.
+ */
+int ivshmem_wait(struct ivshmem_dev * dev, int vector);
+int ivshmem_trywait(struct ivshmem_dev * dev, int vector);
+
+/*
+ * IVSHMEM_HOST: take in peers that joined or left since the last call.
+ * ivshmem_doorbell() does this by itself when it meets an unknown peer.
+ * Returns the number of updates read or -1.
+ */
+int ivshmem_update(struct ivshmem_dev * dev);
+
+/*
+ * Raw interface of the standard driver (/dev/kvm_ivshmem).  The command
+ * numbers must match its enum.
+ */
+enum ivshmem_ioctl { SET_SEMA, DOWN_SEMA, EMPTY, WAIT_EVENT, WAIT_EVENT_IRQ, GET_POSN, GET_LIVELIST, SEMA_IRQ, MULTI_IRQ, BIND_EVENTFD, SET_POLL };
+
+/* the driver has IVSHMEM_NCHANNELS independent semaphore/event pairs; the
+ * channel index goes in bits 16-23 of the ioctl argument */
+#define IVSHMEM_NCHANNELS 32
+#define IVSHMEM_ARG(channel, value) (((channel) << 16) | ((value) & 0xffff))
+
+/* doorbell vector for MULTI_IRQ entries: command plus channel index */
+#define IVSHMEM_VECTOR(channel, cmd) (((channel) << 8) | (cmd))
+
+/* must match struct kvm_ivshmem_doorbell/kvm_ivshmem_batch in the driver */
+struct ivshmem_doorbell {
+    uint16_t peer;
+    uint16_t vector;
+    int32_t error;
+};
+
+struct ivshmem_batch {
+    uint32_t count;
+    uint32_t pad;
+    uint64_t entries;
+};
+
+/*
+ * BIND_EVENTFD takes an interrupt vector, not a channel: the driver has
+ * KVM_IVSHMEM_NVECTORS of them with MSI-X and one with pin interrupts.
+ */
+#define IVSHMEM_KVM_NVECTORS 4
+
+/* must match struct kvm_ivshmem_irqfd in the driver, fd -1 unbinds */
+struct ivshmem_irqfd {
+    int32_t fd;
+    uint32_t vector;
+};
+
+/* busy-poll modes for WAIT_EVENT/DOWN_SEMA, must match the driver */
+enum ivshmem_poll_mode { POLL_OFF, POLL_FIXED, POLL_ADAPTIVE };
+
+struct ivshmem_poll {
+    uint32_t channel;
+    uint32_t mode;
+    uint32_t budget_ns;
+};
+
+extern const char * ivshmem_strings[];
+
+int ivshmem_send(int fd, int ivshmem_cmd, int arg);
+int ivshmem_recv(int fd, int ivshmem_cmd);
+int ivshmem_send_batch(int fd, struct ivshmem_doorbell * db, int count);
+int ivshmem_print_opts(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_barrier.h"
+
+static void init_nodes(struct ivshmem_sync_node * node)
+{
+    memset(node, 0, sizeof(struct ivshmem_sync_node) * IVSHMEM_SYNC_MAX_PARTIES);
+}
+
+/* claim the first free node below max */
+static int attach_node(struct ivshmem_sync_peer * p,
+                       struct ivshmem_sync_node * nodes, int max,
+                       struct ivshmem_dev * dev, int vector)
+{
+
+    uint32_t id = ((uint32_t)ivshmem_posn(dev) << 16 | vector) + 1;
+    uint32_t free;
+    int i;
+
+    p->nodes = nodes;
+    p->dev = dev;
+    p->vector = vector;
+    p->spin = IVSHMEM_SYNC_SPIN;
+
+    for (i = 0; i < max; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&nodes[i].id, &free, id, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p->id = i;
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+static int reached(const uint32_t * word, uint32_t target)
+{
+    return (int32_t)(__atomic_load_n(word, __ATOMIC_ACQUIRE) - target) >= 0;
+}
+
+/* wait for *word to reach target: spin, then sleep on our doorbell */
+static int park(struct ivshmem_sync_peer * p, const uint32_t * word,
+                uint32_t target)
+{
+
+    struct ivshmem_sync_node * me = &p->nodes[p->id];
+    int i;
+
+    for (i = 0; i < p->spin; i++) {
+        if (reached(word, target))
+            return 0;
+        ivshmem_relax();
+    }
+
+    for (;;) {
+        /* either the releaser's store comes first and we see it here, or
+         * it sees sleeping after its store */
+        __atomic_store_n(&me->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (reached(word, target)) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        p->sleeps++;
+        if (ivshmem_wait(p->dev, p->vector) < 0) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (reached(word, target)) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+}
+
+/* ring party i if it has gone to sleep; its flag is already stored */
+static void wake(struct ivshmem_sync_peer * p, int i)
+{
+
+    struct ivshmem_sync_node * node = &p->nodes[i];
+    uint32_t id;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&node->sleeping, __ATOMIC_RELAXED) ||
+            !__atomic_exchange_n(&node->sleeping, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    /* it may have seen its flag and detached in the meantime */
+    if (!(id = __atomic_load_n(&node->id, __ATOMIC_RELAXED)))
+        return;
+    id--;
+    ivshmem_doorbell(p->dev, id >> 16, id & 0xffff);
+    p->doorbells++;
+}
+
+static void wake_all(struct ivshmem_sync_peer * p, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (i != p->id)
+            wake(p, i);
+}
+
+void ivshmem_barrier_init(struct ivshmem_barrier * b,
+                          enum ivshmem_barrier_kind kind, int nparties)
+{
+    __atomic_store_n(&b->magic, 0, __ATOMIC_RELAXED);
+    b->kind = kind;
+    b->nparties = nparties;
+    for (b->rounds = 0; (1 << b->rounds) < nparties; b->rounds++)
+        ;
+    b->count = nparties;
+    b->episode = 0;
+    init_nodes(b->node);
+    __atomic_store_n(&b->magic, IVSHMEM_BARRIER_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_barrier_attach(struct ivshmem_sync_peer * p, void * mem,
+                           struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_barrier * b = mem;
+
+    if (__atomic_load_n(&b->magic, __ATOMIC_ACQUIRE) != IVSHMEM_BARRIER_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->b = b;
+    p->episode = __atomic_load_n(&b->episode, __ATOMIC_ACQUIRE);
+
+    return attach_node(p, b->node, b->nparties, dev, vector);
+}
+
+void ivshmem_barrier_detach(struct ivshmem_sync_peer * p)
+{
+    __atomic_store_n(&p->nodes[p->id].id, 0, __ATOMIC_RELEASE);
+}
+
+static int central_wait(struct ivshmem_sync_peer * p)
+{
+
+    struct ivshmem_barrier * b = p->b;
+    uint32_t episode = ++p->episode;
+
+    if (__atomic_sub_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* nobody touches count again until they see the new episode */
+        __atomic_store_n(&b->count, b->nparties, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->episode, episode, __ATOMIC_RELEASE);
+        wake_all(p, b->nparties);
+        return 0;
+    }
+
+    return park(p, &b->episode, episode);
+}
+
+static int dissemination_wait(struct ivshmem_sync_peer * p)
+{
+
+    struct ivshmem_barrier * b = p->b;
+    struct ivshmem_sync_node * me = &p->nodes[p->id];
+    uint32_t episode = ++p->episode, r;
+    int partner;
+
+    /*
+     * Flags only grow, so a partner that races ahead into the next
+     * episode just bumps a flag we are about to find reached anyway.
+     */
+    for (r = 0; r < b->rounds; r++) {
+        partner = (p->id + (1 << r)) % b->nparties;
+        __atomic_store_n(&p->nodes[partner].flag[r], episode, __ATOMIC_RELEASE);
+        wake(p, partner);
+        if (park(p, &me->flag[r], episode) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int ivshmem_barrier_wait(struct ivshmem_sync_peer * p)
+{
+    if (p->b->kind == IVSHMEM_BARRIER_DISSEMINATION)
+        return dissemination_wait(p);
+    return central_wait(p);
+}
+
+void ivshmem_latch_init(struct ivshmem_latch * l, int count)
+{
+    __atomic_store_n(&l->magic, 0, __ATOMIC_RELAXED);
+    l->count = count;
+    l->open = count <= 0;
+    init_nodes(l->node);
+    __atomic_store_n(&l->magic, IVSHMEM_LATCH_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_latch_attach(struct ivshmem_sync_peer * p, void * mem,
+                         struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_latch * l = mem;
+
+    if (__atomic_load_n(&l->magic, __ATOMIC_ACQUIRE) != IVSHMEM_LATCH_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->l = l;
+
+    return attach_node(p, l->node, IVSHMEM_SYNC_MAX_PARTIES, dev, vector);
+}
+
+void ivshmem_latch_detach(struct ivshmem_sync_peer * p)
+{
+    __atomic_store_n(&p->nodes[p->id].id, 0, __ATOMIC_RELEASE);
+}
+
+void ivshmem_latch_count_down(struct ivshmem_sync_peer * p, int n)
+{
+
+    struct ivshmem_latch * l = p->l;
+    int32_t left = __atomic_sub_fetch(&l->count, n, __ATOMIC_ACQ_REL);
+
+    /* only the count that crosses zero opens it */
+    if (left <= 0 && left + n > 0) {
+        __atomic_store_n(&l->open, 1, __ATOMIC_RELEASE);
+        wake_all(p, IVSHMEM_SYNC_MAX_PARTIES);
+    }
+}
+
+int ivshmem_latch_wait(struct ivshmem_sync_peer * p)
+{
+    return park(p, &p->l->open, 1);
+}
@@ -0,0 +1,119 @@
+#ifndef IVSHMEM_BARRIER_HDR
+#define IVSHMEM_BARRIER_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Phase synchronisation between peers in different VMs: barriers for a
+ * fixed set of parties and a one-shot countdown latch.
+ *
+ * Every party has a node, one cache line in the region, which it claims at
+ * attach.  It spins on flags there for a while and then sleeps on its own
+ * doorbell vector after setting the node's sleeping word.  Whoever releases
+ * it stores the flag and then, only if sleeping was set, clears it and
+ * rings the doorbell.
+ *
+ * Two barrier algorithms are offered, chosen at init:
+ *
+ *  CENTRAL is the sense-reversing counter barrier.  Each party decrements
+ *  the count; the last one resets it and publishes the next episode.
+ *  Instead of one sense bit, the "sense" is the episode number, which every
+ *  party also counts locally.  Cheap for a few parties, but all of them hit
+ *  the count line and the last arrival has to wake every sleeper.
+ *
+ *  DISSEMINATION takes ceil(log2 n) rounds.  In round r, party i signals
+ *  party (i + 2^r) mod n and waits for party (i - 2^r) mod n.  Each party
+ *  only writes one other node per round and only waits on its own, so the
+ *  wakeups are spread over all the parties.
+ *
+ * The latch opens once ivshmem_latch_count_down() has been called count
+ * times in total, and stays open until it is initialised again.
+ */
+
+#define IVSHMEM_BARRIER_MAGIC 0x42415252    /* "BARR" */
+#define IVSHMEM_LATCH_MAGIC 0x4c415443      /* "LATC" */
+#define IVSHMEM_SYNC_MAX_PARTIES 64
+#define IVSHMEM_BARRIER_ROUNDS 6            /* log2 of the above */
+#define IVSHMEM_SYNC_SPIN 4096
+
+enum ivshmem_barrier_kind {
+    IVSHMEM_BARRIER_CENTRAL,
+    IVSHMEM_BARRIER_DISSEMINATION,
+};
+
+struct ivshmem_sync_node {
+    uint32_t flag[IVSHMEM_BARRIER_ROUNDS] __attribute__((aligned(64)));
+    uint32_t sleeping;
+    uint32_t id;                /* (posn << 16 | vector) + 1, or 0 */
+};
+
+struct ivshmem_barrier {
+    uint32_t count __attribute__((aligned(64)));
+    uint32_t episode __attribute__((aligned(64)));
+
+    uint32_t magic __attribute__((aligned(64)));
+    uint32_t kind;
+    uint32_t nparties;
+    uint32_t rounds;
+
+    struct ivshmem_sync_node node[IVSHMEM_SYNC_MAX_PARTIES];
+};
+
+struct ivshmem_latch {
+    int32_t count __attribute__((aligned(64)));
+    uint32_t open __attribute__((aligned(64)));
+
+    uint32_t magic __attribute__((aligned(64)));
+    struct ivshmem_sync_node node[IVSHMEM_SYNC_MAX_PARTIES];
+};
+
+/* one per party and barrier or latch; lives in private memory */
+struct ivshmem_sync_peer {
+    struct ivshmem_barrier * b;
+    struct ivshmem_latch * l;
+    struct ivshmem_sync_node * nodes;
+    struct ivshmem_dev * dev;
+    int vector;
+    int id;                     /* our node */
+    int spin;                   /* polls before sleeping */
+    uint32_t episode;
+
+    unsigned long sleeps;
+    unsigned long doorbells;
+};
+
+void ivshmem_barrier_init(struct ivshmem_barrier * b,
+                          enum ivshmem_barrier_kind kind, int nparties);
+
+/*
+ * Parties are numbered in the order they attach.  -1 with EAGAIN before
+ * init, ENOSPC when nparties have already attached.
+ */
+int ivshmem_barrier_attach(struct ivshmem_sync_peer * p, void * mem,
+                           struct ivshmem_dev * dev, int vector);
+void ivshmem_barrier_detach(struct ivshmem_sync_peer * p);
+
+/* 0 once every party has arrived, -1 if waiting on the device failed */
+int ivshmem_barrier_wait(struct ivshmem_sync_peer * p);
+
+void ivshmem_latch_init(struct ivshmem_latch * l, int count);
+int ivshmem_latch_attach(struct ivshmem_sync_peer * p, void * mem,
+                         struct ivshmem_dev * dev, int vector);
+void ivshmem_latch_detach(struct ivshmem_sync_peer * p);
+void ivshmem_latch_count_down(struct ivshmem_sync_peer * p, int n);
+int ivshmem_latch_wait(struct ivshmem_sync_peer * p);
+
+static inline int ivshmem_latch_is_open(const struct ivshmem_sync_peer * p)
+{
+    return __atomic_load_n(&p->l->open, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_buf.h"
+
+ivshmem_slab_t ivshmem_buf_alloc(struct ivshmem_slab_cache * cache, size_t size)
+{
+
+    ivshmem_slab_t h;
+    struct ivshmem_buf * b;
+
+    if (!(h = ivshmem_slab_alloc(cache, size + sizeof(struct ivshmem_buf))))
+        return 0;
+
+    b = ivshmem_buf(cache->heap, h);
+    b->size = ivshmem_slab_size(cache->heap, h) - sizeof(struct ivshmem_buf);
+    __atomic_store_n(&b->refs, 1, __ATOMIC_RELAXED);
+
+    return h;
+}
+
+int ivshmem_sg_add(const struct ivshmem_slab * heap, struct ivshmem_sg_list * l,
+                   ivshmem_slab_t buf, uint32_t off, uint32_t len)
+{
+
+    struct ivshmem_sg * sg;
+
+    if (l->n == IVSHMEM_SG_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if ((uint64_t)off + len > ivshmem_buf(heap, buf)->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ivshmem_buf_get(heap, buf, 1);
+    sg = &l->sg[l->n++];
+    sg->buf = buf;
+    sg->off = off;
+    sg->len = len;
+    l->total += len;
+
+    return 0;
+}
+
+void ivshmem_sg_share(const struct ivshmem_slab * heap,
+                      const struct ivshmem_sg_list * l, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < l->n; i++)
+        ivshmem_buf_get(heap, l->sg[i].buf, n);
+}
+
+void ivshmem_sg_release(struct ivshmem_slab_cache * cache,
+                        struct ivshmem_sg_list * l)
+{
+    uint32_t i;
+
+    for (i = 0; i < l->n; i++)
+        ivshmem_buf_put(cache, l->sg[i].buf);
+    ivshmem_sg_init(l);
+}
+
+size_t ivshmem_sg_copy(const struct ivshmem_slab * heap,
+                       const struct ivshmem_sg_list * l, void * dst, size_t len)
+{
+
+    char * d = dst;
+    size_t n, done = 0;
+    uint32_t i;
+
+    for (i = 0; i < l->n && done < len; i++) {
+        n = l->sg[i].len;
+        if (n > len - done)
+            n = len - done;
+        memcpy(d + done, (char *)ivshmem_buf_data(heap, l->sg[i].buf) +
+                         l->sg[i].off, n);
+        done += n;
+    }
+
+    return done;
+}
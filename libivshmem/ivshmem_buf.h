@@ -0,0 +1,117 @@
+#ifndef IVSHMEM_BUF_HDR
+#define IVSHMEM_BUF_HDR
+#include <stdint.h>
+#include <stddef.h>
+#include "ivshmem_slab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reference-counted buffers and scatter-gather descriptor lists, so data
+ * is written into the region once and read in place by however many
+ * consumers need it.
+ *
+ * Buffers come from a shared slab heap (ivshmem_slab.h) and are named by
+ * the same offset handles.  A small header in front of the data holds the
+ * reference count.  A buffer starts with one reference, and it goes back to
+ * the heap when the last one is dropped, whichever peer drops it.
+ *
+ * A descriptor list names up to IVSHMEM_SG_MAX (buffer, offset, length)
+ * fragments, so one message can gather parts of several buffers.  It is
+ * plain data and small enough to send through an SPSC or MPMC queue.  Each
+ * fragment holds one reference on its buffer, so a producer builds its
+ * lists and then drops the reference it got from ivshmem_buf_alloc().
+ * ivshmem_sg_share() adds the references for extra copies of a list before
+ * it goes to several consumers, and every consumer calls
+ * ivshmem_sg_release() when done.
+ */
+
+#define IVSHMEM_SG_MAX 16
+
+struct ivshmem_buf {
+    uint32_t refs;
+    uint32_t size;              /* bytes of data the buffer can hold */
+    uint8_t data[];
+};
+
+struct ivshmem_sg {
+    ivshmem_slab_t buf;
+    uint32_t off;
+    uint32_t len;
+};
+
+struct ivshmem_sg_list {
+    uint32_t n;
+    uint32_t total;             /* sum of the fragment lengths */
+    struct ivshmem_sg sg[IVSHMEM_SG_MAX];
+};
+
+static inline struct ivshmem_buf * ivshmem_buf(const struct ivshmem_slab * heap,
+                                               ivshmem_slab_t h)
+{
+    return (struct ivshmem_buf *)ivshmem_slab_ptr(heap, h);
+}
+
+static inline void * ivshmem_buf_data(const struct ivshmem_slab * heap,
+                                      ivshmem_slab_t h)
+{
+    return ivshmem_buf(heap, h)->data;
+}
+
+/* a buffer of at least size bytes with one reference; 0 and errno if none */
+ivshmem_slab_t ivshmem_buf_alloc(struct ivshmem_slab_cache * cache, size_t size);
+
+static inline void ivshmem_buf_get(const struct ivshmem_slab * heap,
+                                   ivshmem_slab_t h, uint32_t n)
+{
+    __atomic_fetch_add(&ivshmem_buf(heap, h)->refs, n, __ATOMIC_RELAXED);
+}
+
+/* drop one reference, freeing the buffer with the last */
+static inline void ivshmem_buf_put(struct ivshmem_slab_cache * cache,
+                                   ivshmem_slab_t h)
+{
+    /* the release orders our reads of the data before its reuse */
+    if (__atomic_sub_fetch(&ivshmem_buf(cache->heap, h)->refs, 1,
+                           __ATOMIC_ACQ_REL) == 0)
+        ivshmem_slab_free(cache, h);
+}
+
+static inline void ivshmem_sg_init(struct ivshmem_sg_list * l)
+{
+    l->n = 0;
+    l->total = 0;
+}
+
+/*
+ * Append a fragment, taking a reference on its buffer for the list.
+ * -1 with ENOSPC when the list is full, EINVAL if it overruns the buffer.
+ */
+int ivshmem_sg_add(const struct ivshmem_slab * heap, struct ivshmem_sg_list * l,
+                   ivshmem_slab_t buf, uint32_t off, uint32_t len);
+
+/* take the references for n more copies of the list */
+void ivshmem_sg_share(const struct ivshmem_slab * heap,
+                      const struct ivshmem_sg_list * l, uint32_t n);
+
+/* drop the list's references and empty it */
+void ivshmem_sg_release(struct ivshmem_slab_cache * cache,
+                        struct ivshmem_sg_list * l);
+
+/* gather up to len bytes of the list into dst; returns the count copied */
+size_t ivshmem_sg_copy(const struct ivshmem_slab * heap,
+                       const struct ivshmem_sg_list * l, void * dst, size_t len);
+
+/* bytes of the list that go through a queue: only the used fragments */
+static inline uint32_t ivshmem_sg_bytes(const struct ivshmem_sg_list * l)
+{
+    return offsetof(struct ivshmem_sg_list, sg) + l->n * sizeof(struct ivshmem_sg);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
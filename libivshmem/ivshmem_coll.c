@@ -0,0 +1,303 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_coll.h"
+
+#define LINE 64
+
+size_t ivshmem_coll_bytes(int nparties, uint32_t chunk)
+{
+    chunk &= ~(LINE - 1);
+    return sizeof(struct ivshmem_coll) + (size_t)nparties * 2 * chunk;
+}
+
+int ivshmem_coll_init(void * mem, size_t bytes, int nparties, uint32_t chunk)
+{
+
+    struct ivshmem_coll * c = mem;
+
+    if (nparties < 1 || nparties > IVSHMEM_COLL_MAX_PARTIES) {
+        errno = EINVAL;
+        return -1;
+    }
+    chunk &= ~(LINE - 1);
+    if (chunk == 0 || ivshmem_coll_bytes(nparties, chunk) > bytes) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    __atomic_store_n(&c->magic, 0, __ATOMIC_RELAXED);
+    c->nparties = nparties;
+    c->chunk = chunk;
+    memset(c->node, 0, sizeof(c->node));
+    __atomic_store_n(&c->magic, IVSHMEM_COLL_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int ivshmem_coll_attach(struct ivshmem_coll_peer * p, void * mem,
+                        struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_coll * c = mem;
+    uint32_t id = ((uint32_t)ivshmem_posn(dev) << 16 | vector) + 1;
+    uint32_t free;
+    int i;
+
+    if (__atomic_load_n(&c->magic, __ATOMIC_ACQUIRE) != IVSHMEM_COLL_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->c = c;
+    p->dev = dev;
+    p->vector = vector;
+    p->nparties = c->nparties;
+    p->spin = IVSHMEM_COLL_SPIN;
+
+    for (i = 0; i < p->nparties; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&c->node[i].id, &free, id, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p->rank = i;
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+void ivshmem_coll_detach(struct ivshmem_coll_peer * p)
+{
+    __atomic_store_n(&p->c->node[p->rank].id, 0, __ATOMIC_RELEASE);
+}
+
+static int reached(const uint32_t * word, uint32_t target)
+{
+    return (int32_t)(__atomic_load_n(word, __ATOMIC_ACQUIRE) - target) >= 0;
+}
+
+/* wait for party i to complete step target: spin, then sleep */
+static int wait_step(struct ivshmem_coll_peer * p, int i, uint32_t target)
+{
+
+    struct ivshmem_coll_node * me = &p->c->node[p->rank];
+    const uint32_t * word = &p->c->node[i].step;
+    int n;
+
+    for (n = 0; n < p->spin; n++) {
+        if (reached(word, target))
+            return 0;
+        ivshmem_relax();
+    }
+
+    for (;;) {
+        /* either the advance comes first and we see it here, or it sees
+         * sleeping after its store */
+        __atomic_store_n(&me->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (reached(word, target)) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        p->sleeps++;
+        if (ivshmem_wait(p->dev, p->vector) < 0) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (reached(word, target)) {
+            __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+}
+
+static int wait_all(struct ivshmem_coll_peer * p, uint32_t target)
+{
+    int i;
+
+    for (i = 0; i < p->nparties; i++)
+        if (i != p->rank && wait_step(p, i, target) < 0)
+            return -1;
+
+    return 0;
+}
+
+/* publish our next step and ring whoever went to sleep waiting for it */
+static void advance(struct ivshmem_coll_peer * p)
+{
+
+    struct ivshmem_coll_node * node;
+    uint32_t id;
+    int i;
+
+    __atomic_store_n(&p->c->node[p->rank].step, ++p->step, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (i = 0; i < p->nparties; i++) {
+        node = &p->c->node[i];
+        if (i == p->rank || !__atomic_load_n(&node->sleeping, __ATOMIC_RELAXED) ||
+                !__atomic_exchange_n(&node->sleeping, 0, __ATOMIC_ACQ_REL))
+            continue;
+        /* it may have seen its step and detached in the meantime */
+        if (!(id = __atomic_load_n(&node->id, __ATOMIC_RELAXED)))
+            continue;
+        id--;
+        ivshmem_doorbell(p->dev, id >> 16, id & 0xffff);
+        p->doorbells++;
+    }
+}
+
+/*
+ * The half of party i's slot the next chunk goes through.  Before writing
+ * ours we wait until everybody is past the step that last read it.
+ */
+static uint8_t * half(struct ivshmem_coll_peer * p, int i)
+{
+    return p->c->slots + ((size_t)i * 2 + (p->chunks & 1)) * p->c->chunk;
+}
+
+static int claim_half(struct ivshmem_coll_peer * p)
+{
+    return wait_all(p, p->reuse[p->chunks & 1]);
+}
+
+static void release_half(struct ivshmem_coll_peer * p)
+{
+    p->reuse[p->chunks & 1] = p->step;
+    p->chunks++;
+}
+
+int ivshmem_coll_barrier(struct ivshmem_coll_peer * p)
+{
+    advance(p);
+    return wait_all(p, p->step);
+}
+
+int ivshmem_coll_bcast(struct ivshmem_coll_peer * p, void * buf, size_t bytes,
+                       int root)
+{
+
+    uint32_t chunk = p->c->chunk;
+    size_t off, n;
+
+    /*
+     * One step per chunk: the root's means written, everyone else's
+     * means read.  Readers still wait for the root, which waits for all.
+     */
+    for (off = 0; off < bytes; off += n) {
+        n = bytes - off < chunk ? bytes - off : chunk;
+        if (p->rank == root) {
+            if (claim_half(p) < 0)
+                return -1;
+            memcpy(half(p, root), (uint8_t *)buf + off, n);
+        } else {
+            if (wait_step(p, root, p->step + 1) < 0)
+                return -1;
+            memcpy((uint8_t *)buf + off, half(p, root), n);
+        }
+        advance(p);
+        release_half(p);
+    }
+
+    return 0;
+}
+
+int ivshmem_coll_allgather(struct ivshmem_coll_peer * p, const void * send,
+                           size_t bytes, void * recv)
+{
+
+    uint32_t chunk = p->c->chunk;
+    size_t off, n;
+    int i;
+
+    for (off = 0; off < bytes; off += n) {
+        n = bytes - off < chunk ? bytes - off : chunk;
+        if (claim_half(p) < 0)
+            return -1;
+        memcpy(half(p, p->rank), (const uint8_t *)send + off, n);
+        advance(p);
+
+        memcpy((uint8_t *)recv + (size_t)p->rank * bytes + off,
+               (const uint8_t *)send + off, n);
+        for (i = 0; i < p->nparties; i++) {
+            if (i == p->rank)
+                continue;
+            if (wait_step(p, i, p->step) < 0)
+                return -1;
+            memcpy((uint8_t *)recv + (size_t)i * bytes + off, half(p, i), n);
+        }
+        advance(p);
+        release_half(p);
+    }
+
+    return 0;
+}
+
+/*
+ * Reduce-scatter then gather, a chunk at a time.  Segments are whole
+ * cache lines so no two reducers write the same line; some of the last
+ * ones may be empty.  root < 0 gathers at every party.
+ */
+static int reduce_chunks(struct ivshmem_coll_peer * p, const void * send,
+                         void * recv, size_t count, int type, int op, int root)
+{
+
+    size_t es = ivshmem_coll_type_size(type);
+    size_t per = p->c->chunk / es, off, n, seg, lo, hi;
+    uint32_t posted;
+    int i, j;
+
+    for (off = 0; off < count; off += n) {
+        n = count - off < per ? count - off : per;
+        seg = (n + p->nparties - 1) / p->nparties;
+        seg = (seg * es + LINE - 1) / LINE * LINE / es;
+
+        if (claim_half(p) < 0)
+            return -1;
+        memcpy(half(p, p->rank), (const uint8_t *)send + off * es, n * es);
+        advance(p);
+        posted = p->step;
+
+        lo = p->rank * seg < n ? p->rank * seg : n;
+        hi = lo + seg < n ? lo + seg : n;
+        for (j = 1; j < p->nparties && lo < hi; j++) {
+            i = (p->rank + j) % p->nparties;
+            if (wait_step(p, i, posted) < 0)
+                return -1;
+            ivshmem_reduce(half(p, p->rank) + lo * es, half(p, i) + lo * es,
+                           hi - lo, type, op);
+        }
+        advance(p);
+
+        if (root < 0 || root == p->rank) {
+            for (i = 0; i < p->nparties; i++) {
+                lo = i * seg < n ? i * seg : n;
+                hi = lo + seg < n ? lo + seg : n;
+                if (lo == hi)
+                    continue;
+                if (i != p->rank && wait_step(p, i, posted + 1) < 0)
+                    return -1;
+                memcpy((uint8_t *)recv + (off + lo) * es,
+                       half(p, i) + lo * es, (hi - lo) * es);
+            }
+        }
+        advance(p);
+        release_half(p);
+    }
+
+    return 0;
+}
+
+int ivshmem_coll_reduce(struct ivshmem_coll_peer * p, const void * send,
+                        void * recv, size_t count, int type, int op, int root)
+{
+    return reduce_chunks(p, send, recv, count, type, op, root);
+}
+
+int ivshmem_coll_allreduce(struct ivshmem_coll_peer * p, const void * send,
+                           void * recv, size_t count, int type, int op)
+{
+    return reduce_chunks(p, send, recv, count, type, op, -1);
+}
@@ -0,0 +1,134 @@
+#ifndef IVSHMEM_COLL_HDR
+#define IVSHMEM_COLL_HDR
+#include <stddef.h>
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MPI-style collectives between a fixed group of peers, through the
+ * region only: barrier, broadcast, reduce, allreduce and allgather.  Every
+ * party has to make the same calls with the same sizes, in the same order.
+ *
+ * Each party owns a node with a step counter and a staging slot of two
+ * chunk-sized halves.  A collective is a fixed sequence of steps per
+ * chunk, and every party counts them the same way, so waiting for a peer
+ * is waiting for its counter to reach a step number.  Waiters spin, then
+ * sleep on their doorbell, and whoever advances rings the sleepers (the
+ * same protocol as ivshmem_barrier).
+ *
+ * Data moves chunk by chunk.  An allreduce chunk goes:
+ *
+ *   1. each party copies its chunk of the input into its slot
+ *   2. the chunk is cut into one segment per party; party i reduces
+ *      segment i of every slot into its own slot, so all the parties
+ *      reduce at once.  Peers are taken in a fixed order (i + 1, i + 2,
+ *      ...), so results do not depend on timing
+ *   3. each party copies every party's reduced segment to its output
+ *
+ * The halves alternate, so parties can start on the next chunk while
+ * slow ones are still reading the last one.  Reductions use the widest
+ * ivshmem_reduce() kernels the CPU has.
+ */
+
+#define IVSHMEM_COLL_MAGIC 0x434f4c4c   /* "COLL" */
+#define IVSHMEM_COLL_MAX_PARTIES 64
+#define IVSHMEM_COLL_SPIN 4096
+
+enum ivshmem_coll_type { IVSHMEM_INT32, IVSHMEM_FLOAT, IVSHMEM_DOUBLE,
+                         IVSHMEM_NTYPES };
+enum ivshmem_coll_op { IVSHMEM_SUM, IVSHMEM_MIN, IVSHMEM_MAX, IVSHMEM_NOPS };
+
+/* reduction kernels; the default is the widest the CPU supports */
+enum ivshmem_isa { IVSHMEM_ISA_GENERIC, IVSHMEM_ISA_AVX2, IVSHMEM_ISA_AVX512,
+                   IVSHMEM_NISAS };
+
+struct ivshmem_coll_node {
+    uint32_t step __attribute__((aligned(64)));     /* by its owner */
+    uint32_t sleeping __attribute__((aligned(64)));
+    uint32_t id;                /* (posn << 16 | vector) + 1, or 0 */
+};
+
+struct ivshmem_coll {
+    uint32_t magic __attribute__((aligned(64)));
+    uint32_t nparties;
+    uint32_t chunk;             /* bytes per half slot */
+
+    struct ivshmem_coll_node node[IVSHMEM_COLL_MAX_PARTIES];
+
+    uint8_t slots[] __attribute__((aligned(64)));
+};
+
+/* one per party, in private memory */
+struct ivshmem_coll_peer {
+    struct ivshmem_coll * c;
+    struct ivshmem_dev * dev;
+    int vector;
+    int rank;                   /* our node */
+    int nparties;
+    int spin;                   /* polls before sleeping */
+
+    uint32_t step;              /* steps we have completed */
+    uint32_t chunks;            /* chunks moved, picks the half */
+    uint32_t reuse[2];          /* step after which a half is free again */
+
+    unsigned long sleeps;
+    unsigned long doorbells;
+};
+
+/* room for nparties with chunk-byte halves */
+size_t ivshmem_coll_bytes(int nparties, uint32_t chunk);
+
+/*
+ * chunk is rounded down to whole cache lines.  Returns -1 with ENOSPC if
+ * bytes cannot hold the slots, EINVAL for a bad party count.
+ */
+int ivshmem_coll_init(void * mem, size_t bytes, int nparties, uint32_t chunk);
+
+/*
+ * Ranks go by attach order.  -1 with EAGAIN before init, ENOSPC once
+ * nparties have attached.
+ */
+int ivshmem_coll_attach(struct ivshmem_coll_peer * p, void * mem,
+                        struct ivshmem_dev * dev, int vector);
+void ivshmem_coll_detach(struct ivshmem_coll_peer * p);
+
+/* all return 0, or -1 if waiting on the device failed */
+int ivshmem_coll_barrier(struct ivshmem_coll_peer * p);
+
+/* buf of bytes from root to everyone */
+int ivshmem_coll_bcast(struct ivshmem_coll_peer * p, void * buf, size_t bytes,
+                       int root);
+
+/*
+ * recv = send op'd over every party, count elements of type; recv is
+ * only written at root.  send and recv may be the same buffer.
+ */
+int ivshmem_coll_reduce(struct ivshmem_coll_peer * p, const void * send,
+                        void * recv, size_t count, int type, int op, int root);
+int ivshmem_coll_allreduce(struct ivshmem_coll_peer * p, const void * send,
+                           void * recv, size_t count, int type, int op);
+
+/* bytes from every party, in rank order into recv */
+int ivshmem_coll_allgather(struct ivshmem_coll_peer * p, const void * send,
+                           size_t bytes, void * recv);
+
+size_t ivshmem_coll_type_size(int type);
+
+/* dst[i] = dst[i] op src[i] for count elements of type */
+void ivshmem_reduce(void * dst, const void * src, size_t count, int type,
+                    int op);
+
+/* the kernels ivshmem_reduce() uses; set fails with ENOTSUP on this CPU */
+int ivshmem_reduce_isa(void);
+int ivshmem_reduce_set_isa(int isa);
+extern const char * ivshmem_isa_names[];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ivshmem_host.h"
+
+/*
+ * A host process joins like a guest's qemu does: it connects to
+ * ivshmem_server, which sends (see ivshmem-server/send_scm.c)
+ *
+ *   our position                       a long, no fd
+ *   -1 and the shm object              sendUpdate(-1, shm_fd)
+ *   (peer, eventfd) per peer vector    sendRights(), ending with our own
+ *
+ * and later one (peer, eventfd) per vector of every peer that joins, or a
+ * lone peer number without an fd when one leaves.  Ringing a peer writes its
+ * eventfd; waiting reads our own.
+ */
+
+/* one message from the server, *newfd is -1 if it carried no fd */
+static int recv_update(int sock, long * posn, int * newfd)
+{
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr * cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t len;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = posn;
+    iov.iov_len = sizeof(*posn);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        len = recvmsg(sock, &msg, 0);
+    } while (len < 0 && errno == EINTR);
+
+    if (len == 0)
+        errno = ECONNRESET;
+    if (len != sizeof(*posn))
+        return -1;
+
+    *newfd = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(newfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    return 0;
+}
+
+static int grow_peers(struct ivshmem_dev * dev, int npeers)
+{
+
+    int * efds;
+    int i;
+
+    if (npeers <= dev->npeers)
+        return 0;
+
+    efds = realloc(dev->efds, npeers * dev->nvectors * sizeof(int));
+    if (efds == NULL)
+        return -1;
+
+    for (i = dev->npeers * dev->nvectors; i < npeers * dev->nvectors; i++)
+        efds[i] = -1;
+
+    dev->efds = efds;
+    dev->npeers = npeers;
+    return 0;
+}
+
+/*
+ * Returns the number of eventfds now known for peer.  The eventfds of a
+ * peer that leaves are closed, or appended to retired if it is not NULL.
+ */
+static int apply_update(struct ivshmem_dev * dev, long posn, int newfd,
+                        int * retired, int * nretired)
+{
+
+    int * fds;
+    int i;
+
+    if (posn < 0 || grow_peers(dev, posn + 1) < 0) {
+        if (newfd >= 0)
+            close(newfd);
+        return -1;
+    }
+
+    fds = &dev->efds[posn * dev->nvectors];
+
+    /* no fd: the peer has left */
+    if (newfd < 0) {
+        for (i = 0; i < dev->nvectors; i++) {
+            if (fds[i] >= 0 && retired)
+                retired[(*nretired)++] = fds[i];
+            else if (fds[i] >= 0)
+                close(fds[i]);
+            fds[i] = -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < dev->nvectors && fds[i] >= 0; i++)
+        ;
+    if (i == dev->nvectors) {
+        /* more vectors than we were told about, -n does not match */
+        close(newfd);
+        return i;
+    }
+    fds[i] = newfd;
+
+    return i + 1;
+}
+
+static int update(struct ivshmem_dev * dev, int block, int * retired,
+                  int max, int * nretired)
+{
+
+    struct pollfd pfd;
+    long posn;
+    int newfd, n = 0;
+
+    pfd.fd = dev->fd;
+    pfd.events = POLLIN;
+
+    /* stop while retired can still take a whole peer */
+    while ((!retired || *nretired + dev->nvectors <= max) &&
+           poll(&pfd, 1, block ? -1 : 0) > 0) {
+        if (recv_update(dev->fd, &posn, &newfd) < 0)
+            return -1;
+        apply_update(dev, posn, newfd, retired, nretired);
+        n++;
+        block = 0;
+    }
+
+    return n;
+}
+
+int ivshmem_host_update(struct ivshmem_dev * dev, int block)
+{
+    return update(dev, block, NULL, 0, NULL);
+}
+
+int ivshmem_host_update_retire(struct ivshmem_dev * dev, int * retired,
+                               int max, int * nretired)
+{
+    *nretired = 0;
+    return update(dev, 0, retired, max, nretired);
+}
+
+int ivshmem_host_open(struct ivshmem_dev * dev, const char * path,
+                      size_t size, int nvectors)
+{
+
+    struct sockaddr_un addr;
+    struct stat st;
+    long posn;
+    int shm_fd, newfd;
+
+    dev->nvectors = nvectors;
+
+    if ((dev->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(dev->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -1;
+
+    if (recv_update(dev->fd, &posn, &newfd) < 0)
+        return -1;
+    dev->posn = posn;
+
+    if (recv_update(dev->fd, &posn, &shm_fd) < 0)
+        return -1;
+    if (posn != -1 || shm_fd < 0) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    /* the existing peers' eventfds, ours come last */
+    do {
+        if (recv_update(dev->fd, &posn, &newfd) < 0) {
+            close(shm_fd);
+            return -1;
+        }
+    } while (apply_update(dev, posn, newfd, NULL, NULL) < nvectors || posn != dev->posn);
+
+    if (size == 0) {
+        if (fstat(shm_fd, &st) < 0) {
+            close(shm_fd);
+            return -1;
+        }
+        size = st.st_size;
+    }
+
+    dev->mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (dev->mem == MAP_FAILED) {
+        dev->mem = NULL;
+        return -1;
+    }
+    dev->size = size;
+
+    return 0;
+}
+
+void ivshmem_host_close(struct ivshmem_dev * dev)
+{
+
+    int i;
+
+    for (i = 0; i < dev->npeers * dev->nvectors; i++) {
+        if (dev->efds[i] >= 0)
+            close(dev->efds[i]);
+    }
+    free(dev->efds);
+    dev->efds = NULL;
+    dev->npeers = 0;
+}
+
+int ivshmem_host_doorbell(struct ivshmem_dev * dev, int peer, int vector)
+{
+
+    uint64_t one = 1;
+    int fd;
+
+    if (vector < 0 || vector >= dev->nvectors || peer < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (peer >= dev->npeers || dev->efds[peer * dev->nvectors + vector] < 0)
+        ivshmem_host_update(dev, 0);
+
+    if (peer >= dev->npeers ||
+        (fd = dev->efds[peer * dev->nvectors + vector]) < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one))
+        return -1;
+
+    return 0;
+}
+
+int ivshmem_host_wait(struct ivshmem_dev * dev, int vector, int block)
+{
+
+    struct pollfd pfd;
+    uint64_t count;
+    int rv;
+
+    if (vector < 0 || vector >= dev->nvectors) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pfd.fd = dev->efds[dev->posn * dev->nvectors + vector];
+    pfd.events = POLLIN;
+
+    do {
+        rv = poll(&pfd, 1, block ? -1 : 0);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv < 0)
+        return -1;
+    if (rv == 0)
+        return 0;
+
+    if (read(pfd.fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+
+    return count;
+}
@@ -0,0 +1,22 @@
+#ifndef IVSHMEM_HOST_HDR
+#define IVSHMEM_HOST_HDR
+#include "ivshmem.h"
+
+/* the IVSHMEM_HOST backend of ivshmem.c, not part of the API */
+int ivshmem_host_open(struct ivshmem_dev * dev, const char * path,
+                      size_t size, int nvectors);
+void ivshmem_host_close(struct ivshmem_dev * dev);
+int ivshmem_host_doorbell(struct ivshmem_dev * dev, int peer, int vector);
+int ivshmem_host_wait(struct ivshmem_dev * dev, int vector, int block);
+int ivshmem_host_update(struct ivshmem_dev * dev, int block);
+
+/*
+ * A non-blocking ivshmem_host_update() that hands the eventfds of peers
+ * that left back in retired instead of closing them, for callers that
+ * ring from other threads without a lock.  Stops early rather than take
+ * more than max; *nretired says how many there are.
+ */
+int ivshmem_host_update_retire(struct ivshmem_dev * dev, int * retired,
+                               int max, int * nretired);
+
+#endif
@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "ivshmem_loop.h"
+
+#define WAKE_KEY UINT32_MAX
+#define MAX_EVENTS 64
+#define EVENT_POLL 64   /* idle rounds between fd checks while spinning */
+
+int ivshmem_loop_init(struct ivshmem_loop * loop)
+{
+
+    struct epoll_event ev;
+
+    memset(loop, 0, sizeof(*loop));
+    loop->spin = IVSHMEM_LOOP_SPIN;
+    loop->budget = IVSHMEM_LOOP_BUDGET;
+
+    if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return -1;
+
+    /* poll() does the same job, a descriptor list per sleep slower */
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = WAKE_KEY;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+            close(loop->epfd);
+            loop->epfd = -1;
+        }
+    }
+
+    return 0;
+}
+
+static void chan_close(struct ivshmem_loop * loop, int c);
+
+void ivshmem_loop_destroy(struct ivshmem_loop * loop)
+{
+    int i;
+
+    for (i = 0; i < loop->nsrcs; i++)
+        if (loop->src[i])
+            ivshmem_loop_remove(loop, loop->src[i]);
+
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    close(loop->wakefd);
+    free(loop->chan);
+    free(loop->src);
+    free(loop->bell);
+    memset(loop, 0, sizeof(*loop));
+}
+
+/* the descriptor that becomes readable when vector fires on dev */
+static int chan_fd(struct ivshmem_loop_chan * ch)
+{
+
+    struct ivshmem_dev * dev = ch->dev;
+    struct ivshmem_irqfd irqfd;
+    int fd;
+
+    switch (dev->type) {
+    case IVSHMEM_HOST:
+        return dev->efds[dev->posn * dev->nvectors + ch->vector];
+
+    case IVSHMEM_KVM:
+        if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+            return -1;
+        irqfd.fd = fd;
+        irqfd.vector = ch->vector;
+        if (ioctl(dev->fd, BIND_EVENTFD, &irqfd) < 0) {
+            close(fd);
+            return -1;
+        }
+        ch->own_fd = 1;
+        return fd;
+
+    default:
+        /* a UIO vector is only ever opened with vector -1 */
+        return dev->fd;
+    }
+}
+
+static int chan_open(struct ivshmem_loop * loop, struct ivshmem_dev * dev,
+                     int vector)
+{
+
+    struct ivshmem_loop_chan * ch;
+    struct epoll_event ev;
+    int c, parent = -1;
+
+    for (c = 0; c < loop->nchans; c++)
+        if (loop->chan[c].refs && loop->chan[c].dev == dev &&
+                loop->chan[c].vector == vector) {
+            loop->chan[c].refs++;
+            return c;
+        }
+
+    /* a KVM source sleeps on an interrupt vector; with pin interrupts
+     * the bind below fails for everything but 0 */
+    if (vector >= 0 && (vector >= dev->nvectors ||
+                (dev->type == IVSHMEM_KVM && vector >= IVSHMEM_KVM_NVECTORS))) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* UIO vectors share one descriptor, held by a channel of their own */
+    if (vector >= 0 && dev->type == IVSHMEM_UIO &&
+            (parent = chan_open(loop, dev, -1)) < 0)
+        return -1;
+
+    for (c = 0; c < loop->nchans && loop->chan[c].refs; c++)
+        ;
+    if (c == loop->nchans) {
+        ch = realloc(loop->chan, (c + 1) * sizeof(*ch));
+        if (ch == NULL)
+            goto fail;
+        loop->chan = ch;
+        loop->nchans++;
+    }
+
+    ch = &loop->chan[c];
+    memset(ch, 0, sizeof(*ch));
+    ch->dev = dev;
+    ch->vector = vector;
+    ch->parent = parent;
+    ch->refs = 1;
+    ch->fd = parent >= 0 ? -1 : chan_fd(ch);
+    if (parent < 0 && ch->fd < 0) {
+        ch->refs = 0;
+        goto fail;
+    }
+
+    if (ch->fd >= 0 && loop->epfd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = c;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ch->fd, &ev) < 0) {
+            chan_close(loop, c);
+            return -1;
+        }
+    }
+
+    return c;
+
+fail:
+    if (parent >= 0)
+        chan_close(loop, parent);
+    return -1;
+}
+
+static void chan_close(struct ivshmem_loop * loop, int c)
+{
+
+    struct ivshmem_loop_chan * ch = &loop->chan[c];
+    struct ivshmem_irqfd irqfd;
+
+    if (--ch->refs)
+        return;
+
+    if (ch->fd >= 0 && loop->epfd >= 0)
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ch->fd, NULL);
+    if (ch->own_fd) {
+        irqfd.fd = -1;
+        irqfd.vector = ch->vector;
+        ioctl(ch->dev->fd, BIND_EVENTFD, &irqfd);
+        close(ch->fd);
+    }
+    if (ch->parent >= 0)
+        chan_close(loop, ch->parent);
+}
+
+int ivshmem_loop_add(struct ivshmem_loop * loop, struct ivshmem_loop_source * src)
+{
+
+    struct ivshmem_loop_source ** s;
+
+    if ((src->chan = chan_open(loop, src->dev, src->vector)) < 0)
+        return -1;
+
+    if ((s = realloc(loop->src, (loop->nsrcs + 1) * sizeof(*s))) == NULL) {
+        chan_close(loop, src->chan);
+        return -1;
+    }
+    loop->src = s;
+    src->index = loop->nsrcs;
+    src->ready = 0;
+    src->count = 0;
+    src->calls = 0;
+    loop->src[loop->nsrcs++] = src;
+    if (!src->in)
+        loop->nevents++;
+
+    return 0;
+}
+
+void ivshmem_loop_remove(struct ivshmem_loop * loop,
+                         struct ivshmem_loop_source * src)
+{
+    /* dispatch() may be walking src[]: leave a hole to squeeze out later */
+    loop->src[src->index] = NULL;
+    loop->removed = 1;
+    if (!src->in)
+        loop->nevents--;
+    chan_close(loop, src->chan);
+}
+
+static void squeeze(struct ivshmem_loop * loop)
+{
+    int i, n = 0;
+
+    for (i = 0; i < loop->nsrcs; i++)
+        if (loop->src[i]) {
+            loop->src[i]->index = n;
+            loop->src[n++] = loop->src[i];
+        }
+    loop->nsrcs = n;
+    loop->removed = 0;
+}
+
+int ivshmem_loop_doorbell(struct ivshmem_loop * loop, struct ivshmem_dev * dev,
+                          int peer, int vector)
+{
+
+    struct ivshmem_loop_bell * b;
+    int i;
+
+    for (i = 0; i < loop->nbells; i++)
+        if (loop->bell[i].dev == dev && loop->bell[i].peer == peer &&
+                loop->bell[i].vector == vector) {
+            loop->coalesced++;
+            return 0;
+        }
+
+    if (loop->nbells == loop->maxbells) {
+        b = realloc(loop->bell, (loop->maxbells * 2 + 8) * sizeof(*b));
+        if (b == NULL)
+            return -1;
+        loop->bell = b;
+        loop->maxbells = loop->maxbells * 2 + 8;
+    }
+
+    b = &loop->bell[loop->nbells++];
+    b->dev = dev;
+    b->peer = peer;
+    b->vector = vector;
+
+    return 0;
+}
+
+/* hand n doorbells on channel c to its sources */
+static void fire(struct ivshmem_loop * loop, int c, uint32_t n)
+{
+
+    struct ivshmem_loop_source * s;
+    int i;
+
+    for (i = 0; i < loop->nsrcs; i++) {
+        if ((s = loop->src[i]) == NULL || s->chan != c)
+            continue;
+        s->count += n;
+        /* ring sources are polled every round anyway */
+        if (!s->in)
+            s->ready = 1;
+    }
+}
+
+/* take the doorbells that made channel c's descriptor readable */
+static void drain(struct ivshmem_loop * loop, int c)
+{
+
+    struct ivshmem_loop_chan * ch = &loop->chan[c];
+    uint64_t count;
+    int buf, k, n;
+
+    switch (ch->dev->type) {
+    case IVSHMEM_HOST:
+        if ((n = ivshmem_trywait(ch->dev, ch->vector)) > 0)
+            fire(loop, c, n);
+        break;
+
+    case IVSHMEM_KVM:
+        if (read(ch->fd, &count, sizeof(count)) == sizeof(count))
+            fire(loop, c, count);
+        break;
+
+    default:
+        /* re-arms the descriptor; the counts page says which vectors */
+        if (read(ch->fd, &buf, sizeof(buf)) != sizeof(buf))
+            break;
+        for (k = 0; k < loop->nchans; k++) {
+            if (!loop->chan[k].refs || loop->chan[k].parent != c)
+                continue;
+            n = ch->dev->counts ? ivshmem_trywait(ch->dev, loop->chan[k].vector)
+                                : 1;
+            if (n > 0)
+                fire(loop, k, n);
+        }
+        break;
+    }
+}
+
+/* sleep up to timeout ms for any channel or a wake, then drain them */
+static int sleep_on_fds(struct ivshmem_loop * loop, int timeout)
+{
+
+    struct epoll_event ev[MAX_EVENTS];
+    struct pollfd * pfd;
+    uint64_t count;
+    int i, n, c;
+
+    if (loop->epfd >= 0) {
+        if ((n = epoll_wait(loop->epfd, ev, MAX_EVENTS, timeout)) < 0)
+            return errno == EINTR ? 0 : -1;
+        for (i = 0; i < n; i++) {
+            if (ev[i].data.u32 == WAKE_KEY) {
+                if (read(loop->wakefd, &count, sizeof(count)) < 0)
+                    continue;
+            } else
+                drain(loop, ev[i].data.u32);
+        }
+        return 0;
+    }
+
+    if ((pfd = malloc((loop->nchans + 1) * sizeof(*pfd))) == NULL)
+        return -1;
+    /* pfd[c] follows chan[c], unused ones with fd -1 are ignored by poll() */
+    for (c = 0; c < loop->nchans; c++) {
+        pfd[c].fd = loop->chan[c].refs ? loop->chan[c].fd : -1;
+        pfd[c].events = POLLIN;
+        pfd[c].revents = 0;
+    }
+    pfd[c].fd = loop->wakefd;
+    pfd[c].events = POLLIN;
+    pfd[c].revents = 0;
+
+    if ((n = poll(pfd, loop->nchans + 1, timeout)) > 0) {
+        for (c = 0; c < loop->nchans; c++)
+            if (pfd[c].revents & POLLIN)
+                drain(loop, c);
+        if (pfd[c].revents & POLLIN &&
+                read(loop->wakefd, &count, sizeof(count)) < 0)
+            n = 0;
+    }
+    free(pfd);
+
+    return n < 0 && errno != EINTR ? -1 : 0;
+}
+
+/* run every ready source once; returns the work done and whether more is left */
+static int dispatch(struct ivshmem_loop * loop, int * more)
+{
+
+    struct ivshmem_loop_source * s;
+    struct ivshmem_loop_bell * b;
+    uint32_t len;
+    int i, r, work = 0;
+
+    *more = 0;
+    for (i = 0; i < loop->nsrcs; i++) {
+        if ((s = loop->src[i]) == NULL)
+            continue;
+        if (!s->ready && (!s->in || !ivshmem_spsc_peek(s->in, &len)))
+            continue;
+
+        r = s->cb(loop, s, loop->budget);
+        loop->calls++;
+        s->calls++;
+        s->count = 0;
+        if (r < 0)
+            return r;
+
+        /* a callback may have removed its own source */
+        if (loop->src[i] != s)
+            continue;
+        if (s->in)
+            ivshmem_spsc_release(s->in);
+        s->ready = r >= loop->budget;
+        *more |= s->ready;
+        work += r;
+    }
+
+    /* one publish, and at most one doorbell, per out ring per round */
+    for (i = 0; i < loop->nsrcs; i++)
+        if ((s = loop->src[i]) && s->out)
+            ivshmem_spsc_flush(s->out);
+
+    for (i = 0; i < loop->nbells; i++) {
+        b = &loop->bell[i];
+        ivshmem_doorbell(b->dev, b->peer, b->vector);
+    }
+    loop->doorbells += loop->nbells;
+    loop->nbells = 0;
+
+    if (loop->removed)
+        squeeze(loop);
+
+    return work;
+}
+
+/* ask every in ring for a doorbell; non-zero if one already has data */
+static int arm(struct ivshmem_loop * loop)
+{
+
+    struct ivshmem_loop_source * s;
+    int i, pending = 0;
+
+    for (i = 0; i < loop->nsrcs; i++)
+        if ((s = loop->src[i]) && s->in)
+            pending |= ivshmem_spsc_arm_data(s->in);
+
+    return pending;
+}
+
+int ivshmem_loop_run_once(struct ivshmem_loop * loop, int timeout)
+{
+
+    int work, more;
+
+    loop->rounds++;
+    if ((work = dispatch(loop, &more)) < 0)
+        return work;
+    if (work || more) {
+        loop->idle = 0;
+        return work;
+    }
+
+    if (timeout != 0 && ++loop->idle < loop->spin) {
+        /* doorbell-only sources are seen through their descriptors */
+        if (loop->nevents && loop->idle % EVENT_POLL == 0)
+            sleep_on_fds(loop, 0);
+        ivshmem_relax();
+        return 0;
+    }
+
+    loop->idle = 0;
+    if (arm(loop))
+        return 0;
+    if (timeout != 0)
+        loop->sleeps++;
+    return sleep_on_fds(loop, timeout) < 0 ? -1 : 0;
+}
+
+int ivshmem_loop_run(struct ivshmem_loop * loop)
+{
+
+    int r = 0;
+
+    while (!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE))
+        if ((r = ivshmem_loop_run_once(loop, -1)) < 0)
+            break;
+
+    __atomic_store_n(&loop->stop, 0, __ATOMIC_RELAXED);
+    return r < 0 ? r : 0;
+}
+
+void ivshmem_loop_stop(struct ivshmem_loop * loop)
+{
+    __atomic_store_n(&loop->stop, 1, __ATOMIC_RELEASE);
+    ivshmem_loop_wake(loop);
+}
+
+void ivshmem_loop_wake(struct ivshmem_loop * loop)
+{
+    uint64_t one = 1;
+
+    if (write(loop->wakefd, &one, sizeof(one)) < 0)
+        return;
+}
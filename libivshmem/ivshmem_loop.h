@@ -0,0 +1,167 @@
+#ifndef IVSHMEM_LOOP_HDR
+#define IVSHMEM_LOOP_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event loop for one thread serving many channels, on any number of
+ * devices and vectors, instead of one thread blocked in ivshmem_wait() per
+ * channel.
+ *
+ * A source is a callback on a (device, vector) pair, optionally with an
+ * SPSC ring the loop watches for it:
+ *
+ *   in    consumer end.  The callback runs whenever the ring has messages.
+ *         The loop arms the ring before sleeping, so the producer only
+ *         rings when the loop is actually asleep.
+ *   out   producer end.  The callback commits to it, and the loop flushes
+ *         it once after the round, so a burst of replies costs at most one
+ *         doorbell.
+ *
+ * With neither ring, the callback runs when the vector fires and gets the
+ * doorbell count coalesced since its last run.  Any number of sources can
+ * share a vector.  Their rings are then polled together, which is how a
+ * handful of vectors serves hundreds of rings.
+ *
+ * Each round runs every ready source once, up to budget messages each.
+ * Sources that used their whole budget stay ready for the next round, so
+ * one busy ring cannot starve the rest.  When a round finds nothing, the
+ * loop polls for spin more rounds before arming its rings and sleeping.
+ *
+ * Sleeping is one epoll_wait() over a file descriptor per vector:
+ *
+ *   HOST  the vector's eventfd from ivshmem_server
+ *   KVM   an eventfd bound to the vector with BIND_EVENTFD
+ *   UIO   the device fd, shared by all its vectors; the per-vector counts
+ *         page tells them apart (without it, everything is vector 0)
+ *
+ * The KVM driver binds eventfds to interrupt vectors, not channels, so
+ * only vectors below IVSHMEM_KVM_NVECTORS (just 0 with pin interrupts)
+ * can be added; others fail with EINVAL.  A vector's eventfd also fires
+ * for doorbells on the other channels the host routes onto it, so its
+ * counts are an upper bound: ring sources do not mind, they find their
+ * rings empty, but doorbell-only sources on KVM should share a vector
+ * with nothing else.
+ *
+ * If epoll is unavailable, the loop falls back to poll() over the same
+ * descriptors.
+ */
+
+#define IVSHMEM_LOOP_BUDGET 64
+#define IVSHMEM_LOOP_SPIN 1000
+
+struct ivshmem_loop;
+struct ivshmem_loop_source;
+
+/*
+ * Return how many messages were handled; handling budget or more keeps
+ * the source ready.  A negative return stops ivshmem_loop_run(), which
+ * returns it.
+ */
+typedef int (*ivshmem_loop_cb)(struct ivshmem_loop * loop,
+                               struct ivshmem_loop_source * src, int budget);
+
+/* owned by the caller, registered with ivshmem_loop_add() */
+struct ivshmem_loop_source {
+    struct ivshmem_dev * dev;
+    int vector;
+    struct ivshmem_spsc_end * in;       /* or NULL */
+    struct ivshmem_spsc_end * out;      /* or NULL */
+    ivshmem_loop_cb cb;
+    void * arg;
+
+    /* private to the loop */
+    int chan;
+    int index;
+    int ready;
+    uint32_t count;     /* doorbells since the last callback */
+    unsigned long calls;
+};
+
+/* one (device, vector) the loop sleeps on; unused while refs is 0 */
+struct ivshmem_loop_chan {
+    struct ivshmem_dev * dev;
+    int vector;         /* -1: a UIO device's fd, shared by its vectors */
+    int fd;             /* what we poll, -1 for a vector under a UIO device */
+    int parent;         /* UIO vectors: the device's channel */
+    int own_fd;         /* KVM: the loop made fd and must unbind it */
+    int refs;
+};
+
+/* a doorbell held back until the end of the round */
+struct ivshmem_loop_bell {
+    struct ivshmem_dev * dev;
+    int peer;
+    int vector;
+};
+
+struct ivshmem_loop {
+    int epfd;           /* -1 when using poll() */
+    int wakefd;         /* ivshmem_loop_wake() */
+    int stop;
+    int spin;
+    int budget;
+    int idle;           /* rounds since the last one with work */
+    int removed;        /* src has holes to squeeze out */
+
+    struct ivshmem_loop_chan * chan;
+    int nchans;
+    struct ivshmem_loop_source ** src;
+    int nsrcs;
+    int nevents;        /* sources without an in ring */
+    struct ivshmem_loop_bell * bell;
+    int nbells;
+    int maxbells;
+
+    unsigned long rounds;
+    unsigned long sleeps;
+    unsigned long calls;
+    unsigned long doorbells;
+    unsigned long coalesced;    /* ivshmem_loop_doorbell()s saved */
+};
+
+/* Returns 0, or -1 with errno */
+int ivshmem_loop_init(struct ivshmem_loop * loop);
+void ivshmem_loop_destroy(struct ivshmem_loop * loop);
+
+/*
+ * Register src, whose dev, vector, in, out, cb and arg are filled in.
+ * Returns 0, or -1 with errno.  ivshmem_loop_remove() is safe from a
+ * callback, including src's own.
+ */
+int ivshmem_loop_add(struct ivshmem_loop * loop, struct ivshmem_loop_source * src);
+void ivshmem_loop_remove(struct ivshmem_loop * loop,
+                         struct ivshmem_loop_source * src);
+
+/*
+ * Ring vector on peer at the end of the round.  Repeated requests for the
+ * same doorbell in one round are rung once.
+ */
+int ivshmem_loop_doorbell(struct ivshmem_loop * loop, struct ivshmem_dev * dev,
+                          int peer, int vector);
+
+/*
+ * One round, sleeping up to timeout ms (-1 forever) if it finds nothing
+ * to do.  Returns the messages handled, or a callback's negative return.
+ */
+int ivshmem_loop_run_once(struct ivshmem_loop * loop, int timeout);
+
+/* rounds until ivshmem_loop_stop(); returns 0 or a negative callback return */
+int ivshmem_loop_run(struct ivshmem_loop * loop);
+
+/* make run() return; callable from any thread */
+void ivshmem_loop_stop(struct ivshmem_loop * loop);
+
+/* cut a sleep short from another thread */
+void ivshmem_loop_wake(struct ivshmem_loop * loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
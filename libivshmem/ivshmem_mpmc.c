@@ -0,0 +1,300 @@
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_mpmc.h"
+
+static uint32_t cell_bytes(uint32_t msg_size)
+{
+    uint32_t bytes = msg_size + sizeof(struct ivshmem_mpmc_cell);
+
+    return (bytes + 63) & ~63u;
+}
+
+size_t ivshmem_mpmc_bytes(uint32_t ncells, uint32_t msg_size)
+{
+    return offsetof(struct ivshmem_mpmc, cells) +
+                (size_t)ncells * cell_bytes(msg_size);
+}
+
+static struct ivshmem_mpmc_cell * cell_at(struct ivshmem_mpmc * q,
+                                          uint32_t pos, uint32_t mask)
+{
+    return (struct ivshmem_mpmc_cell *)
+                (q->cells + (size_t)(pos & mask) * q->cell_size);
+}
+
+struct ivshmem_mpmc * ivshmem_mpmc_init(void * mem, size_t bytes,
+                                        uint32_t msg_size)
+{
+
+    struct ivshmem_mpmc * q = mem;
+    uint32_t ncells = 2, i;
+
+    if (ivshmem_mpmc_bytes(ncells, msg_size) > bytes)
+        return NULL;
+    while (ncells < (1u << 31) &&
+           ivshmem_mpmc_bytes(ncells * 2, msg_size) <= bytes)
+        ncells *= 2;
+
+    __atomic_store_n(&q->magic, 0, __ATOMIC_RELAXED);
+    q->enqueue_pos = q->dequeue_pos = 0;
+    q->data_waiters = q->space_waiters = 0;
+    memset(q->waiter, 0, sizeof(q->waiter));
+    q->ncells = ncells;
+    q->cell_size = cell_bytes(msg_size);
+
+    for (i = 0; i < ncells; i++)
+        cell_at(q, i, ncells - 1)->seq = i;
+
+    __atomic_store_n(&q->magic, IVSHMEM_MPMC_MAGIC, __ATOMIC_RELEASE);
+
+    return q;
+}
+
+int ivshmem_mpmc_attach(struct ivshmem_mpmc_end * end, void * mem,
+                        struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_mpmc * q = mem;
+    uint32_t id = ((uint32_t)ivshmem_posn(dev) << 16 | vector) + 1;
+    uint32_t free;
+    int i;
+
+    if (__atomic_load_n(&q->magic, __ATOMIC_ACQUIRE) != IVSHMEM_MPMC_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(end, 0, sizeof(*end));
+    end->q = q;
+    end->dev = dev;
+    end->vector = vector;
+    end->mask = q->ncells - 1;
+
+    for (i = 0; i < IVSHMEM_MPMC_MAX_WAITERS; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&q->waiter[i], &free, id, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            end->slot = i;
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+void ivshmem_mpmc_detach(struct ivshmem_mpmc_end * end)
+{
+    uint64_t bit = 1ull << end->slot;
+
+    __atomic_fetch_and(&end->q->data_waiters, ~bit, __ATOMIC_RELAXED);
+    __atomic_fetch_and(&end->q->space_waiters, ~bit, __ATOMIC_RELAXED);
+    __atomic_store_n(&end->q->waiter[end->slot], 0, __ATOMIC_RELEASE);
+}
+
+/* clear one bit of *waiters and ring its owner */
+static void wake_one(struct ivshmem_mpmc_end * end, uint64_t * waiters)
+{
+
+    uint64_t set, bit;
+    uint32_t id;
+
+    /* pairs with the fence a waiter puts between setting its bit and
+     * looking at the queue again */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while ((set = __atomic_load_n(waiters, __ATOMIC_RELAXED)) != 0) {
+        bit = set & -set;
+        /* whoever clears the bit owns the wakeup */
+        if (__atomic_fetch_and(waiters, ~bit, __ATOMIC_ACQ_REL) & bit) {
+            id = __atomic_load_n(&end->q->waiter[__builtin_ctzll(bit)],
+                                 __ATOMIC_ACQUIRE) - 1;
+            ivshmem_doorbell(end->dev, id >> 16, id & 0xffff);
+            end->doorbells++;
+            return;
+        }
+    }
+}
+
+void * ivshmem_mpmc_reserve(struct ivshmem_mpmc_end * end)
+{
+
+    struct ivshmem_mpmc * q = end->q;
+    struct ivshmem_mpmc_cell * cell;
+    uint32_t pos, seq;
+    int32_t dif;
+
+    pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = cell_at(q, pos, end->mask);
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (int32_t)(seq - pos);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1,
+                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return NULL;    /* full */
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    end->cell = cell;
+    end->pos = pos;
+    return cell->data;
+}
+
+void ivshmem_mpmc_commit(struct ivshmem_mpmc_end * end, uint32_t len)
+{
+    end->cell->len = len;
+    __atomic_store_n(&end->cell->seq, end->pos + 1, __ATOMIC_RELEASE);
+    end->cell = NULL;
+
+    wake_one(end, &end->q->data_waiters);
+}
+
+void * ivshmem_mpmc_claim(struct ivshmem_mpmc_end * end, uint32_t * len)
+{
+
+    struct ivshmem_mpmc * q = end->q;
+    struct ivshmem_mpmc_cell * cell;
+    uint32_t pos, seq;
+    int32_t dif;
+
+    pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = cell_at(q, pos, end->mask);
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (int32_t)(seq - (pos + 1));
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1,
+                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return NULL;    /* empty */
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    end->cell = cell;
+    end->pos = pos;
+    *len = cell->len;
+    return cell->data;
+}
+
+void ivshmem_mpmc_done(struct ivshmem_mpmc_end * end)
+{
+    __atomic_store_n(&end->cell->seq, end->pos + end->mask + 1,
+                     __ATOMIC_RELEASE);
+    end->cell = NULL;
+
+    wake_one(end, &end->q->space_waiters);
+}
+
+static int data_ready(struct ivshmem_mpmc_end * end)
+{
+    struct ivshmem_mpmc * q = end->q;
+    uint32_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&cell_at(q, pos, end->mask)->seq,
+                           __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+static int space_ready(struct ivshmem_mpmc_end * end)
+{
+    struct ivshmem_mpmc * q = end->q;
+    uint32_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&cell_at(q, pos, end->mask)->seq,
+                           __ATOMIC_ACQUIRE) == pos;
+}
+
+static int park(struct ivshmem_mpmc_end * end, uint64_t * waiters,
+                int (*ready)(struct ivshmem_mpmc_end *))
+{
+
+    uint64_t bit = 1ull << end->slot;
+    int i;
+
+    for (i = 0; i <= end->spin; i++) {
+        if (ready(end))
+            return 0;
+    }
+
+    /* announce ourselves, then look once more: either we see the item or
+     * its publisher sees our bit */
+    __atomic_fetch_or(waiters, bit, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ready(end)) {
+        __atomic_fetch_and(waiters, ~bit, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    end->sleeps++;
+    return ivshmem_wait(end->dev, end->vector) < 0 ? -1 : 0;
+}
+
+int ivshmem_mpmc_wait_data(struct ivshmem_mpmc_end * end)
+{
+    return park(end, &end->q->data_waiters, data_ready);
+}
+
+int ivshmem_mpmc_wait_space(struct ivshmem_mpmc_end * end)
+{
+    return park(end, &end->q->space_waiters, space_ready);
+}
+
+int ivshmem_mpmc_send(struct ivshmem_mpmc_end * end, const void * buf,
+                      uint32_t len)
+{
+
+    void * cell;
+
+    if (len > ivshmem_mpmc_capacity(end->q)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    while ((cell = ivshmem_mpmc_reserve(end)) == NULL) {
+        if (ivshmem_mpmc_wait_space(end) < 0)
+            return -1;
+    }
+
+    memcpy(cell, buf, len);
+    ivshmem_mpmc_commit(end, len);
+
+    return len;
+}
+
+int ivshmem_mpmc_recv(struct ivshmem_mpmc_end * end, void * buf,
+                      uint32_t len)
+{
+
+    void * cell;
+    uint32_t n;
+
+    while ((cell = ivshmem_mpmc_claim(end, &n)) == NULL) {
+        if (ivshmem_mpmc_wait_data(end) < 0)
+            return -1;
+    }
+
+    if (n > len)
+        n = len;
+    memcpy(buf, cell, n);
+    ivshmem_mpmc_done(end);
+
+    return n;
+}
+
+void ivshmem_mpmc_wake_all(struct ivshmem_mpmc_end * end)
+{
+    while (__atomic_load_n(&end->q->data_waiters, __ATOMIC_ACQUIRE))
+        wake_one(end, &end->q->data_waiters);
+    while (__atomic_load_n(&end->q->space_waiters, __ATOMIC_ACQUIRE))
+        wake_one(end, &end->q->space_waiters);
+}
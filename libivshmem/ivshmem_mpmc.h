@@ -0,0 +1,109 @@
+#ifndef IVSHMEM_MPMC_HDR
+#define IVSHMEM_MPMC_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded multi-producer/multi-consumer queue in the shared region, after
+ * Dmitry Vyukov's bounded MPMC queue: every cell carries a sequence number
+ * that says whether it is free for the enqueue at position pos (seq == pos)
+ * or holds the item for the dequeue at pos (seq == pos + 1).  Producers and
+ * consumers claim a position with one CAS on their own counter and then own
+ * the cell until they store its next sequence number, so payloads are
+ * written and read in place and no lock is ever held across VMs.
+ *
+ * Every end attaches with the vector it sleeps on and gets a slot in the
+ * waiter table.  A consumer that finds the queue empty sets its bit in
+ * data_waiters, rechecks and sleeps; a producer that publishes an item
+ * clears one set bit and rings that waiter.  Producers waiting for space
+ * are woken by consumers through space_waiters the same way.
+ */
+
+#define IVSHMEM_MPMC_MAGIC 0x4d504d43   /* "MPMC" */
+#define IVSHMEM_MPMC_MAX_WAITERS 64
+
+struct ivshmem_mpmc_cell {
+    uint32_t seq;
+    uint32_t len;
+    uint8_t data[];
+};
+
+struct ivshmem_mpmc {
+    uint32_t enqueue_pos __attribute__((aligned(64)));
+    uint32_t dequeue_pos __attribute__((aligned(64)));
+
+    uint64_t data_waiters __attribute__((aligned(64)));
+    uint64_t space_waiters __attribute__((aligned(64)));
+
+    /* written only at attach/detach: (posn << 16 | vector) + 1, or 0 */
+    uint32_t waiter[IVSHMEM_MPMC_MAX_WAITERS] __attribute__((aligned(64)));
+
+    uint32_t magic __attribute__((aligned(64)));
+    uint32_t ncells;
+    uint32_t cell_size;
+
+    uint8_t cells[] __attribute__((aligned(64)));
+};
+
+struct ivshmem_mpmc_end {
+    struct ivshmem_mpmc * q;
+    struct ivshmem_dev * dev;
+    int vector;
+    int slot;           /* our index in the waiter table */
+    int spin;           /* polls before parking */
+    uint32_t mask;
+
+    struct ivshmem_mpmc_cell * cell;    /* claimed by reserve/claim */
+    uint32_t pos;
+
+    unsigned long doorbells;
+    unsigned long sleeps;
+};
+
+size_t ivshmem_mpmc_bytes(uint32_t ncells, uint32_t msg_size);
+struct ivshmem_mpmc * ivshmem_mpmc_init(void * mem, size_t bytes,
+                                        uint32_t msg_size);
+
+/* -1 with EAGAIN before init, ENOSPC when the waiter table is full */
+int ivshmem_mpmc_attach(struct ivshmem_mpmc_end * end, void * mem,
+                        struct ivshmem_dev * dev, int vector);
+void ivshmem_mpmc_detach(struct ivshmem_mpmc_end * end);
+
+static inline uint32_t ivshmem_mpmc_capacity(const struct ivshmem_mpmc * q)
+{
+    return q->cell_size - sizeof(struct ivshmem_mpmc_cell);
+}
+
+/*
+ * Producer: reserve() claims a free cell and returns its payload area, or
+ * NULL if the queue is full; commit() publishes it.  Consumer: claim()
+ * returns the oldest item, or NULL if there is none, and done() frees its
+ * cell.  An end holds at most one cell at a time.
+ */
+void * ivshmem_mpmc_reserve(struct ivshmem_mpmc_end * end);
+void ivshmem_mpmc_commit(struct ivshmem_mpmc_end * end, uint32_t len);
+void * ivshmem_mpmc_claim(struct ivshmem_mpmc_end * end, uint32_t * len);
+void ivshmem_mpmc_done(struct ivshmem_mpmc_end * end);
+
+/* park until an item (space) may be available; 0 or -1 on device error */
+int ivshmem_mpmc_wait_data(struct ivshmem_mpmc_end * end);
+int ivshmem_mpmc_wait_space(struct ivshmem_mpmc_end * end);
+
+/* blocking copy in/out */
+int ivshmem_mpmc_send(struct ivshmem_mpmc_end * end, const void * buf,
+                      uint32_t len);
+int ivshmem_mpmc_recv(struct ivshmem_mpmc_end * end, void * buf,
+                      uint32_t len);
+
+/* ring every parked end, e.g. to make consumers notice a shutdown flag */
+void ivshmem_mpmc_wake_all(struct ivshmem_mpmc_end * end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_mutex.h"
+
+void ivshmem_mutex_init(struct ivshmem_mutex * m)
+{
+    __atomic_store_n(&m->magic, 0, __ATOMIC_RELAXED);
+    m->state = 0;
+    m->spin = IVSHMEM_MUTEX_MIN_SPIN;
+    m->sleepers = 0;
+    memset(m->waiter, 0, sizeof(m->waiter));
+    __atomic_store_n(&m->magic, IVSHMEM_MUTEX_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_mutex_attach(struct ivshmem_mutex_peer * p, void * mem,
+                         struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_mutex * m = mem;
+    uint32_t id = ((uint32_t)ivshmem_posn(dev) << 16 | vector) + 1;
+    uint32_t free;
+    int i;
+
+    if (__atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) != IVSHMEM_MUTEX_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->m = m;
+    p->dev = dev;
+    p->vector = vector;
+
+    for (i = 0; i < IVSHMEM_MUTEX_MAX_WAITERS; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&m->waiter[i], &free, id, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p->slot = i;
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+void ivshmem_mutex_detach(struct ivshmem_mutex_peer * p)
+{
+    __atomic_fetch_and(&p->m->sleepers, ~(1ull << p->slot), __ATOMIC_RELAXED);
+    __atomic_store_n(&p->m->waiter[p->slot], 0, __ATOMIC_RELEASE);
+}
+
+int ivshmem_mutex_lock_slow(struct ivshmem_mutex_peer * p)
+{
+
+    struct ivshmem_mutex * m = p->m;
+    uint64_t bit = 1ull << p->slot;
+    uint32_t spin, limit, i;
+
+    p->contended++;
+
+    spin = __atomic_load_n(&m->spin, __ATOMIC_RELAXED);
+    limit = spin * 2;
+    if (limit < IVSHMEM_MUTEX_MIN_SPIN)
+        limit = IVSHMEM_MUTEX_MIN_SPIN;
+    if (limit > IVSHMEM_MUTEX_MAX_SPIN)
+        limit = IVSHMEM_MUTEX_MAX_SPIN;
+
+    for (i = 0; i < limit; i++) {
+        ivshmem_relax();
+        if (__atomic_load_n(&m->state, __ATOMIC_RELAXED) == 0 &&
+                ivshmem_mutex_trylock(p))
+            break;
+    }
+
+    /* the estimate drifts towards what this acquisition needed */
+    __atomic_store_n(&m->spin, spin + ((int32_t)(i - spin)) / 8,
+                     __ATOMIC_RELAXED);
+    if (i < limit)
+        return 0;
+
+    for (;;) {
+        /* either the unlocker's exchange comes after ours and we get the
+         * lock, or it comes before, sees 2 and then sees our bit */
+        __atomic_fetch_or(&m->sleepers, bit, __ATOMIC_SEQ_CST);
+        if (__atomic_exchange_n(&m->state, 2, __ATOMIC_SEQ_CST) == 0) {
+            __atomic_fetch_and(&m->sleepers, ~bit, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        p->sleeps++;
+        if (ivshmem_wait(p->dev, p->vector) < 0) {
+            __atomic_fetch_and(&m->sleepers, ~bit, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+}
+
+void ivshmem_mutex_wake(struct ivshmem_mutex_peer * p)
+{
+
+    struct ivshmem_mutex * m = p->m;
+    uint64_t set, bit;
+    uint32_t id;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while ((set = __atomic_load_n(&m->sleepers, __ATOMIC_RELAXED)) != 0) {
+        bit = set & -set;
+        if (__atomic_fetch_and(&m->sleepers, ~bit, __ATOMIC_ACQ_REL) & bit) {
+            id = __atomic_load_n(&m->waiter[__builtin_ctzll(bit)],
+                                 __ATOMIC_ACQUIRE) - 1;
+            ivshmem_doorbell(p->dev, id >> 16, id & 0xffff);
+            p->doorbells++;
+            return;
+        }
+    }
+}
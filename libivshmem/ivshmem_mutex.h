@@ -0,0 +1,91 @@
+#ifndef IVSHMEM_MUTEX_HDR
+#define IVSHMEM_MUTEX_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Mutex in the shared region for peers in different VMs.  pthread spinlocks
+ * spin forever, and sem_t/pthread mutexes sleep on futexes, which only work
+ * inside one kernel.  This lock spins for a while and then sleeps on the
+ * caller's own doorbell vector.
+ *
+ * state is 0 (free), 1 (held) or 2 (held, maybe with sleepers), as in
+ * Drepper's futex mutex.  An unlocker that finds 1 does nothing more.  One
+ * that finds 2 clears a bit in the sleeper bitmap and rings that peer.
+ * The spin limit adapts: it moves towards twice the spins that recent
+ * acquisitions needed, up to IVSHMEM_MUTEX_MAX_SPIN.  Holders that are
+ * descheduled then cost little CPU, while short critical sections never
+ * sleep.
+ *
+ * A sleeper can take a doorbell meant for someone else on the same vector
+ * and will just go round again.  Give the lock a vector of its own if
+ * that vector is busy.
+ */
+
+#define IVSHMEM_MUTEX_MAGIC 0x4d555458  /* "MUTX" */
+#define IVSHMEM_MUTEX_MAX_WAITERS 64
+#define IVSHMEM_MUTEX_MIN_SPIN 16
+#define IVSHMEM_MUTEX_MAX_SPIN 16384
+
+struct ivshmem_mutex {
+    uint32_t state __attribute__((aligned(64)));
+    uint32_t spin;              /* adaptive spin estimate */
+    uint64_t sleepers;
+
+    uint32_t magic __attribute__((aligned(64)));
+    /* (posn << 16 | vector) + 1 of every attached peer, or 0 */
+    uint32_t waiter[IVSHMEM_MUTEX_MAX_WAITERS];
+};
+
+struct ivshmem_mutex_peer {
+    struct ivshmem_mutex * m;
+    struct ivshmem_dev * dev;
+    int vector;
+    int slot;
+
+    unsigned long contended;
+    unsigned long sleeps;
+    unsigned long doorbells;
+};
+
+void ivshmem_mutex_init(struct ivshmem_mutex * m);
+
+/* -1 with EAGAIN before init, ENOSPC when all waiter slots are taken */
+int ivshmem_mutex_attach(struct ivshmem_mutex_peer * p, void * mem,
+                         struct ivshmem_dev * dev, int vector);
+void ivshmem_mutex_detach(struct ivshmem_mutex_peer * p);
+
+int ivshmem_mutex_lock_slow(struct ivshmem_mutex_peer * p);
+void ivshmem_mutex_wake(struct ivshmem_mutex_peer * p);
+
+static inline int ivshmem_mutex_trylock(struct ivshmem_mutex_peer * p)
+{
+    uint32_t free = 0;
+
+    return __atomic_compare_exchange_n(&p->m->state, &free, 1, 0,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* 0, or -1 if waiting on the device failed */
+static inline int ivshmem_mutex_lock(struct ivshmem_mutex_peer * p)
+{
+    if (ivshmem_mutex_trylock(p))
+        return 0;
+    return ivshmem_mutex_lock_slow(p);
+}
+
+static inline void ivshmem_mutex_unlock(struct ivshmem_mutex_peer * p)
+{
+    if (__atomic_exchange_n(&p->m->state, 0, __ATOMIC_ACQ_REL) == 2)
+        ivshmem_mutex_wake(p);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_notify.h"
+
+void ivshmem_notify_init(struct ivshmem_notify * n)
+{
+    __atomic_store_n(&n->magic, 0, __ATOMIC_RELAXED);
+    n->posted = 0;
+    n->sleeping = 0;
+    __atomic_store_n(&n->magic, IVSHMEM_NOTIFY_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_notify_attach_sender(struct ivshmem_notifier * s, void * mem,
+                                 struct ivshmem_dev * dev, int peer,
+                                 int vector, uint32_t batch, uint64_t window_ns)
+{
+
+    struct ivshmem_notify * n = mem;
+
+    if (__atomic_load_n(&n->magic, __ATOMIC_ACQUIRE) != IVSHMEM_NOTIFY_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->n = n;
+    s->dev = dev;
+    s->peer = peer;
+    s->vector = vector;
+    s->batch = batch ? batch : 1;
+    s->window_ns = window_ns;
+    s->posted = __atomic_load_n(&n->posted, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int ivshmem_notify_attach_waiter(struct ivshmem_notify_waiter * w, void * mem,
+                                 struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_notify * n = mem;
+
+    if (__atomic_load_n(&n->magic, __ATOMIC_ACQUIRE) != IVSHMEM_NOTIFY_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(w, 0, sizeof(*w));
+    w->n = n;
+    w->dev = dev;
+    w->vector = vector;
+    w->spin = IVSHMEM_NOTIFY_SPIN;
+    w->seen = __atomic_load_n(&n->posted, __ATOMIC_ACQUIRE);
+
+    return 0;
+}
+
+void ivshmem_notify_kick(struct ivshmem_notifier * s)
+{
+
+    struct ivshmem_notify * n = s->n;
+
+    s->pending = 0;
+    s->kicks++;
+
+    /* pairs with the fence in ivshmem_notify_wait(): either it sees our
+     * posted count, or we see it asleep */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&n->sleeping, __ATOMIC_RELAXED) ||
+            !__atomic_exchange_n(&n->sleeping, 0, __ATOMIC_ACQ_REL))
+        return;
+
+    ivshmem_doorbell(s->dev, s->peer, s->vector);
+    s->doorbells++;
+}
+
+int64_t ivshmem_notify_poll(struct ivshmem_notifier * s)
+{
+
+    uint64_t age;
+
+    /* without a window only batch or flush() kick */
+    if (!s->pending || !s->window_ns)
+        return -1;
+
+    age = ivshmem_notify_now() - s->first;
+    if (age < s->window_ns)
+        return s->window_ns - age;
+
+    ivshmem_notify_kick(s);
+    return -1;
+}
+
+int ivshmem_notify_wait(struct ivshmem_notify_waiter * w)
+{
+
+    struct ivshmem_notify * n = w->n;
+    uint32_t got;
+    int i;
+
+    for (i = 0; i < w->spin; i++) {
+        if ((got = ivshmem_notify_trywait(w)))
+            return got;
+        ivshmem_relax();
+    }
+
+    for (;;) {
+        __atomic_store_n(&n->sleeping, 1, __ATOMIC_SEQ_CST);
+        if ((got = ivshmem_notify_trywait(w))) {
+            __atomic_store_n(&n->sleeping, 0, __ATOMIC_RELAXED);
+            return got;
+        }
+
+        w->sleeps++;
+        if (ivshmem_wait(w->dev, w->vector) < 0) {
+            __atomic_store_n(&n->sleeping, 0, __ATOMIC_RELAXED);
+            return -1;
+        }
+        /* a stale doorbell may have woken us, and then nobody cleared it */
+        if ((got = ivshmem_notify_trywait(w))) {
+            __atomic_store_n(&n->sleeping, 0, __ATOMIC_RELAXED);
+            return got;
+        }
+    }
+}
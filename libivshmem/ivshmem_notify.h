@@ -0,0 +1,150 @@
+#ifndef IVSHMEM_NOTIFY_HDR
+#define IVSHMEM_NOTIFY_HDR
+#include <stdint.h>
+#include <time.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event notifications from one sender to one receiver that do not cost a
+ * doorbell, and so a VM exit, per event.
+ *
+ * The sender counts events in the region, and the receiver takes the
+ * difference from what it has already seen.  Counts therefore stay exact
+ * however many doorbells are merged, unlike reconstructing them from the
+ * interrupt count read() returns, as sum_sema does.
+ *
+ * The sender rings only when the receiver has said it is going to sleep.
+ * A receiver that is still polling sees new events straight away, so
+ * those doorbells are skipped.  For a sleeping receiver, the sender can
+ * also hold the doorbell back until batch events are pending, or until
+ * the oldest pending one is window_ns old, whichever comes first.  Larger
+ * values mean fewer exits per second and more latency for a sleeping
+ * receiver.  With batch 1 every event rings a sleeping receiver at once.
+ *
+ * The window is only checked when the sender calls in, so a sender that
+ * goes quiet for a while calls ivshmem_notify_poll() meanwhile.  One that
+ * stops posting calls ivshmem_notify_flush(), or the last events can sit
+ * unannounced.
+ */
+
+#define IVSHMEM_NOTIFY_MAGIC 0x4e4f5446    /* "NOTF" */
+#define IVSHMEM_NOTIFY_SPIN 1000
+
+struct ivshmem_notify {
+    uint32_t posted __attribute__((aligned(64)));   /* by the sender */
+    uint32_t sleeping __attribute__((aligned(64))); /* by the receiver */
+    uint32_t magic __attribute__((aligned(64)));
+};
+
+struct ivshmem_notifier {
+    struct ivshmem_notify * n;
+    struct ivshmem_dev * dev;
+    int peer;
+    int vector;
+    uint32_t batch;
+    uint64_t window_ns;         /* 0: no time limit */
+
+    uint32_t posted;
+    uint32_t pending;           /* posted since the last kick */
+    uint64_t first;             /* when the oldest pending one was posted */
+
+    unsigned long posts;
+    unsigned long kicks;        /* times the sender considered ringing */
+    unsigned long doorbells;    /* ... and actually did */
+};
+
+struct ivshmem_notify_waiter {
+    struct ivshmem_notify * n;
+    struct ivshmem_dev * dev;
+    int vector;
+    int spin;                   /* polls before sleeping */
+    uint32_t seen;
+
+    unsigned long sleeps;
+};
+
+void ivshmem_notify_init(struct ivshmem_notify * n);
+
+/*
+ * Sender end: rings vector on peer.  Returns -1 with errno EAGAIN before
+ * init.
+ */
+int ivshmem_notify_attach_sender(struct ivshmem_notifier * s, void * mem,
+                                 struct ivshmem_dev * dev, int peer,
+                                 int vector, uint32_t batch, uint64_t window_ns);
+int ivshmem_notify_attach_waiter(struct ivshmem_notify_waiter * w, void * mem,
+                                 struct ivshmem_dev * dev, int vector);
+
+/* ring the receiver if it is asleep, and start a new batch */
+void ivshmem_notify_kick(struct ivshmem_notifier * s);
+
+static inline uint64_t ivshmem_notify_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* announce count new events */
+static inline void ivshmem_notify_post(struct ivshmem_notifier * s,
+                                       uint32_t count)
+{
+    uint64_t now = 0;
+
+    s->posted += count;
+    __atomic_store_n(&s->n->posted, s->posted, __ATOMIC_RELEASE);
+    s->posts += count;
+
+    if (s->window_ns) {
+        now = ivshmem_notify_now();
+        if (s->pending == 0)
+            s->first = now;
+    }
+    s->pending += count;
+
+    if (s->pending >= s->batch ||
+            (s->window_ns && now - s->first >= s->window_ns))
+        ivshmem_notify_kick(s);
+}
+
+static inline void ivshmem_notify_flush(struct ivshmem_notifier * s)
+{
+    if (s->pending)
+        ivshmem_notify_kick(s);
+}
+
+/*
+ * Kick if the window has run out.  Returns the nanoseconds left in it, or
+ * -1 when there is no window or nothing is pending.
+ */
+int64_t ivshmem_notify_poll(struct ivshmem_notifier * s);
+
+/* the events posted since the last call, 0 if none */
+static inline uint32_t ivshmem_notify_trywait(struct ivshmem_notify_waiter * w)
+{
+    uint32_t posted = __atomic_load_n(&w->n->posted, __ATOMIC_ACQUIRE);
+    uint32_t n = posted - w->seen;
+
+    w->seen = posted;
+    return n;
+}
+
+/* as trywait, but blocks for at least one; -1 if the device wait fails */
+int ivshmem_notify_wait(struct ivshmem_notify_waiter * w);
+
+/* events per doorbell so far */
+static inline double ivshmem_notify_ratio(const struct ivshmem_notifier * s)
+{
+    return s->doorbells ? (double)s->posts / s->doorbells : (double)s->posts;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_qlock.h"
+
+void ivshmem_mcs_init(struct ivshmem_mcs * l)
+{
+    __atomic_store_n(&l->magic, 0, __ATOMIC_RELAXED);
+    l->tail = 0;
+    memset(l->node, 0, sizeof(l->node));
+    __atomic_store_n(&l->magic, IVSHMEM_MCS_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_mcs_attach(struct ivshmem_mcs_peer * p, void * mem)
+{
+
+    struct ivshmem_mcs * l = mem;
+    uint32_t free;
+    int i;
+
+    if (__atomic_load_n(&l->magic, __ATOMIC_ACQUIRE) != IVSHMEM_MCS_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (i = 0; i < IVSHMEM_MCS_MAX_PEERS; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&l->node[i].owner, &free, 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p->l = l;
+            p->node = &l->node[i];
+            p->me = i + 1;
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+void ivshmem_mcs_detach(struct ivshmem_mcs_peer * p)
+{
+    __atomic_store_n(&p->node->owner, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,142 @@
+#ifndef IVSHMEM_QLOCK_HDR
+#define IVSHMEM_QLOCK_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fair spinning locks for the shared region.  pthread_spin_trylock() and
+ * the test-and-set in MemAccess.c let whichever peer's CAS lands first win,
+ * so one VM can starve the others, and every waiter hammers the same line.
+ * Both locks here grant the lock in arrival order.
+ *
+ * The ticket lock is two counters: take a ticket, wait until it is served.
+ * Waiters still share the now_serving line but poll it with a backoff
+ * proportional to their distance from the head of the queue.
+ *
+ * The MCS lock queues peers through nodes in the region, one cache line per
+ * peer, each claimed at attach.  A waiter spins only on its own node until
+ * its predecessor hands over, so a release touches one other line no matter
+ * how many peers wait.  Nodes are named by index, not pointer, because
+ * every VM maps the region somewhere else.
+ *
+ * Neither lock sleeps; waiters queued behind a preempted vCPU wait for it.
+ * Use ivshmem_mutex where vCPUs are oversubscribed.
+ */
+
+struct ivshmem_ticket {
+    uint32_t next __attribute__((aligned(64)));
+    uint32_t serving __attribute__((aligned(64)));
+};
+
+static inline void ivshmem_ticket_init(struct ivshmem_ticket * t)
+{
+    t->next = 0;
+    __atomic_store_n(&t->serving, 0, __ATOMIC_RELEASE);
+}
+
+static inline void ivshmem_ticket_lock(struct ivshmem_ticket * t)
+{
+    uint32_t me = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+    uint32_t serving, n;
+
+    while ((serving = __atomic_load_n(&t->serving, __ATOMIC_ACQUIRE)) != me) {
+        for (n = (me - serving) * 32; n; n--)
+            ivshmem_relax();
+    }
+}
+
+static inline int ivshmem_ticket_trylock(struct ivshmem_ticket * t)
+{
+    uint32_t me = __atomic_load_n(&t->serving, __ATOMIC_RELAXED);
+    uint32_t next = me;
+
+    return __atomic_compare_exchange_n(&t->next, &next, me + 1, 0,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ivshmem_ticket_unlock(struct ivshmem_ticket * t)
+{
+    /* only the holder writes serving */
+    __atomic_store_n(&t->serving, t->serving + 1, __ATOMIC_RELEASE);
+}
+
+#define IVSHMEM_MCS_MAGIC 0x4d435351    /* "MCSQ" */
+#define IVSHMEM_MCS_MAX_PEERS 64
+
+struct ivshmem_mcs_node {
+    uint32_t owner __attribute__((aligned(64)));   /* attached or 0 */
+    uint32_t next;              /* index + 1 of our successor, or 0 */
+    uint32_t locked;
+};
+
+struct ivshmem_mcs {
+    uint32_t tail __attribute__((aligned(64)));    /* index + 1, or 0 */
+    uint32_t magic __attribute__((aligned(64)));
+    struct ivshmem_mcs_node node[IVSHMEM_MCS_MAX_PEERS];
+};
+
+struct ivshmem_mcs_peer {
+    struct ivshmem_mcs * l;
+    struct ivshmem_mcs_node * node;
+    uint32_t me;                /* our index + 1 */
+};
+
+void ivshmem_mcs_init(struct ivshmem_mcs * l);
+
+/* -1 with EAGAIN before init, ENOSPC when every node is taken */
+int ivshmem_mcs_attach(struct ivshmem_mcs_peer * p, void * mem);
+void ivshmem_mcs_detach(struct ivshmem_mcs_peer * p);
+
+static inline void ivshmem_mcs_lock(struct ivshmem_mcs_peer * p)
+{
+    struct ivshmem_mcs_node * node = p->node;
+    uint32_t prev;
+
+    __atomic_store_n(&node->next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->locked, 1, __ATOMIC_RELAXED);
+
+    prev = __atomic_exchange_n(&p->l->tail, p->me, __ATOMIC_ACQ_REL);
+    if (!prev)
+        return;
+
+    __atomic_store_n(&p->l->node[prev - 1].next, p->me, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+        ivshmem_relax();
+}
+
+static inline int ivshmem_mcs_trylock(struct ivshmem_mcs_peer * p)
+{
+    uint32_t free = 0;
+
+    __atomic_store_n(&p->node->next, 0, __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&p->l->tail, &free, p->me, 0,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ivshmem_mcs_unlock(struct ivshmem_mcs_peer * p)
+{
+    struct ivshmem_mcs_node * node = p->node;
+    uint32_t next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    uint32_t me = p->me;
+
+    if (!next) {
+        if (__atomic_compare_exchange_n(&p->l->tail, &me, 0, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+        /* a successor has swung the tail but not linked in yet */
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+            ivshmem_relax();
+    }
+
+    __atomic_store_n(&p->l->node[next - 1].locked, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <errno.h>
+#include "ivshmem_coll.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef void (* kernel_fn)(void * dst, const void * src, size_t n);
+
+const char * ivshmem_isa_names[] = { "generic", "avx2", "avx512" };
+
+static int isa = -1;
+
+/*
+ * Float min and max take src unless dst compares strictly smaller
+ * (larger), so equal values and NaNs give src.  MINPS/MAXPS and friends
+ * return their second operand in those cases, and the vector kernels pass
+ * src second, so every kernel gives the same answer.  Integer sums wrap.
+ */
+#define GENERIC(name, T, expr)                                          \
+static void name(void * dst, const void * src, size_t n)                \
+{                                                                       \
+    T * d = dst;                                                        \
+    const T * s = src;                                                  \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i < n; i++)                                             \
+        d[i] = (expr);                                                  \
+}
+
+GENERIC(sum_i32, uint32_t, d[i] + s[i])
+GENERIC(min_i32, int32_t, s[i] < d[i] ? s[i] : d[i])
+GENERIC(max_i32, int32_t, s[i] > d[i] ? s[i] : d[i])
+GENERIC(sum_f32, float, d[i] + s[i])
+GENERIC(min_f32, float, d[i] < s[i] ? d[i] : s[i])
+GENERIC(max_f32, float, d[i] > s[i] ? d[i] : s[i])
+GENERIC(sum_f64, double, d[i] + s[i])
+GENERIC(min_f64, double, d[i] < s[i] ? d[i] : s[i])
+GENERIC(max_f64, double, d[i] > s[i] ? d[i] : s[i])
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * One vector per iteration, two of them unrolled: the loop is bound by
+ * memory long before the ALU.  What does not fill a vector goes to the
+ * generic kernel.  Loads and stores are unaligned, slots and user buffers
+ * need not agree on alignment.
+ */
+#define VECTOR(name, tgt, T, VT, W, load, store, op, tail)              \
+__attribute__((target(tgt)))                                            \
+static void name(void * dst, const void * src, size_t n)                \
+{                                                                       \
+    T * d = dst;                                                        \
+    const T * s = src;                                                  \
+    VT a, b;                                                            \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i + 2 * W <= n; i += 2 * W) {                           \
+        a = op(load(d + i), load(s + i));                               \
+        b = op(load(d + i + W), load(s + i + W));                       \
+        store(d + i, a);                                                \
+        store(d + i + W, b);                                            \
+    }                                                                   \
+    for (; i + W <= n; i += W)                                          \
+        store(d + i, op(load(d + i), load(s + i)));                     \
+    tail(d + i, s + i, n - i);                                          \
+}
+
+#define LOAD256I(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STORE256I(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define LOAD512I(p) _mm512_loadu_si512((const void *)(p))
+#define STORE512I(p, v) _mm512_storeu_si512((void *)(p), v)
+
+VECTOR(sum_i32_avx2, "avx2", int32_t, __m256i, 8, LOAD256I, STORE256I, _mm256_add_epi32, sum_i32)
+VECTOR(min_i32_avx2, "avx2", int32_t, __m256i, 8, LOAD256I, STORE256I, _mm256_min_epi32, min_i32)
+VECTOR(max_i32_avx2, "avx2", int32_t, __m256i, 8, LOAD256I, STORE256I, _mm256_max_epi32, max_i32)
+VECTOR(sum_f32_avx2, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, sum_f32)
+VECTOR(min_f32_avx2, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_min_ps, min_f32)
+VECTOR(max_f32_avx2, "avx2", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_max_ps, max_f32)
+VECTOR(sum_f64_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, sum_f64)
+VECTOR(min_f64_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd, min_f64)
+VECTOR(max_f64_avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_max_pd, max_f64)
+
+VECTOR(sum_i32_avx512, "avx512f", int32_t, __m512i, 16, LOAD512I, STORE512I, _mm512_add_epi32, sum_i32)
+VECTOR(min_i32_avx512, "avx512f", int32_t, __m512i, 16, LOAD512I, STORE512I, _mm512_min_epi32, min_i32)
+VECTOR(max_i32_avx512, "avx512f", int32_t, __m512i, 16, LOAD512I, STORE512I, _mm512_max_epi32, max_i32)
+VECTOR(sum_f32_avx512, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, sum_f32)
+VECTOR(min_f32_avx512, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_min_ps, min_f32)
+VECTOR(max_f32_avx512, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_max_ps, max_f32)
+VECTOR(sum_f64_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, sum_f64)
+VECTOR(min_f64_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_min_pd, min_f64)
+VECTOR(max_f64_avx512, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_max_pd, max_f64)
+
+#endif
+
+static const kernel_fn kernels[IVSHMEM_NISAS][IVSHMEM_NTYPES][IVSHMEM_NOPS] = {
+    [IVSHMEM_ISA_GENERIC] = {
+        { sum_i32, min_i32, max_i32 },
+        { sum_f32, min_f32, max_f32 },
+        { sum_f64, min_f64, max_f64 },
+    },
+#ifdef HAVE_X86_KERNELS
+    [IVSHMEM_ISA_AVX2] = {
+        { sum_i32_avx2, min_i32_avx2, max_i32_avx2 },
+        { sum_f32_avx2, min_f32_avx2, max_f32_avx2 },
+        { sum_f64_avx2, min_f64_avx2, max_f64_avx2 },
+    },
+    [IVSHMEM_ISA_AVX512] = {
+        { sum_i32_avx512, min_i32_avx512, max_i32_avx512 },
+        { sum_f32_avx512, min_f32_avx512, max_f32_avx512 },
+        { sum_f64_avx512, min_f64_avx512, max_f64_avx512 },
+    },
+#endif
+};
+
+static int supported(int i)
+{
+    if (i == IVSHMEM_ISA_GENERIC)
+        return 1;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (i == IVSHMEM_ISA_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (i == IVSHMEM_ISA_AVX512)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return 0;
+}
+
+int ivshmem_reduce_isa(void)
+{
+    int i = __atomic_load_n(&isa, __ATOMIC_RELAXED);
+
+    if (i < 0) {
+        /* racing callers all pick the same one */
+        for (i = IVSHMEM_NISAS - 1; !supported(i); i--)
+            ;
+        __atomic_store_n(&isa, i, __ATOMIC_RELAXED);
+    }
+
+    return i;
+}
+
+int ivshmem_reduce_set_isa(int i)
+{
+    if (i < 0 || i >= IVSHMEM_NISAS || !supported(i)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    __atomic_store_n(&isa, i, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+size_t ivshmem_coll_type_size(int type)
+{
+    return type == IVSHMEM_DOUBLE ? sizeof(double) : sizeof(int32_t);
+}
+
+void ivshmem_reduce(void * dst, const void * src, size_t count, int type,
+                    int op)
+{
+    kernels[ivshmem_reduce_isa()][type][op](dst, src, count);
+}
@@ -0,0 +1,407 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_rpc.h"
+
+#define RPC_SPIN 1000
+
+static void * req_ring(struct ivshmem_rpc * rpc, int i)
+{
+    return rpc->rings + (size_t)2 * i * rpc->ring_bytes;
+}
+
+static void * resp_ring(struct ivshmem_rpc * rpc, int i)
+{
+    return rpc->rings + (size_t)(2 * i + 1) * rpc->ring_bytes;
+}
+
+size_t ivshmem_rpc_bytes(int nclients, size_t ring_bytes)
+{
+    ring_bytes &= ~(size_t)(IVSHMEM_CACHELINE - 1);
+    return offsetof(struct ivshmem_rpc, rings) + 2 * nclients * ring_bytes;
+}
+
+/* back to an empty pair of rings, for the next client of slot i */
+static int reset_rings(struct ivshmem_rpc * rpc, int i)
+{
+    uint32_t slot_size = rpc->max_msg + sizeof(struct ivshmem_rpc_hdr);
+
+    if (!ivshmem_spsc_init(req_ring(rpc, i), rpc->ring_bytes, slot_size) ||
+            !ivshmem_spsc_init(resp_ring(rpc, i), rpc->ring_bytes, slot_size))
+        return -1;
+    return 0;
+}
+
+/* answer up to a batch of client i's requests; returns how many */
+static int serve(struct ivshmem_rpc_worker * w, struct ivshmem_rpc_conn * c)
+{
+
+    struct ivshmem_rpc_server * s = w->server;
+    struct ivshmem_rpc_hdr * req, * resp;
+    uint32_t len, max = ivshmem_spsc_capacity(c->resp.ring) - sizeof(*resp);
+    int n, r;
+
+    for (n = 0; n < IVSHMEM_RPC_BATCH; n++) {
+        if ((req = ivshmem_spsc_peek(&c->req, &len)) == NULL)
+            break;
+        /* the client's window keeps this from failing */
+        if ((resp = ivshmem_spsc_reserve(&c->resp)) == NULL)
+            break;
+
+        /* the ring is written by another VM; a runt has no header */
+        if (len < sizeof(*req)) {
+            resp->id = 0;
+            resp->method = 0;
+            r = -EINVAL;
+        } else {
+            r = s->handler(s->arg, req->method, req->data,
+                           len - sizeof(*req), resp->data, max);
+            /* committing more than the slot holds would corrupt the ring */
+            if (r > (int)max)
+                r = -EMSGSIZE;
+            resp->id = req->id;
+            resp->method = req->method;
+        }
+        resp->status = r < 0 ? -r : 0;
+        ivshmem_spsc_commit(&c->resp, sizeof(*resp) + (r < 0 ? 0 : r));
+        ivshmem_spsc_consume(&c->req);
+    }
+
+    if (n) {
+        /* one doorbell, if any, for the whole batch */
+        ivshmem_spsc_flush(&c->resp);
+        ivshmem_spsc_release(&c->req);
+        w->calls += n;
+    }
+
+    return n;
+}
+
+/* move slot i along; returns non-zero if there was anything to do */
+static int poll_slot(struct ivshmem_rpc_worker * w, int i)
+{
+
+    struct ivshmem_rpc * rpc = w->server->rpc;
+    struct ivshmem_rpc_slot * slot = &rpc->slot[i];
+    struct ivshmem_rpc_conn * c = &w->conn[i];
+
+    switch (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) {
+    case IVSHMEM_RPC_CONNECTING:
+        ivshmem_spsc_attach(&c->req, req_ring(rpc, i), IVSHMEM_SPSC_CONSUMER,
+                            &w->dev, slot->client_posn, slot->client_vector,
+                            w->index);
+        ivshmem_spsc_attach(&c->resp, resp_ring(rpc, i), IVSHMEM_SPSC_PRODUCER,
+                            &w->dev, slot->client_posn, slot->client_vector,
+                            w->index);
+        c->attached = 1;
+        __atomic_store_n(&slot->state, IVSHMEM_RPC_CONNECTED, __ATOMIC_SEQ_CST);
+        ivshmem_doorbell(&w->dev, slot->client_posn, slot->client_vector);
+        return 1;
+
+    case IVSHMEM_RPC_CONNECTED:
+        return c->attached ? serve(w, c) : 0;
+
+    case IVSHMEM_RPC_CLOSING:
+        c->attached = 0;
+        reset_rings(rpc, i);
+        __atomic_store_n(&slot->state, IVSHMEM_RPC_FREE, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Ask every connected client's request ring for a doorbell; returns
+ * non-zero if one of them already has requests waiting.
+ */
+static int arm(struct ivshmem_rpc_worker * w)
+{
+
+    struct ivshmem_rpc_server * s = w->server;
+    int i, pending = 0;
+
+    for (i = w->index; i < s->rpc->nclients; i += s->nworkers)
+        if (w->conn[i].attached)
+            pending |= ivshmem_spsc_arm_data(&w->conn[i].req);
+
+    return pending;
+}
+
+static void * worker_main(void * arg)
+{
+
+    struct ivshmem_rpc_worker * w = arg;
+    struct ivshmem_rpc_server * s = w->server;
+    int i, busy, idle = 0;
+
+    for (;;) {
+        busy = 0;
+        for (i = w->index; i < s->rpc->nclients; i += s->nworkers)
+            busy |= poll_slot(w, i);
+
+        if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE))
+            break;
+
+        if (busy) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < s->spin) {
+            ivshmem_relax();
+            continue;
+        }
+
+        /*
+         * Clients ring us after every state change they make, so a
+         * connect or close that arrives now leaves a count behind for
+         * the wait below.
+         */
+        if (arm(w))
+            continue;
+        w->sleeps++;
+        if (ivshmem_wait(&w->dev, w->index) < 0)
+            break;
+        idle = 0;
+    }
+
+    return NULL;
+}
+
+int ivshmem_rpc_server_start(struct ivshmem_rpc_server * s, const char * path,
+                             size_t size, size_t offset, int nclients,
+                             int nworkers, size_t ring_bytes, uint32_t max_msg,
+                             ivshmem_rpc_handler handler, void * arg)
+{
+
+    struct ivshmem_rpc * rpc;
+    struct ivshmem_rpc_worker * w;
+    int i, t, err;
+
+    if (nclients < 1 || nclients > IVSHMEM_RPC_MAX_CLIENTS ||
+            nworkers < 1 || nworkers > IVSHMEM_RPC_MAX_WORKERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    if (ivshmem_open(&s->dev, path, size, nworkers) < 0)
+        return -1;
+    if (offset + ivshmem_rpc_bytes(nclients, ring_bytes) > s->dev.size) {
+        ivshmem_close(&s->dev);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    s->offset = offset;
+    s->rpc = rpc = (struct ivshmem_rpc *)((char *)s->dev.mem + offset);
+    s->handler = handler;
+    s->arg = arg;
+    s->nworkers = nworkers;
+    s->spin = RPC_SPIN;
+
+    __atomic_store_n(&rpc->magic, 0, __ATOMIC_RELAXED);
+    rpc->nclients = nclients;
+    rpc->nworkers = nworkers;
+    rpc->ring_bytes = ring_bytes & ~(size_t)(IVSHMEM_CACHELINE - 1);
+    rpc->max_msg = max_msg;
+
+    /* every worker needs its own device before slots can name it */
+    for (t = 0; t < nworkers; t++) {
+        w = &s->worker[t];
+        w->server = s;
+        w->index = t;
+        if (ivshmem_open(&w->dev, path, size, nworkers) < 0 ||
+                (w->conn = calloc(nclients, sizeof(*w->conn))) == NULL)
+            goto fail;
+    }
+
+    for (i = 0; i < nclients; i++) {
+        if (reset_rings(rpc, i) < 0) {
+            errno = EINVAL;
+            goto fail;
+        }
+        rpc->slot[i].state = IVSHMEM_RPC_FREE;
+        rpc->slot[i].server_posn = ivshmem_posn(&s->worker[i % nworkers].dev);
+        rpc->slot[i].server_vector = i % nworkers;
+    }
+
+    __atomic_store_n(&rpc->magic, IVSHMEM_RPC_MAGIC, __ATOMIC_RELEASE);
+
+    for (t = 0; t < nworkers; t++)
+        if ((err = pthread_create(&s->worker[t].thread, NULL, worker_main,
+                                  &s->worker[t])) != 0) {
+            s->nworkers = t;
+            ivshmem_rpc_server_stop(s);
+            errno = err;
+            return -1;
+        }
+
+    return 0;
+
+fail:
+    __atomic_store_n(&rpc->magic, 0, __ATOMIC_RELAXED);
+    for (t = 0; t < nworkers; t++) {
+        free(s->worker[t].conn);
+        if (s->worker[t].dev.mem)
+            ivshmem_close(&s->worker[t].dev);
+    }
+    ivshmem_close(&s->dev);
+    return -1;
+}
+
+void ivshmem_rpc_server_stop(struct ivshmem_rpc_server * s)
+{
+
+    struct ivshmem_rpc_worker * w;
+    int t;
+
+    __atomic_store_n(&s->rpc->magic, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+
+    for (t = 0; t < s->nworkers; t++) {
+        w = &s->worker[t];
+        ivshmem_doorbell(&s->dev, ivshmem_posn(&w->dev), t);
+        pthread_join(w->thread, NULL);
+    }
+    for (t = 0; t < IVSHMEM_RPC_MAX_WORKERS; t++) {
+        w = &s->worker[t];
+        free(w->conn);
+        if (w->dev.mem)
+            ivshmem_close(&w->dev);
+    }
+    ivshmem_close(&s->dev);
+}
+
+int ivshmem_rpc_connect(struct ivshmem_rpc_client * c, void * mem,
+                        struct ivshmem_dev * dev, int vector)
+{
+
+    struct ivshmem_rpc * rpc = mem;
+    struct ivshmem_rpc_slot * slot;
+    uint32_t state;
+    int i;
+
+    if (__atomic_load_n(&rpc->magic, __ATOMIC_ACQUIRE) != IVSHMEM_RPC_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (i = 0; i < rpc->nclients; i++) {
+        state = IVSHMEM_RPC_FREE;
+        if (__atomic_compare_exchange_n(&rpc->slot[i].state, &state,
+                                IVSHMEM_RPC_CLAIMED, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == rpc->nclients) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->rpc = rpc;
+    c->slot = slot = &rpc->slot[i];
+    slot->client_posn = ivshmem_posn(dev);
+    slot->client_vector = vector;
+    __atomic_store_n(&slot->state, IVSHMEM_RPC_CONNECTING, __ATOMIC_SEQ_CST);
+    ivshmem_doorbell(dev, slot->server_posn, slot->server_vector);
+
+    /* the worker rings back once it has attached */
+    for (i = 0; __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) !=
+                IVSHMEM_RPC_CONNECTED; i++) {
+        if (i < RPC_SPIN)
+            ivshmem_relax();
+        else if (ivshmem_wait(dev, vector) < 0)
+            return -1;
+    }
+
+    ivshmem_spsc_attach(&c->req, req_ring(rpc, slot - rpc->slot),
+                        IVSHMEM_SPSC_PRODUCER, dev, slot->server_posn,
+                        slot->server_vector, vector);
+    ivshmem_spsc_attach(&c->resp, resp_ring(rpc, slot - rpc->slot),
+                        IVSHMEM_SPSC_CONSUMER, dev, slot->server_posn,
+                        slot->server_vector, vector);
+
+    return 0;
+}
+
+void ivshmem_rpc_disconnect(struct ivshmem_rpc_client * c)
+{
+
+    struct ivshmem_rpc_slot * slot = c->slot;
+
+    /* the worker resets the rings and frees the slot */
+    __atomic_store_n(&slot->state, IVSHMEM_RPC_CLOSING, __ATOMIC_SEQ_CST);
+    ivshmem_doorbell(c->req.dev, slot->server_posn, slot->server_vector);
+}
+
+int64_t ivshmem_rpc_send(struct ivshmem_rpc_client * c, uint16_t method,
+                         const void * req, uint32_t len, int flush)
+{
+
+    struct ivshmem_rpc_hdr * hdr;
+
+    if (len > ivshmem_rpc_max_payload(c)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (c->outstanding == ivshmem_rpc_window(c) ||
+            (hdr = ivshmem_spsc_reserve(&c->req)) == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    hdr->id = c->next_id;
+    hdr->method = method;
+    hdr->status = 0;
+    memcpy(hdr->data, req, len);
+    ivshmem_spsc_commit(&c->req, sizeof(*hdr) + len);
+    if (flush)
+        ivshmem_spsc_flush(&c->req);
+
+    c->outstanding++;
+    return c->next_id++;
+}
+
+int ivshmem_rpc_recv(struct ivshmem_rpc_client * c, uint32_t * id,
+                     void * resp, uint32_t max)
+{
+
+    struct ivshmem_rpc_hdr * hdr;
+    uint32_t len;
+    int rv;
+
+    /* nothing comes back for calls the server has not been shown */
+    ivshmem_spsc_flush(&c->req);
+
+    while ((hdr = ivshmem_spsc_peek(&c->resp, &len)) == NULL)
+        if (ivshmem_spsc_wait_data(&c->resp) < 0)
+            return -1;
+
+    len -= sizeof(*hdr);
+    if (id)
+        *id = hdr->id;
+    if (hdr->status) {
+        errno = hdr->status;
+        rv = -1;
+    } else {
+        memcpy(resp, hdr->data, len < max ? len : max);
+        rv = len;
+    }
+
+    ivshmem_spsc_consume(&c->resp);
+    ivshmem_spsc_release(&c->resp);
+    c->outstanding--;
+
+    return rv;
+}
+
+int ivshmem_rpc_call(struct ivshmem_rpc_client * c, uint16_t method,
+                     const void * req, uint32_t len, void * resp, uint32_t max)
+{
+    if (ivshmem_rpc_send(c, method, req, len, 1) < 0)
+        return -1;
+    return ivshmem_rpc_recv(c, NULL, resp, max);
+}
@@ -0,0 +1,176 @@
+#ifndef IVSHMEM_RPC_HDR
+#define IVSHMEM_RPC_HDR
+#include <stdint.h>
+#include <pthread.h>
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Request/response calls between VMs over the shared region, for services
+ * that co-located guests would otherwise reach over TCP.
+ *
+ * The server lays out a table of client slots and, for each, a request ring
+ * (client to server) and a response ring (server to client), both SPSC
+ * rings with doorbell suppression.  Every message is an 8-byte header (call
+ * id, method, status) followed by the payload; the ring slot carries the
+ * length.  A client can have as many calls outstanding as its request ring
+ * has slots, and responses come back in the order the calls were made.
+ * Since the response ring is as big, the server never waits for a client
+ * to make room, and a client never waits to send.
+ *
+ * The server runs a dispatcher thread per worker.  Worker t serves every
+ * client slot i with i % nworkers == t and sleeps on vector t of its own
+ * open of the device, so workers never share a struct ivshmem_dev.  The
+ * worker handling a slot is advertised in the slot; a client writes its own
+ * position and vector there, marks the slot CONNECTING and rings the
+ * worker, which attaches the rings and answers CONNECTED.
+ */
+
+#define IVSHMEM_RPC_MAGIC 0x52504331    /* "RPC1" */
+#define IVSHMEM_RPC_MAX_CLIENTS 64
+#define IVSHMEM_RPC_MAX_WORKERS 16
+#define IVSHMEM_RPC_BATCH 32            /* requests per client per pass */
+
+enum ivshmem_rpc_state {
+    IVSHMEM_RPC_FREE,
+    IVSHMEM_RPC_CLAIMED,
+    IVSHMEM_RPC_CONNECTING,
+    IVSHMEM_RPC_CONNECTED,
+    IVSHMEM_RPC_CLOSING,
+};
+
+struct ivshmem_rpc_hdr {
+    uint32_t id;
+    uint16_t method;
+    uint16_t status;            /* 0, or an errno from the handler */
+    uint8_t data[];
+};
+
+struct ivshmem_rpc_slot {
+    uint32_t state __attribute__((aligned(64)));
+    int32_t client_posn;
+    int32_t client_vector;
+    int32_t server_posn;
+    int32_t server_vector;
+};
+
+struct ivshmem_rpc {
+    uint32_t magic;
+    uint32_t nclients;
+    uint32_t nworkers;
+    uint32_t ring_bytes;
+    uint32_t max_msg;
+    struct ivshmem_rpc_slot slot[IVSHMEM_RPC_MAX_CLIENTS];
+    uint8_t rings[] __attribute__((aligned(64)));
+};
+
+/*
+ * Called by a worker thread for every request.  Write at most max bytes of
+ * response into resp, directly in the response ring, and return its length,
+ * or return a negative errno to fail the call.  A length over max fails
+ * the call with EMSGSIZE.
+ */
+typedef int (*ivshmem_rpc_handler)(void * arg, uint16_t method,
+                                   const void * req, uint32_t len,
+                                   void * resp, uint32_t max);
+
+/* a worker's ends of one client's rings */
+struct ivshmem_rpc_conn {
+    struct ivshmem_spsc_end req;
+    struct ivshmem_spsc_end resp;
+    int attached;
+};
+
+struct ivshmem_rpc_worker {
+    struct ivshmem_rpc_server * server;
+    struct ivshmem_dev dev;
+    struct ivshmem_rpc_conn * conn;     /* indexed by client slot */
+    pthread_t thread;
+    int index;
+    unsigned long calls;
+    unsigned long sleeps;
+};
+
+struct ivshmem_rpc_server {
+    struct ivshmem_dev dev;     /* the main thread's, to ring workers */
+    size_t offset;
+    struct ivshmem_rpc * rpc;
+    ivshmem_rpc_handler handler;
+    void * arg;
+    int nworkers;
+    int spin;                   /* idle passes before a worker sleeps */
+    int stop;
+    struct ivshmem_rpc_worker worker[IVSHMEM_RPC_MAX_WORKERS];
+};
+
+struct ivshmem_rpc_client {
+    struct ivshmem_rpc * rpc;
+    struct ivshmem_rpc_slot * slot;
+    struct ivshmem_spsc_end req;
+    struct ivshmem_spsc_end resp;
+    uint32_t next_id;
+    uint32_t outstanding;
+};
+
+/* bytes of region needed for nclients with ring_bytes per ring */
+size_t ivshmem_rpc_bytes(int nclients, size_t ring_bytes);
+
+/*
+ * Lay out the RPC area at offset in the region at path (size as for
+ * ivshmem_open()), with rings of ring_bytes for messages of up to max_msg
+ * bytes, and start nworkers dispatcher threads.  Each thread opens path
+ * itself, and nworkers vectors are needed.  Returns 0, or -1 with errno.
+ */
+int ivshmem_rpc_server_start(struct ivshmem_rpc_server * s, const char * path,
+                             size_t size, size_t offset, int nclients,
+                             int nworkers, size_t ring_bytes, uint32_t max_msg,
+                             ivshmem_rpc_handler handler, void * arg);
+void ivshmem_rpc_server_stop(struct ivshmem_rpc_server * s);
+
+/* -1 with EAGAIN before the server is up, ENOSPC when it is full */
+int ivshmem_rpc_connect(struct ivshmem_rpc_client * c, void * mem,
+                        struct ivshmem_dev * dev, int vector);
+void ivshmem_rpc_disconnect(struct ivshmem_rpc_client * c);
+
+/* largest request or response payload */
+static inline uint32_t ivshmem_rpc_max_payload(const struct ivshmem_rpc_client * c)
+{
+    return ivshmem_spsc_capacity(c->req.ring) - sizeof(struct ivshmem_rpc_hdr);
+}
+
+/* calls that can be outstanding at once */
+static inline uint32_t ivshmem_rpc_window(const struct ivshmem_rpc_client * c)
+{
+    return c->req.ring->nslots;
+}
+
+/*
+ * Start a call without waiting for it and return its id.  Calls queue up
+ * unseen until one is sent with flush set, so a batch costs the server at
+ * most one doorbell.  -1 with EAGAIN when the window is full (recv first),
+ * EMSGSIZE when req is too long.
+ */
+int64_t ivshmem_rpc_send(struct ivshmem_rpc_client * c, uint16_t method,
+                         const void * req, uint32_t len, int flush);
+
+/*
+ * Wait for the next response, in call order.  Returns its payload length
+ * (copied up to max) and stores its id; -1 with errno set to the handler's
+ * error for a failed call.
+ */
+int ivshmem_rpc_recv(struct ivshmem_rpc_client * c, uint32_t * id,
+                     void * resp, uint32_t max);
+
+/* one call, start to finish */
+int ivshmem_rpc_call(struct ivshmem_rpc_client * c, uint16_t method,
+                     const void * req, uint32_t len, void * resp, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
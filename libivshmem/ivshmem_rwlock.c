@@ -0,0 +1,110 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_rwlock.h"
+
+/*
+ * Records are copied with relaxed atomic accesses so that the racing reads
+ * of a torn record are not undefined behaviour; whole words where the
+ * alignment allows it.
+ */
+static void copy_relaxed(void * dst, const void * src, size_t len)
+{
+
+    uint64_t * d8 = dst;
+    const uint64_t * s8 = src;
+    uint8_t * d;
+    const uint8_t * s;
+
+    if (!(((uintptr_t)dst | (uintptr_t)src) & 7)) {
+        for (; len >= 8; len -= 8)
+            __atomic_store_n(d8++, __atomic_load_n(s8++, __ATOMIC_RELAXED),
+                             __ATOMIC_RELAXED);
+    }
+
+    d = (uint8_t *)d8;
+    s = (const uint8_t *)s8;
+    while (len--)
+        __atomic_store_n(d++, __atomic_load_n(s++, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+}
+
+void ivshmem_seqlock_read(const struct ivshmem_seqlock * sl, void * dst,
+                          const void * src, size_t len)
+{
+    uint32_t seq;
+
+    do {
+        seq = ivshmem_seqlock_read_begin(sl);
+        copy_relaxed(dst, src, len);
+    } while (ivshmem_seqlock_read_retry(sl, seq));
+}
+
+void ivshmem_seqlock_write(struct ivshmem_seqlock * sl, void * dst,
+                           const void * src, size_t len)
+{
+    ivshmem_seqlock_write_begin(sl);
+    copy_relaxed(dst, src, len);
+    ivshmem_seqlock_write_end(sl);
+}
+
+void ivshmem_rwlock_init(struct ivshmem_rwlock * l)
+{
+    __atomic_store_n(&l->magic, 0, __ATOMIC_RELAXED);
+    l->writer = 0;
+    memset(l->reader, 0, sizeof(l->reader));
+    __atomic_store_n(&l->magic, IVSHMEM_RWLOCK_MAGIC, __ATOMIC_RELEASE);
+}
+
+int ivshmem_rwlock_attach(struct ivshmem_rwlock_peer * p, void * mem)
+{
+
+    struct ivshmem_rwlock * l = mem;
+    uint32_t free;
+    int i;
+
+    if (__atomic_load_n(&l->magic, __ATOMIC_ACQUIRE) != IVSHMEM_RWLOCK_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for (i = 0; i < IVSHMEM_RWLOCK_MAX_PEERS; i++) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&l->reader[i].owner, &free, 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            p->l = l;
+            p->me = &l->reader[i];
+            return 0;
+        }
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+void ivshmem_rwlock_detach(struct ivshmem_rwlock_peer * p)
+{
+    __atomic_store_n(&p->me->owner, 0, __ATOMIC_RELEASE);
+}
+
+void ivshmem_rwlock_write_lock(struct ivshmem_rwlock_peer * p)
+{
+
+    struct ivshmem_rwlock * l = p->l;
+    uint32_t free;
+    int i;
+
+    for (;;) {
+        free = 0;
+        if (__atomic_compare_exchange_n(&l->writer, &free, 1, 1,
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            break;
+        while (__atomic_load_n(&l->writer, __ATOMIC_RELAXED))
+            ivshmem_relax();
+    }
+
+    /* every reader that got in before our store shows up in its count */
+    for (i = 0; i < IVSHMEM_RWLOCK_MAX_PEERS; i++) {
+        while (__atomic_load_n(&l->reader[i].readers, __ATOMIC_ACQUIRE))
+            ivshmem_relax();
+    }
+}
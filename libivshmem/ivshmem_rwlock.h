@@ -0,0 +1,139 @@
+#ifndef IVSHMEM_RWLOCK_HDR
+#define IVSHMEM_RWLOCK_HDR
+#include <stdint.h>
+#include <stddef.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Primitives for read-mostly state shared between guests, such as
+ * configuration and routing tables, where readers should not pay for
+ * each other.
+ *
+ * The seqlock suits small records.  Readers take no lock at all: they copy
+ * the record and retry if the sequence number was odd or changed under
+ * them, so they only ever read the lock's line.  Writers serialise on the
+ * sequence number itself.  Reader copies can be torn while a write is in
+ * progress, so readers must only look at their copy after
+ * ivshmem_seqlock_read_retry() says it is good.
+ *
+ * The reader-writer lock is for state too large to copy.  Every attached
+ * peer has a reader count on its own cache line; a reader bumps its own
+ * count and then checks that no writer holds the lock, so readers share no
+ * written line with each other.  A writer takes the writer word and then
+ * waits for every reader count to drain; readers that see the writer back
+ * out and wait, so writers are never starved.
+ */
+
+struct ivshmem_seqlock {
+    uint32_t seq __attribute__((aligned(64)));
+};
+
+static inline void ivshmem_seqlock_init(struct ivshmem_seqlock * sl)
+{
+    __atomic_store_n(&sl->seq, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t ivshmem_seqlock_read_begin(const struct ivshmem_seqlock * sl)
+{
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        ivshmem_relax();
+    return seq;
+}
+
+/* non-zero if what was read since read_begin() must be thrown away */
+static inline int ivshmem_seqlock_read_retry(const struct ivshmem_seqlock * sl,
+                                             uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void ivshmem_seqlock_write_begin(struct ivshmem_seqlock * sl)
+{
+    uint32_t seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+
+    for (;;) {
+        if (!(seq & 1) &&
+            __atomic_compare_exchange_n(&sl->seq, &seq, seq + 1, 1,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        ivshmem_relax();
+        seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+    }
+    /* the odd count must be visible before any of the new data */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void ivshmem_seqlock_write_end(struct ivshmem_seqlock * sl)
+{
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* copy len bytes of a record written under sl; the copy is word-wise */
+void ivshmem_seqlock_read(const struct ivshmem_seqlock * sl, void * dst,
+                          const void * src, size_t len);
+void ivshmem_seqlock_write(struct ivshmem_seqlock * sl, void * dst,
+                           const void * src, size_t len);
+
+#define IVSHMEM_RWLOCK_MAGIC 0x52574c4b  /* "RWLK" */
+#define IVSHMEM_RWLOCK_MAX_PEERS 64
+
+struct ivshmem_rwlock_reader {
+    uint32_t readers __attribute__((aligned(64)));
+    uint32_t owner;
+};
+
+struct ivshmem_rwlock {
+    uint32_t writer __attribute__((aligned(64)));
+    uint32_t magic __attribute__((aligned(64)));
+    struct ivshmem_rwlock_reader reader[IVSHMEM_RWLOCK_MAX_PEERS];
+};
+
+struct ivshmem_rwlock_peer {
+    struct ivshmem_rwlock * l;
+    struct ivshmem_rwlock_reader * me;
+};
+
+void ivshmem_rwlock_init(struct ivshmem_rwlock * l);
+
+/* -1 with EAGAIN before init, ENOSPC when every reader slot is taken */
+int ivshmem_rwlock_attach(struct ivshmem_rwlock_peer * p, void * mem);
+void ivshmem_rwlock_detach(struct ivshmem_rwlock_peer * p);
+
+static inline void ivshmem_rwlock_read_lock(struct ivshmem_rwlock_peer * p)
+{
+    for (;;) {
+        /* our own line; seq_cst orders it against the writer's CAS */
+        __atomic_fetch_add(&p->me->readers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&p->l->writer, __ATOMIC_SEQ_CST))
+            return;
+
+        __atomic_fetch_sub(&p->me->readers, 1, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&p->l->writer, __ATOMIC_RELAXED))
+            ivshmem_relax();
+    }
+}
+
+static inline void ivshmem_rwlock_read_unlock(struct ivshmem_rwlock_peer * p)
+{
+    __atomic_fetch_sub(&p->me->readers, 1, __ATOMIC_RELEASE);
+}
+
+void ivshmem_rwlock_write_lock(struct ivshmem_rwlock_peer * p);
+
+static inline void ivshmem_rwlock_write_unlock(struct ivshmem_rwlock_peer * p)
+{
+    __atomic_store_n(&p->l->writer, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
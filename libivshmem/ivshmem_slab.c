@@ -0,0 +1,265 @@
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_slab.h"
+
+#define HANDLE_MASK 0xffffffffull
+
+static struct ivshmem_slab_magazine * mag(struct ivshmem_slab * heap,
+                                          ivshmem_slab_t h)
+{
+    return ivshmem_slab_ptr(heap, h);
+}
+
+/* Treiber stack of magazines; the tag in the top half defeats ABA */
+static void push(struct ivshmem_slab * heap, uint64_t * top,
+                 struct ivshmem_slab_magazine * m)
+{
+    uint64_t h = ivshmem_slab_handle(heap, m);
+    uint64_t old = __atomic_load_n(top, __ATOMIC_RELAXED), new;
+
+    do {
+        __atomic_store_n(&m->next, (old & HANDLE_MASK) << IVSHMEM_SLAB_MIN_SHIFT,
+                         __ATOMIC_RELAXED);
+        new = ((old >> 32) + 1) << 32 | h >> IVSHMEM_SLAB_MIN_SHIFT;
+    } while (!__atomic_compare_exchange_n(top, &old, new, 1,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static struct ivshmem_slab_magazine * pop(struct ivshmem_slab * heap,
+                                          uint64_t * top)
+{
+    uint64_t old = __atomic_load_n(top, __ATOMIC_ACQUIRE), new;
+    struct ivshmem_slab_magazine * m;
+
+    do {
+        if (!(old & HANDLE_MASK))
+            return NULL;
+        m = mag(heap, (old & HANDLE_MASK) << IVSHMEM_SLAB_MIN_SHIFT);
+        /* m may be popped and reused under us; the tag makes the CAS fail */
+        new = ((old >> 32) + 1) << 32 |
+              __atomic_load_n(&m->next, __ATOMIC_RELAXED) >> IVSHMEM_SLAB_MIN_SHIFT;
+    } while (!__atomic_compare_exchange_n(top, &old, new, 1,
+                                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return m;
+}
+
+/* take the next unused chunk for class c, -1 when the arena is used up */
+static long carve(struct ivshmem_slab_cache * cache, int c)
+{
+
+    struct ivshmem_slab * heap = cache->heap;
+    uint64_t chunk;
+
+    if (__atomic_load_n(&heap->brk, __ATOMIC_RELAXED) >= heap->nchunks)
+        return -1;
+    chunk = __atomic_fetch_add(&heap->brk, 1, __ATOMIC_RELAXED);
+    if (chunk >= heap->nchunks)
+        return -1;
+
+    __atomic_store_n(&heap->chunk_class[chunk], c + 1, __ATOMIC_RELEASE);
+    cache->chunks++;
+
+    return chunk;
+}
+
+static char * chunk_base(struct ivshmem_slab * heap, long chunk)
+{
+    return ivshmem_slab_ptr(heap, heap->arena + chunk * IVSHMEM_SLAB_CHUNK);
+}
+
+static struct ivshmem_slab_magazine * empty_magazine(struct ivshmem_slab_cache * cache)
+{
+
+    struct ivshmem_slab * heap = cache->heap;
+    struct ivshmem_slab_magazine * m;
+    long chunk;
+    int i, n = IVSHMEM_SLAB_CHUNK / sizeof(*m);
+
+    if ((m = pop(heap, &heap->empty)))
+        return m;
+
+    if ((chunk = carve(cache, IVSHMEM_SLAB_MAGAZINES - 1)) < 0)
+        return NULL;
+
+    m = (struct ivshmem_slab_magazine *)chunk_base(heap, chunk);
+    for (i = 1; i < n; i++) {
+        m[i].count = 0;
+        push(heap, &heap->empty, &m[i]);
+    }
+    m->count = 0;
+
+    return m;
+}
+
+/*
+ * A non-empty magazine for class c: from the depot if it has one, else
+ * carved from a fresh chunk, the rest of which goes to the depot.  If the
+ * arena runs out of magazines part way, the rest of the chunk is lost, but
+ * so is every later allocation.
+ */
+static struct ivshmem_slab_magazine * full_magazine(struct ivshmem_slab_cache * cache,
+                                                    int c)
+{
+
+    struct ivshmem_slab * heap = cache->heap;
+    struct ivshmem_slab_magazine * m, * first = NULL;
+    size_t size = (size_t)1 << (c + IVSHMEM_SLAB_MIN_SHIFT);
+    ivshmem_slab_t h, end;
+    long chunk;
+
+    if ((m = pop(heap, &heap->depot[c].full)))
+        return m;
+
+    if ((chunk = carve(cache, c)) < 0)
+        return NULL;
+
+    h = heap->arena + chunk * IVSHMEM_SLAB_CHUNK;
+    end = h + IVSHMEM_SLAB_CHUNK;
+    while (h < end) {
+        if (!(m = empty_magazine(cache)))
+            break;
+        while (h < end && m->count < IVSHMEM_SLAB_ROUNDS) {
+            m->rounds[m->count++] = h;
+            h += size;
+        }
+        if (!first)
+            first = m;
+        else
+            push(heap, &heap->depot[c].full, m);
+    }
+
+    return first;
+}
+
+ivshmem_slab_t ivshmem_slab_alloc_slow(struct ivshmem_slab_cache * cache, int c)
+{
+
+    struct ivshmem_slab_magazine * m, * prev;
+
+    if (c < 0) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    prev = cache->previous[c];
+    if (prev && prev->count) {
+        cache->previous[c] = cache->loaded[c];
+        cache->loaded[c] = m = prev;
+        return m->rounds[--m->count];
+    }
+
+    if (!(m = full_magazine(cache, c))) {
+        errno = ENOMEM;
+        return 0;
+    }
+    cache->depot_gets++;
+
+    if (prev)
+        push(cache->heap, &cache->heap->empty, prev);
+    cache->previous[c] = cache->loaded[c];
+    cache->loaded[c] = m;
+
+    return m->rounds[--m->count];
+}
+
+void ivshmem_slab_free_slow(struct ivshmem_slab_cache * cache,
+                            ivshmem_slab_t h, int c)
+{
+
+    struct ivshmem_slab_magazine * m, * prev;
+
+    prev = cache->previous[c];
+    if (prev && prev->count < IVSHMEM_SLAB_ROUNDS) {
+        cache->previous[c] = cache->loaded[c];
+        cache->loaded[c] = m = prev;
+        m->rounds[m->count++] = h;
+        return;
+    }
+
+    /* nowhere to put h if the arena cannot even give us a magazine */
+    if (!(m = empty_magazine(cache)))
+        return;
+
+    if (prev) {
+        push(cache->heap, &cache->heap->depot[c].full, prev);
+        cache->depot_puts++;
+    }
+    cache->previous[c] = cache->loaded[c];
+    cache->loaded[c] = m;
+    m->rounds[m->count++] = h;
+}
+
+struct ivshmem_slab * ivshmem_slab_init(void * mem, size_t bytes)
+{
+
+    struct ivshmem_slab * heap = mem;
+    size_t hdr = offsetof(struct ivshmem_slab, chunk_class);
+    uint64_t nchunks, arena;
+
+    if (bytes <= hdr)
+        return NULL;
+    nchunks = (bytes - hdr) / (IVSHMEM_SLAB_CHUNK + 1);
+    /* depot stacks hold handle >> 6 in 32 bits */
+    if (nchunks > (HANDLE_MASK << IVSHMEM_SLAB_MIN_SHIFT) / IVSHMEM_SLAB_CHUNK - 1)
+        nchunks = (HANDLE_MASK << IVSHMEM_SLAB_MIN_SHIFT) / IVSHMEM_SLAB_CHUNK - 1;
+    for (;; nchunks--) {
+        if (nchunks == 0)
+            return NULL;
+        arena = (hdr + nchunks + 4095) & ~4095ull;
+        if (arena + nchunks * IVSHMEM_SLAB_CHUNK <= bytes)
+            break;
+    }
+
+    __atomic_store_n(&heap->magic, 0, __ATOMIC_RELAXED);
+    heap->nchunks = nchunks;
+    heap->arena = arena;
+    heap->brk = 0;
+    heap->empty = 0;
+    memset(heap->depot, 0, sizeof(heap->depot));
+    memset(heap->chunk_class, 0, nchunks);
+
+    __atomic_store_n(&heap->magic, IVSHMEM_SLAB_MAGIC, __ATOMIC_RELEASE);
+
+    return heap;
+}
+
+int ivshmem_slab_attach(struct ivshmem_slab_cache * cache, void * mem)
+{
+
+    struct ivshmem_slab * heap = mem;
+
+    if (__atomic_load_n(&heap->magic, __ATOMIC_ACQUIRE) != IVSHMEM_SLAB_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->heap = heap;
+
+    return 0;
+}
+
+static void put_back(struct ivshmem_slab_cache * cache, int c,
+                     struct ivshmem_slab_magazine * m)
+{
+    struct ivshmem_slab * heap = cache->heap;
+
+    if (!m)
+        return;
+    if (m->count)
+        push(heap, &heap->depot[c].full, m);
+    else
+        push(heap, &heap->empty, m);
+}
+
+void ivshmem_slab_detach(struct ivshmem_slab_cache * cache)
+{
+    int c;
+
+    for (c = 0; c < IVSHMEM_SLAB_NCLASSES; c++) {
+        put_back(cache, c, cache->loaded[c]);
+        put_back(cache, c, cache->previous[c]);
+        cache->loaded[c] = cache->previous[c] = NULL;
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef IVSHMEM_SLAB_HDR
+#define IVSHMEM_SLAB_HDR
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Slab allocator over a piece of the shared region.  Every VM maps the
+ * region at a different address, so objects are named by handles: byte
+ * offsets from the start of the heap, with 0 meaning none.  Convert with
+ * ivshmem_slab_ptr() and ivshmem_slab_handle() in each VM.
+ *
+ * The arena is cut into fixed-size chunks, each given to one size class
+ * (64 bytes to 64K, powers of two) when it is first needed.  Free objects
+ * travel in magazines, small arrays of handles (Bonwick's magazine layer):
+ * each attached peer keeps a loaded and a previous magazine per class and
+ * allocates and frees against them without touching any shared line.
+ * Only when both are empty (full) does it trade a magazine with the global
+ * depot, a lock-free stack of full magazines per class plus one of empty
+ * magazines, and only when the depot has nothing does it carve a new chunk
+ * by bumping the arena pointer.
+ *
+ * Memory goes back to the class it was carved for and never back to the
+ * arena.  Objects freed by another peer than the one that allocated them
+ * are fine; they simply come back through that peer's magazines.
+ */
+
+#define IVSHMEM_SLAB_MAGIC 0x534c4142   /* "SLAB" */
+#define IVSHMEM_SLAB_MIN_SHIFT 6
+#define IVSHMEM_SLAB_NCLASSES 11        /* 64 .. 64K */
+#define IVSHMEM_SLAB_MAX_SIZE (1u << (IVSHMEM_SLAB_MIN_SHIFT + \
+                                      IVSHMEM_SLAB_NCLASSES - 1))
+#define IVSHMEM_SLAB_CHUNK (256 * 1024)
+#define IVSHMEM_SLAB_ROUNDS 30          /* a magazine is 256 bytes */
+#define IVSHMEM_SLAB_MAGAZINES 0xff     /* chunk_class of magazine chunks */
+
+typedef uint64_t ivshmem_slab_t;
+
+struct ivshmem_slab_magazine {
+    ivshmem_slab_t next;        /* depot link */
+    uint32_t count;
+    uint32_t pad;
+    ivshmem_slab_t rounds[IVSHMEM_SLAB_ROUNDS];
+};
+
+/* depot stacks: tag << 32 | handle >> 6, so ABA is caught by the tag */
+struct ivshmem_slab_depot {
+    uint64_t full __attribute__((aligned(64)));
+};
+
+struct ivshmem_slab {
+    uint32_t magic;
+    uint32_t nchunks;
+    uint64_t arena;             /* handle of chunk 0 */
+
+    uint64_t brk __attribute__((aligned(64)));  /* chunks handed out */
+    uint64_t empty __attribute__((aligned(64)));
+    struct ivshmem_slab_depot depot[IVSHMEM_SLAB_NCLASSES];
+
+    /* class + 1 of every carved chunk, 0 while unused */
+    uint8_t chunk_class[] __attribute__((aligned(64)));
+};
+
+/* one per attached peer (or thread); lives in private memory */
+struct ivshmem_slab_cache {
+    struct ivshmem_slab * heap;
+    struct ivshmem_slab_magazine * loaded[IVSHMEM_SLAB_NCLASSES];
+    struct ivshmem_slab_magazine * previous[IVSHMEM_SLAB_NCLASSES];
+
+    unsigned long depot_gets;
+    unsigned long depot_puts;
+    unsigned long chunks;
+};
+
+struct ivshmem_slab * ivshmem_slab_init(void * mem, size_t bytes);
+
+/* -1 with EAGAIN before init */
+int ivshmem_slab_attach(struct ivshmem_slab_cache * cache, void * mem);
+
+/* hands the cached magazines back to the depot */
+void ivshmem_slab_detach(struct ivshmem_slab_cache * cache);
+
+static inline void * ivshmem_slab_ptr(const struct ivshmem_slab * heap,
+                                      ivshmem_slab_t h)
+{
+    return h ? (char *)heap + h : NULL;
+}
+
+static inline ivshmem_slab_t ivshmem_slab_handle(const struct ivshmem_slab * heap,
+                                                 const void * p)
+{
+    return p ? (const char *)p - (const char *)heap : 0;
+}
+
+static inline int ivshmem_slab_class(size_t size)
+{
+    int c;
+
+    if (size <= (1u << IVSHMEM_SLAB_MIN_SHIFT))
+        return 0;
+    c = 64 - __builtin_clzll(size - 1) - IVSHMEM_SLAB_MIN_SHIFT;
+    return c < IVSHMEM_SLAB_NCLASSES ? c : -1;
+}
+
+static inline size_t ivshmem_slab_size(const struct ivshmem_slab * heap,
+                                       ivshmem_slab_t h)
+{
+    uint8_t c = heap->chunk_class[(h - heap->arena) / IVSHMEM_SLAB_CHUNK];
+
+    return (size_t)1 << (c - 1 + IVSHMEM_SLAB_MIN_SHIFT);
+}
+
+ivshmem_slab_t ivshmem_slab_alloc_slow(struct ivshmem_slab_cache * cache,
+                                       int c);
+void ivshmem_slab_free_slow(struct ivshmem_slab_cache * cache,
+                            ivshmem_slab_t h, int c);
+
+/* 0 with ENOMEM when the arena is used up, EINVAL above the largest class */
+static inline ivshmem_slab_t ivshmem_slab_alloc(struct ivshmem_slab_cache * cache,
+                                                size_t size)
+{
+    int c = ivshmem_slab_class(size);
+    struct ivshmem_slab_magazine * m;
+
+    if (c >= 0 && (m = cache->loaded[c]) && m->count)
+        return m->rounds[--m->count];
+    return ivshmem_slab_alloc_slow(cache, c);
+}
+
+static inline void ivshmem_slab_free(struct ivshmem_slab_cache * cache,
+                                     ivshmem_slab_t h)
+{
+    struct ivshmem_slab * heap = cache->heap;
+    int c;
+    struct ivshmem_slab_magazine * m;
+
+    if (!h)
+        return;
+    c = heap->chunk_class[(h - heap->arena) / IVSHMEM_SLAB_CHUNK] - 1;
+    if ((m = cache->loaded[c]) && m->count < IVSHMEM_SLAB_ROUNDS)
+        m->rounds[m->count++] = h;
+    else
+        ivshmem_slab_free_slow(cache, h, c);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,186 @@
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "ivshmem_spsc.h"
+
+static uint32_t slot_bytes(uint32_t slot_size)
+{
+    uint32_t bytes = slot_size + sizeof(struct ivshmem_spsc_slot);
+
+    /* whole cache lines, so neighbouring slots never share one */
+    return (bytes + IVSHMEM_CACHELINE - 1) & ~(IVSHMEM_CACHELINE - 1);
+}
+
+size_t ivshmem_spsc_bytes(uint32_t nslots, uint32_t slot_size)
+{
+    return offsetof(struct ivshmem_spsc, slots) +
+                (size_t)nslots * slot_bytes(slot_size);
+}
+
+struct ivshmem_spsc * ivshmem_spsc_init(void * mem, size_t bytes,
+                                        uint32_t slot_size)
+{
+
+    struct ivshmem_spsc * ring = mem;
+    uint32_t nslots = 2;
+
+    if (ivshmem_spsc_bytes(nslots, slot_size) > bytes)
+        return NULL;
+    while (nslots < (1u << 31) &&
+           ivshmem_spsc_bytes(nslots * 2, slot_size) <= bytes)
+        nslots *= 2;
+
+    __atomic_store_n(&ring->magic, 0, __ATOMIC_RELAXED);
+    ring->head = ring->tail = 0;
+    ring->space_event = ring->data_event = 0;
+    ring->nslots = nslots;
+    ring->slot_size = slot_bytes(slot_size);
+
+    /* the other side may attach as soon as it sees magic */
+    __atomic_store_n(&ring->magic, IVSHMEM_SPSC_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+int ivshmem_spsc_attach(struct ivshmem_spsc_end * end, void * mem, int role,
+                        struct ivshmem_dev * dev, int peer, int peer_vector,
+                        int vector)
+{
+
+    struct ivshmem_spsc * ring = mem;
+    uint32_t head, tail;
+
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != IVSHMEM_SPSC_MAGIC) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memset(end, 0, sizeof(*end));
+    end->ring = ring;
+    end->dev = dev;
+    end->peer = peer;
+    end->peer_vector = peer_vector;
+    end->vector = vector;
+    end->mask = ring->nslots - 1;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (role == IVSHMEM_SPSC_PRODUCER) {
+        end->local = end->published = head;
+        end->cached = tail;
+    } else {
+        end->local = end->published = tail;
+        end->cached = head;
+    }
+
+    return 0;
+}
+
+int ivshmem_spsc_arm_data(struct ivshmem_spsc_end * end)
+{
+    uint32_t len;
+
+    /* slots we have consumed may be what the producer waits for */
+    ivshmem_spsc_release(end);
+
+    /* ask for a doorbell on the next publish, then look again in case it
+     * happened before the producer could see the request */
+    __atomic_store_n(&end->ring->data_event, end->local, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return ivshmem_spsc_peek(end, &len) != NULL;
+}
+
+int ivshmem_spsc_arm_space(struct ivshmem_spsc_end * end)
+{
+    /* the consumer cannot free what it has not been shown */
+    ivshmem_spsc_flush(end);
+
+    __atomic_store_n(&end->ring->space_event, end->cached, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return ivshmem_spsc_reserve(end) != NULL;
+}
+
+int ivshmem_spsc_wait_data(struct ivshmem_spsc_end * end)
+{
+
+    uint32_t len;
+    int i;
+
+    for (;;) {
+        for (i = 0; i <= end->spin; i++) {
+            if (ivshmem_spsc_peek(end, &len))
+                return 0;
+        }
+
+        if (ivshmem_spsc_arm_data(end))
+            return 0;
+
+        if (ivshmem_wait(end->dev, end->vector) < 0)
+            return -1;
+    }
+}
+
+int ivshmem_spsc_wait_space(struct ivshmem_spsc_end * end)
+{
+    int i;
+
+    for (;;) {
+        for (i = 0; i <= end->spin; i++) {
+            if (ivshmem_spsc_reserve(end))
+                return 0;
+        }
+
+        if (ivshmem_spsc_arm_space(end))
+            return 0;
+
+        if (ivshmem_wait(end->dev, end->vector) < 0)
+            return -1;
+    }
+}
+
+int ivshmem_spsc_send(struct ivshmem_spsc_end * end, const void * buf,
+                      uint32_t len)
+{
+
+    void * slot;
+
+    if (len > ivshmem_spsc_capacity(end->ring)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    while ((slot = ivshmem_spsc_reserve(end)) == NULL) {
+        if (ivshmem_spsc_wait_space(end) < 0)
+            return -1;
+    }
+
+    memcpy(slot, buf, len);
+    ivshmem_spsc_commit(end, len);
+    ivshmem_spsc_flush(end);
+
+    return len;
+}
+
+int ivshmem_spsc_recv(struct ivshmem_spsc_end * end, void * buf,
+                      uint32_t len)
+{
+
+    void * slot;
+    uint32_t n;
+
+    while ((slot = ivshmem_spsc_peek(end, &n)) == NULL) {
+        if (ivshmem_spsc_wait_data(end) < 0)
+            return -1;
+    }
+
+    if (n > len)
+        n = len;
+    memcpy(buf, slot, n);
+    ivshmem_spsc_consume(end);
+    ivshmem_spsc_release(end);
+
+    return n;
+}
@@ -0,0 +1,232 @@
+#ifndef IVSHMEM_SPSC_HDR
+#define IVSHMEM_SPSC_HDR
+#include <stdint.h>
+#include "ivshmem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Single-producer/single-consumer ring laid out in the shared region.
+ *
+ * head is only written by the producer and tail only by the consumer, each
+ * on its own cache line, so the two sides never write the same line.  Both
+ * are free-running 32-bit counters; slot i is i & (nslots - 1).
+ *
+ * Notifications are suppressed the way virtio's event index does it: before
+ * sleeping, the consumer stores the tail it is waiting behind in
+ * data_event, and the producer rings only when publishing moves head past
+ * that point.  So while the consumer keeps up, or already has a doorbell on
+ * its way, publishing costs no doorbell at all.  space_event does the same
+ * for a producer waiting on a full ring.
+ *
+ * Nothing in the ring is a pointer, so every peer can map the region at a
+ * different address.
+ */
+
+#define IVSHMEM_CACHELINE 64
+#define IVSHMEM_SPSC_MAGIC 0x53505343   /* "SPSC" */
+
+struct ivshmem_spsc_slot {
+    uint32_t len;
+    uint32_t pad;
+    uint8_t data[];
+};
+
+struct ivshmem_spsc {
+    /* written by the producer */
+    uint32_t head __attribute__((aligned(IVSHMEM_CACHELINE)));
+    uint32_t space_event;
+
+    /* written by the consumer */
+    uint32_t tail __attribute__((aligned(IVSHMEM_CACHELINE)));
+    uint32_t data_event;
+
+    /* set by ivshmem_spsc_init(), read-only afterwards */
+    uint32_t magic __attribute__((aligned(IVSHMEM_CACHELINE)));
+    uint32_t nslots;
+    uint32_t slot_size;
+
+    uint8_t slots[] __attribute__((aligned(IVSHMEM_CACHELINE)));
+};
+
+/* one side of a ring, private to the process using it */
+struct ivshmem_spsc_end {
+    struct ivshmem_spsc * ring;
+    struct ivshmem_dev * dev;
+    int peer;           /* the other side ... */
+    int peer_vector;    /* ... and the vector it sleeps on */
+    int vector;         /* the vector we sleep on */
+    int spin;           /* polls before arming the event and sleeping */
+
+    uint32_t local;     /* producer: next head, consumer: next tail */
+    uint32_t published; /* what the other side has been shown of local */
+    uint32_t cached;    /* last index read from the other side's line */
+    uint32_t mask;
+
+    unsigned long doorbells;    /* doorbells this end has rung */
+};
+
+/*
+ * Lay a ring out over bytes of mem, with slots that hold slot_size bytes
+ * of payload each.  Returns the ring, or NULL if not even two slots fit.
+ * Only one side calls this; the other attaches once magic is set.
+ */
+struct ivshmem_spsc * ivshmem_spsc_init(void * mem, size_t bytes,
+                                        uint32_t slot_size);
+size_t ivshmem_spsc_bytes(uint32_t nslots, uint32_t slot_size);
+
+enum ivshmem_spsc_role { IVSHMEM_SPSC_PRODUCER, IVSHMEM_SPSC_CONSUMER };
+
+/*
+ * Fill in end for one side of ring.  peer/peer_vector is where our
+ * notifications go, vector is where the other side's arrive.  Returns -1
+ * with errno EAGAIN while the ring is not initialised yet.
+ */
+int ivshmem_spsc_attach(struct ivshmem_spsc_end * end, void * ring, int role,
+                        struct ivshmem_dev * dev, int peer, int peer_vector,
+                        int vector);
+
+static inline struct ivshmem_spsc_slot *
+ivshmem_spsc_slot(struct ivshmem_spsc * ring, uint32_t idx, uint32_t mask)
+{
+    return (struct ivshmem_spsc_slot *)
+        (ring->slots + (size_t)(idx & mask) * ring->slot_size);
+}
+
+static inline uint32_t ivshmem_spsc_capacity(const struct ivshmem_spsc * ring)
+{
+    return ring->slot_size - sizeof(struct ivshmem_spsc_slot);
+}
+
+/* virtio's vring_need_event(): did old -> new_idx step over event? */
+static inline int ivshmem_spsc_need_event(uint32_t event, uint32_t new_idx,
+                                          uint32_t old)
+{
+    return (uint32_t)(new_idx - event - 1) < (uint32_t)(new_idx - old);
+}
+
+/*
+ * Producer: ivshmem_spsc_reserve() returns the next free slot's payload
+ * area (NULL when full) for the caller to fill in place, commit() hands it
+ * over privately, and flush() publishes everything committed so far,
+ * ringing the consumer only if it asked to be woken.
+ */
+static inline void * ivshmem_spsc_reserve(struct ivshmem_spsc_end * end)
+{
+    struct ivshmem_spsc * ring = end->ring;
+
+    if (end->local - end->cached == ring->nslots) {
+        end->cached = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (end->local - end->cached == ring->nslots)
+            return NULL;
+    }
+
+    return ivshmem_spsc_slot(ring, end->local, end->mask)->data;
+}
+
+static inline void ivshmem_spsc_commit(struct ivshmem_spsc_end * end,
+                                       uint32_t len)
+{
+    ivshmem_spsc_slot(end->ring, end->local, end->mask)->len = len;
+    end->local++;
+}
+
+static inline void ivshmem_spsc_flush(struct ivshmem_spsc_end * end)
+{
+    struct ivshmem_spsc * ring = end->ring;
+    uint32_t old = end->published;
+
+    if (old == end->local)
+        return;
+
+    __atomic_store_n(&ring->head, end->local, __ATOMIC_RELEASE);
+    end->published = end->local;
+
+    /* order the head store before the event load, pairs with the
+     * consumer's fence between storing data_event and rereading head */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ivshmem_spsc_need_event(__atomic_load_n(&ring->data_event,
+                                        __ATOMIC_RELAXED), end->local, old)) {
+        ivshmem_doorbell(end->dev, end->peer, end->peer_vector);
+        end->doorbells++;
+    }
+}
+
+/*
+ * Consumer: ivshmem_spsc_peek() returns the oldest filled slot's payload
+ * (NULL when empty) to be read in place, consume() steps past it, and
+ * release() gives the consumed slots back, ringing a producer that is
+ * waiting for space.
+ */
+static inline void * ivshmem_spsc_peek(struct ivshmem_spsc_end * end,
+                                       uint32_t * len)
+{
+    struct ivshmem_spsc_slot * slot;
+
+    if (end->local == end->cached) {
+        end->cached = __atomic_load_n(&end->ring->head, __ATOMIC_ACQUIRE);
+        if (end->local == end->cached)
+            return NULL;
+    }
+
+    slot = ivshmem_spsc_slot(end->ring, end->local, end->mask);
+    *len = slot->len;
+    return slot->data;
+}
+
+static inline void ivshmem_spsc_consume(struct ivshmem_spsc_end * end)
+{
+    end->local++;
+}
+
+static inline void ivshmem_spsc_release(struct ivshmem_spsc_end * end)
+{
+    struct ivshmem_spsc * ring = end->ring;
+    uint32_t old = end->published;
+
+    if (old == end->local)
+        return;
+
+    __atomic_store_n(&ring->tail, end->local, __ATOMIC_RELEASE);
+    end->published = end->local;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ivshmem_spsc_need_event(__atomic_load_n(&ring->space_event,
+                                        __ATOMIC_RELAXED), end->local, old)) {
+        ivshmem_doorbell(end->dev, end->peer, end->peer_vector);
+        end->doorbells++;
+    }
+}
+
+/*
+ * Block until there is something to peek at (consumer) or a slot to
+ * reserve (producer).  Both poll end->spin times first.  Return 0, or -1 if
+ * the wait on the device failed.  Only one ring end may sleep on a given
+ * vector, or they steal each other's wakeups.
+ */
+int ivshmem_spsc_wait_data(struct ivshmem_spsc_end * end);
+int ivshmem_spsc_wait_space(struct ivshmem_spsc_end * end);
+
+/*
+ * The first half of the waits above, for a thread that serves several
+ * rings from one vector: ask for a doorbell on the next publish (release)
+ * and return non-zero if there is already something to peek at (a slot to
+ * reserve), in which case the caller must not sleep.  Arm every ring, then
+ * make one ivshmem_wait() on the shared vector.
+ */
+int ivshmem_spsc_arm_data(struct ivshmem_spsc_end * end);
+int ivshmem_spsc_arm_space(struct ivshmem_spsc_end * end);
+
+/* copying convenience wrappers around the calls above; both block */
+int ivshmem_spsc_send(struct ivshmem_spsc_end * end, const void * buf,
+                      uint32_t len);
+int ivshmem_spsc_recv(struct ivshmem_spsc_end * end, void * buf,
+                      uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
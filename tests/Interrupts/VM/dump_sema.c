@@ -20,11 +20,11 @@ int main(int argc, char ** argv){
     void * memptr;
     long * long_array;
     long num_chunks;
-    int other;
+    int other, channel;
     int i, j, k;
 
-    if (argc != 4){
-        printf("USAGE: dump_sema <filename> <num chunks> <other vm>\n");
+    if (argc != 4 && argc != 5){
+        printf("USAGE: dump_sema <filename> <num chunks> <other vm> [channel]\n");
         exit(-1);
     }
 
@@ -33,6 +33,7 @@ int main(int argc, char ** argv){
 
     num_chunks=atol(argv[2]);
     other = atoi(argv[3]);
+    channel = (argc == 5) ? atoi(argv[4]) : 0;
 
     length=num_chunks*CHUNK_SZ;
     printf("[DUMP] size is %d\n", length);
@@ -45,7 +46,7 @@ int main(int argc, char ** argv){
         exit (-1);
     }
 
-    ivshmem_send(fd, SET_SEMA, 8);
+    ivshmem_send(fd, SET_SEMA, IVSHMEM_ARG(channel, 8));
 
     srand(time(NULL));
     long_array=(long *)memptr;
@@ -61,12 +62,12 @@ int main(int argc, char ** argv){
 
             SHA1_Init(&context);
 
-            ivshmem_send(fd, DOWN_SEMA, 0);
+            ivshmem_send(fd, DOWN_SEMA, IVSHMEM_ARG(channel, 0));
             for (i = 0; i < CHUNK_SZ/sizeof(long); i++){
 	            long_array[offset + i]=rand();
             }
             SHA1_Update(&context,memptr + CHUNK_SZ*j, CHUNK_SZ);
-            ivshmem_send(fd, SEMA_IRQ, other); // we are interacting with VM 2
+            ivshmem_send(fd, SEMA_IRQ, IVSHMEM_ARG(channel, other)); // we are interacting with VM 2
 
             SHA1_Final(md,&context);
 
@@ -0,0 +1,89 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "ivshmem.h"
+
+/*
+ * Measures the cost of notifying K peers with K wait_event_irq ioctls
+ * against a single multi_irq ioctl, for K = 1 .. number of peers given.
+ */
+
+#define MAX_PEERS 256
+
+static double elapsed_ns(struct timespec * start, struct timespec * end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_doorbell db[MAX_PEERS];
+    struct timespec start, end;
+    int peers[MAX_PEERS];
+    int fd, npeers, rounds;
+    int i, k, r;
+
+    if (argc < 4){
+        printf("USAGE: fanout <filename> <rounds> <peer> [<peer> ...]\n");
+        exit(-1);
+    }
+
+    if ((fd = open(argv[1], O_RDWR)) < 0) {
+        fprintf(stderr, "ERROR: cannot open file\n");
+        exit(-1);
+    }
+
+    rounds = atoi(argv[2]);
+    npeers = argc - 3;
+    if (npeers > MAX_PEERS)
+        npeers = MAX_PEERS;
+
+    for (i = 0; i < npeers; i++)
+        peers[i] = atoi(argv[i + 3]);
+
+    printf("%4s %14s %14s %14s %14s\n", "K", "single ns/rnd", "batch ns/rnd",
+            "single ns/db", "batch ns/db");
+
+    for (k = 1; k <= npeers; k++) {
+        double single, batch;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < k; i++) {
+                ioctl(fd, WAIT_EVENT_IRQ, peers[i]);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        single = elapsed_ns(&start, &end) / rounds;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < k; i++) {
+                db[i].peer = peers[i];
+                db[i].vector = WAIT_EVENT_IRQ;
+            }
+            if (ivshmem_send_batch(fd, db, k) < 0) {
+                fprintf(stderr, "ERROR: multi_irq failed\n");
+                exit(-1);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        batch = elapsed_ns(&start, &end) / rounds;
+
+        for (i = 0; i < k; i++) {
+            if (db[i].error)
+                printf("[FANOUT] peer %d: error %d\n", db[i].peer, db[i].error);
+        }
+
+        printf("%4d %14.0f %14.0f %14.0f %14.0f\n", k, single, batch,
+                single / k, batch / k);
+    }
+
+    close(fd);
+}
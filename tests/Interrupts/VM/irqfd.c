@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "ivshmem.h"
+
+/*
+ * Binds an eventfd to each vector given on the command line and waits for
+ * them with a single epoll set, reporting which vector fired.
+ */
+
+#define MAX_VECTORS 32
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_irqfd irqfd;
+    struct epoll_event ev;
+    int efd[MAX_VECTORS];
+    unsigned int vector[MAX_VECTORS];
+    int fd, epfd, nvectors, count;
+    int i;
+
+    if (argc < 4){
+        printf("USAGE: irqfd <filename> <count> <vector> [<vector> ...]\n");
+        exit(-1);
+    }
+
+    if ((fd = open(argv[1], O_RDWR)) < 0) {
+        fprintf(stderr, "ERROR: cannot open file\n");
+        exit(-1);
+    }
+
+    count = atoi(argv[2]);
+    nvectors = argc - 3;
+    if (nvectors > MAX_VECTORS)
+        nvectors = MAX_VECTORS;
+
+    epfd = epoll_create(nvectors);
+
+    for (i = 0; i < nvectors; i++) {
+        efd[i] = eventfd(0, 0);
+
+        vector[i] = atoi(argv[i + 3]);
+        irqfd.fd = efd[i];
+        irqfd.vector = vector[i];
+        if (ioctl(fd, BIND_EVENTFD, &irqfd) < 0) {
+            fprintf(stderr, "ERROR: cannot bind vector %u\n", irqfd.vector);
+            exit(-1);
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, efd[i], &ev);
+    }
+
+    while (count > 0) {
+        struct epoll_event events[MAX_VECTORS];
+        int n;
+
+        n = epoll_wait(epfd, events, MAX_VECTORS, -1);
+
+        for (i = 0; i < n; i++) {
+            int v = events[i].data.u32;
+            uint64_t hits;
+
+            read(efd[v], &hits, sizeof(hits));
+            printf("[IRQFD] vector %u fired %llu time(s)\n",
+                    vector[v], (unsigned long long)hits);
+            count--;
+        }
+    }
+
+    /* closing the device drops the bindings */
+    close(fd);
+    for (i = 0; i < nvectors; i++)
+        close(efd[i]);
+    close(epfd);
+}
@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "ivshmem.h"
+
+/*
+ * Event ping-pong between two guests.  The "ping" side rings the other guest
+ * and waits for the reply, the "pong" side echoes.  Both sides select the
+ * driver's busy-poll mode for the channel, so running the pair once per mode
+ * compares the round-trip latency and the CPU spent waiting.
+ *
+ *   pingpong <file> ping|pong <other vm> <rounds> off|fixed:<ns>|adaptive
+ */
+
+#define CHANNEL 1
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static long long cpu_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ll +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ll;
+}
+
+static int cmp_ll(const void * a, const void * b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_poll poll;
+    long long * rtt;
+    long long start, wall, cpu;
+    int fd, other, rounds, ping;
+    int i;
+
+    if (argc != 6){
+        printf("USAGE: pingpong <filename> ping|pong <other vm> <rounds> "
+                "off|fixed:<ns>|adaptive\n");
+        exit(-1);
+    }
+
+    if ((fd = open(argv[1], O_RDWR)) < 0) {
+        fprintf(stderr, "ERROR: cannot open file\n");
+        exit(-1);
+    }
+
+    ping = (strcmp(argv[2], "ping") == 0);
+    other = atoi(argv[3]);
+    rounds = atoi(argv[4]);
+
+    memset(&poll, 0, sizeof(poll));
+    poll.channel = CHANNEL;
+    if (strncmp(argv[5], "fixed:", 6) == 0) {
+        poll.mode = POLL_FIXED;
+        poll.budget_ns = atoi(argv[5] + 6);
+    } else if (strcmp(argv[5], "adaptive") == 0) {
+        poll.mode = POLL_ADAPTIVE;
+    } else {
+        poll.mode = POLL_OFF;
+    }
+
+    if (ioctl(fd, SET_POLL, &poll) < 0) {
+        fprintf(stderr, "ERROR: cannot set poll mode\n");
+        exit(-1);
+    }
+
+    rtt = malloc(rounds * sizeof(long long));
+
+    start = now_ns();
+    cpu = cpu_ns();
+
+    for (i = 0; i < rounds; i++) {
+        long long t0 = now_ns();
+
+        if (ping) {
+            ioctl(fd, WAIT_EVENT_IRQ, IVSHMEM_ARG(CHANNEL, other));
+            ioctl(fd, WAIT_EVENT, IVSHMEM_ARG(CHANNEL, 0));
+        } else {
+            ioctl(fd, WAIT_EVENT, IVSHMEM_ARG(CHANNEL, 0));
+            ioctl(fd, WAIT_EVENT_IRQ, IVSHMEM_ARG(CHANNEL, other));
+        }
+
+        rtt[i] = now_ns() - t0;
+    }
+
+    wall = now_ns() - start;
+    cpu = cpu_ns() - cpu;
+
+    if (ping) {
+        qsort(rtt, rounds, sizeof(long long), cmp_ll);
+        printf("[PINGPONG] mode %s rounds %d\n", argv[5], rounds);
+        printf("[PINGPONG] rtt ns: min %lld p50 %lld p99 %lld max %lld avg %lld\n",
+                rtt[0], rtt[rounds / 2], rtt[(rounds * 99) / 100],
+                rtt[rounds - 1], wall / rounds);
+    }
+    printf("[PINGPONG] cpu %.1f%% of one vCPU\n", 100.0 * cpu / wall);
+
+    free(rtt);
+    close(fd);
+}
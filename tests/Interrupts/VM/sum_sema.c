@@ -19,10 +19,10 @@ int main(int argc, char ** argv){
     long * long_array;
     int i,fd,j, k;
     struct test * myptr;
-    int other;
+    int other, channel;
 
-    if (argc != 4){
-        printf("USAGE: sum <filename> <num chunks> <other vm>\n");
+    if (argc != 4 && argc != 5){
+        printf("USAGE: sum <filename> <num chunks> <other vm> [channel]\n");
         exit(-1);
     }
 
@@ -30,6 +30,7 @@ int main(int argc, char ** argv){
     printf("[SUM] opening file %s\n", argv[1]);
     num_chunks=atol(argv[2]);
     other = atoi(argv[3]);
+    channel = (argc == 5) ? atoi(argv[4]) : 0;
 
     length=num_chunks*CHUNK_SZ;
     printf("[SUM] length is %d\n", length);
@@ -41,7 +42,7 @@ int main(int argc, char ** argv){
         exit (-1);
     }
 
-    ioctl(fd, SET_SEMA, (void*)0);
+    ioctl(fd, SET_SEMA, (void *)(long)IVSHMEM_ARG(channel, 0));
 
     printf("[SUM] reading %d chunks\n", num_chunks);
 
@@ -56,9 +57,9 @@ int main(int argc, char ** argv){
 
             SHA1_Init(&context);
 
-            ioctl(fd, DOWN_SEMA, NULL);
+            ioctl(fd, DOWN_SEMA, (void *)(long)IVSHMEM_ARG(channel, 0));
             SHA1_Update(&context,memptr + CHUNK_SZ*j, CHUNK_SZ);
-            ioctl(fd, SEMA_IRQ, (void *)other);
+            ioctl(fd, SEMA_IRQ, (void *)(long)IVSHMEM_ARG(channel, other));
 
             SHA1_Final(md,&context);
 
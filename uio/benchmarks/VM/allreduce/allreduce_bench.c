@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ivshmem.h"
+#include "ivshmem_coll.h"
+
+/*
+ * Allreduce bandwidth against the number of participating VMs, using the
+ * collectives in libivshmem/ivshmem_coll.h.  "init" lays out the staging
+ * slots for <parties> with <chunk KB> halves.  Each party then runs
+ * allreduce over every size in the list, checks the result and, at rank 0,
+ * prints the time per allreduce with two bandwidths:
+ *
+ *   algbw   bytes / time, what the application sees
+ *   busbw   algbw * 2(n-1)/n, the data each party moves in a ring
+ *           allreduce, comparable across party counts
+ *
+ * "check" runs every collective, from every root, over sizes on both sides
+ * of the chunk and across many chunks, and verifies each result.
+ * "kernels" needs no device and times each reduction kernel the CPU has.
+ *
+ *   allreduce_bench <dev> init <parties> [chunk KB]
+ *   allreduce_bench <dev> run <sizes> [int|float|double] [sum|min|max]
+ *                                     [generic|avx2|avx512] [spin]
+ *   allreduce_bench <dev> check [rounds] [spin]
+ *   allreduce_bench - kernels [MB]
+ */
+
+#define BENCH_MAGIC 0x414c5242
+#define COLL_OFFSET 4096
+#define MAX_SIZES 32
+#define BYTES_PER_SIZE (64ull << 20)    /* moved per size, sets iterations */
+#define WARMUP 3
+#define NCHECKS 5              /* check sizes, the largest last */
+#define VECTOR 0
+
+static const char * type_names[] = { "int", "float", "double" };
+static const char * op_names[] = { "sum", "min", "max" };
+
+struct bench_ctl {
+    uint32_t magic;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t parse_size(const char * s)
+{
+    char * end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if (*end == 'K' || *end == 'k')
+        v <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        v <<= 20;
+    return v;
+}
+
+static int lookup(const char * s, const char ** names, int n)
+{
+    int i;
+
+    for (i = 0; i < n && strcmp(s, names[i]); i++)
+        ;
+    if (i == n) {
+        printf("unknown %s\n", s);
+        exit(-1);
+    }
+    return i;
+}
+
+/* small integers, exact in every type and under any summation order */
+static int value(int rank, size_t i)
+{
+    return (int)((i * 7 + rank * 3) % 29) - 14;
+}
+
+static void fill(void * buf, size_t count, int type, int rank)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (type == IVSHMEM_INT32)
+            ((int32_t *)buf)[i] = value(rank, i);
+        else if (type == IVSHMEM_FLOAT)
+            ((float *)buf)[i] = value(rank, i);
+        else
+            ((double *)buf)[i] = value(rank, i);
+    }
+}
+
+static size_t check(const void * buf, size_t count, int type, int op,
+                    int nparties)
+{
+
+    size_t i, bad = 0;
+    double want, got;
+    int r, v;
+
+    for (i = 0; i < count; i++) {
+        want = value(0, i);
+        for (r = 1; r < nparties; r++) {
+            v = value(r, i);
+            if (op == IVSHMEM_SUM)
+                want += v;
+            else if (op == IVSHMEM_MIN ? v < want : v > want)
+                want = v;
+        }
+        if (type == IVSHMEM_INT32)
+            got = ((const int32_t *)buf)[i];
+        else if (type == IVSHMEM_FLOAT)
+            got = ((const float *)buf)[i];
+        else
+            got = ((const double *)buf)[i];
+        bad += got != want;
+    }
+
+    return bad;
+}
+
+static uint8_t pattern(int who, size_t i, int round)
+{
+    return i * 31 + who * 7 + round;
+}
+
+static size_t check_bytes(const uint8_t * buf, size_t bytes, int who,
+                          int round)
+{
+    size_t i, bad = 0;
+
+    for (i = 0; i < bytes; i++)
+        bad += buf[i] != pattern(who, i, round);
+    return bad;
+}
+
+/* every collective from every root; returns how many came out wrong */
+static long check_all(struct ivshmem_coll_peer * p, int rounds)
+{
+
+    size_t chunk = p->c->chunk, n = p->nparties;
+    size_t sizes[NCHECKS] = { 1, 1000, chunk - 4, chunk + 12,
+                              chunk * (n + 2) + 76 };
+    size_t bytes, count, i;
+    uint8_t * buf, * all;
+    int32_t * send, * recv;
+    long bad = 0, done = 0;
+    int round, s, root, q, type, op;
+
+    buf = malloc(sizes[NCHECKS - 1]);
+    all = malloc(sizes[NCHECKS - 1] * n);
+    send = malloc(sizes[NCHECKS - 1]);
+    recv = malloc(sizes[NCHECKS - 1]);
+
+    for (round = 0; round < rounds; round++) {
+        for (s = 0; s < NCHECKS; s++) {
+            bytes = sizes[s];
+            count = bytes / sizeof(int32_t);
+
+            for (root = 0; root < n; root++) {
+                for (i = 0; i < bytes; i++)
+                    buf[i] = p->rank == root ? pattern(root, i, round) : 0;
+                if (ivshmem_coll_bcast(p, buf, bytes, root) < 0)
+                    return -1;
+                bad += check_bytes(buf, bytes, root, round) != 0;
+
+                /* recv must stay untouched away from the root */
+                fill(send, count, IVSHMEM_INT32, p->rank);
+                memset(recv, 0xa5, count * sizeof(int32_t));
+                if (ivshmem_coll_reduce(p, send, recv, count, IVSHMEM_INT32,
+                                        IVSHMEM_MAX, root) < 0)
+                    return -1;
+                if (p->rank == root)
+                    bad += check(recv, count, IVSHMEM_INT32, IVSHMEM_MAX,
+                                 n) != 0;
+                else
+                    for (i = 0; i < count; i++)
+                        if (recv[i] != (int32_t)0xa5a5a5a5) {
+                            bad++;
+                            break;
+                        }
+                done += 2;
+            }
+
+            for (i = 0; i < bytes; i++)
+                buf[i] = pattern(p->rank, i, round);
+            if (ivshmem_coll_allgather(p, buf, bytes, all) < 0)
+                return -1;
+            for (q = 0; q < n; q++)
+                bad += check_bytes(all + q * bytes, bytes, q, round) != 0;
+            done++;
+
+            /* in place, as well as every type and operation */
+            for (type = 0; type < IVSHMEM_NTYPES; type++) {
+                for (op = 0; op < IVSHMEM_NOPS; op++) {
+                    count = bytes / ivshmem_coll_type_size(type);
+                    fill(send, count, type, p->rank);
+                    if (ivshmem_coll_allreduce(p, send, send, count, type,
+                                               op) < 0)
+                        return -1;
+                    bad += check(send, count, type, op, n) != 0;
+                    done++;
+                }
+            }
+        }
+        if (ivshmem_coll_barrier(p) < 0)
+            return -1;
+    }
+
+    printf("[ALLREDUCE] check rank %d of %zu: %ld collectives, %ld wrong\n",
+           p->rank, n, done, bad);
+    free(buf);
+    free(all);
+    free(send);
+    free(recv);
+
+    return bad;
+}
+
+static void attach(struct ivshmem_coll_peer * p, struct ivshmem_dev * dev)
+{
+
+    struct bench_ctl * ctl = dev->mem;
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+            ivshmem_coll_attach(p, (char *)dev->mem + COLL_OFFSET, dev,
+                                VECTOR) < 0) {
+        printf("run init first (%s)\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+static void kernels(size_t bytes)
+{
+
+    void * dst = malloc(bytes), * src = malloc(bytes);
+    uint64_t start, elapsed;
+    int isa, type, op, pass;
+    size_t count;
+
+    memset(dst, 0, bytes);
+    memset(src, 0, bytes);
+
+    for (isa = 0; isa < IVSHMEM_NISAS; isa++) {
+        if (ivshmem_reduce_set_isa(isa) < 0)
+            continue;
+        for (type = 0; type < IVSHMEM_NTYPES; type++) {
+            count = bytes / ivshmem_coll_type_size(type);
+            for (op = 0; op < IVSHMEM_NOPS; op++) {
+                ivshmem_reduce(dst, src, count, type, op);
+                start = now_ns();
+                for (pass = 0; pass < 8; pass++)
+                    ivshmem_reduce(dst, src, count, type, op);
+                elapsed = now_ns() - start;
+                printf("[ALLREDUCE] kernel %-7s %-6s %s: %.2f GB/s\n",
+                       ivshmem_isa_names[isa], type_names[type], op_names[op],
+                       8.0 * bytes / elapsed);
+            }
+        }
+    }
+
+    free(dst);
+    free(src);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_coll_peer p;
+    struct bench_ctl * ctl;
+    uint32_t sizes[MAX_SIZES];
+    char * tok;
+    void * send, * recv;
+    uint64_t start, elapsed;
+    size_t count, bad;
+    long iters, i, wrong;
+    int nsizes = 0, s, type = IVSHMEM_FLOAT, op = IVSHMEM_SUM;
+    double algbw;
+
+    if (argc < 3) {
+        printf("USAGE: allreduce_bench <filename> init <parties> [chunk KB]\n"
+               "       allreduce_bench <filename> run <sizes> [int|float|double] "
+               "[sum|min|max] [generic|avx2|avx512] [spin]\n"
+               "       allreduce_bench <filename> check [rounds] [spin]\n"
+               "       allreduce_bench - kernels [MB]\n");
+        exit(-1);
+    }
+
+    if (strcmp(argv[2], "kernels") == 0) {
+        kernels((argc > 3 ? atol(argv[3]) : 16) << 20);
+        return 0;
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        if (argc < 4) {
+            printf("init needs <parties>\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        if (ivshmem_coll_init((char *)dev.mem + COLL_OFFSET,
+                              dev.size - COLL_OFFSET, atoi(argv[3]),
+                              (argc > 4 ? atoi(argv[4]) : 256) << 10) < 0) {
+            perror("ivshmem_coll_init");
+            exit(-1);
+        }
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (strcmp(argv[2], "check") == 0) {
+        attach(&p, &dev);
+        if (argc > 4)
+            p.spin = atoi(argv[4]);
+        if (ivshmem_coll_barrier(&p) < 0 ||
+                (wrong = check_all(&p, argc > 3 ? atoi(argv[3]) : 3)) < 0) {
+            perror("ivshmem_coll");
+            exit(-1);
+        }
+        ivshmem_coll_detach(&p);
+        ivshmem_close(&dev);
+        return wrong ? 1 : 0;
+    }
+
+    if (strcmp(argv[2], "run") != 0 || argc < 4) {
+        printf("run needs <sizes>\n");
+        exit(-1);
+    }
+    for (tok = strtok(argv[3], ","); tok && nsizes < MAX_SIZES;
+            tok = strtok(NULL, ","))
+        sizes[nsizes++] = parse_size(tok);
+    if (argc > 4)
+        type = lookup(argv[4], type_names, IVSHMEM_NTYPES);
+    if (argc > 5)
+        op = lookup(argv[5], op_names, IVSHMEM_NOPS);
+    if (argc > 6 && ivshmem_reduce_set_isa(lookup(argv[6], ivshmem_isa_names,
+                                                  IVSHMEM_NISAS)) < 0) {
+        printf("%s not supported here\n", argv[6]);
+        exit(-1);
+    }
+
+    attach(&p, &dev);
+    if (argc > 7)
+        p.spin = atoi(argv[7]);
+
+    if (p.rank == 0)
+        printf("[ALLREDUCE] %d parties, %u KB chunks, %s %s, %s kernels\n",
+               p.nparties, p.c->chunk >> 10, type_names[type], op_names[op],
+               ivshmem_isa_names[ivshmem_reduce_isa()]);
+
+    /* nobody's step moves until everyone has attached */
+    if (ivshmem_coll_barrier(&p) < 0) {
+        perror("ivshmem_coll_barrier");
+        exit(-1);
+    }
+
+    for (s = 0; s < nsizes; s++) {
+        count = sizes[s] / ivshmem_coll_type_size(type);
+        send = malloc(count * ivshmem_coll_type_size(type) + 1);
+        recv = malloc(count * ivshmem_coll_type_size(type) + 1);
+        fill(send, count, type, p.rank);
+        iters = BYTES_PER_SIZE / (sizes[s] ? sizes[s] : 1);
+        if (iters < 10)
+            iters = 10;
+        if (iters > 10000)
+            iters = 10000;
+
+        for (i = 0; i < WARMUP; i++)
+            ivshmem_coll_allreduce(&p, send, recv, count, type, op);
+        p.sleeps = p.doorbells = 0;
+        ivshmem_coll_barrier(&p);
+
+        start = now_ns();
+        for (i = 0; i < iters; i++) {
+            if (ivshmem_coll_allreduce(&p, send, recv, count, type, op) < 0) {
+                perror("ivshmem_coll_allreduce");
+                exit(-1);
+            }
+        }
+        elapsed = now_ns() - start;
+
+        if ((bad = check(recv, count, type, op, p.nparties)))
+            printf("[ALLREDUCE] rank %d: %zu of %zu elements wrong at %u "
+                   "bytes\n", p.rank, bad, count, sizes[s]);
+        if (p.rank == 0) {
+            algbw = (double)sizes[s] * iters / elapsed;
+            printf("[ALLREDUCE] %9u bytes: %10.2f us, algbw %6.2f GB/s, "
+                   "busbw %6.2f GB/s, %.2f sleeps, %.2f doorbells\n",
+                   sizes[s], elapsed / 1e3 / iters, algbw,
+                   algbw * 2 * (p.nparties - 1) / p.nparties,
+                   (double)p.sleeps / iters, (double)p.doorbells / iters);
+        }
+        free(send);
+        free(recv);
+    }
+
+    ivshmem_coll_barrier(&p);
+    ivshmem_coll_detach(&p);
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs allreduce_bench between host processes joined through ivshmem_server
+# for 1..8 parties, after timing the reduction kernels.  Each party count
+# is checked first; the script fails if any collective came out wrong.
+#
+#   ./run_host.sh [sizes] [type] [op]
+
+BENCH=./build/allreduce_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/allreduce_bench.sock
+SIZES=${1:-4K,64K,1M,16M,64M}
+STATUS=0
+
+$BENCH - kernels
+
+for P in ${PARTIES:-1 2 4 8}; do
+    $SERVER -p $SOCK -s allreduce_bench -m ${REGION_MB:-64} -n 1 > /dev/null &
+    SRV=$!
+    sleep 0.2
+
+    $BENCH $SOCK init $P ${CHUNK_KB:-256}
+    # let the server finish with init leaving before the others join
+    sleep 0.1
+    PIDS=
+    for i in $(seq $P); do
+        $BENCH $SOCK check &
+        PIDS="$PIDS $!"
+    done
+    for PID in $PIDS; do
+        wait $PID || STATUS=1
+    done
+
+    $BENCH $SOCK init $P ${CHUNK_KB:-256}
+    sleep 0.1
+    PIDS=
+    for i in $(seq $P); do
+        $BENCH $SOCK run $SIZES ${2:-float} ${3:-sum} $ISA &
+        PIDS="$PIDS $!"
+    done
+    wait $PIDS
+
+    kill $SRV
+    wait $SRV 2>/dev/null
+    rm -f /dev/shm/allreduce_bench
+done
+
+exit $STATUS
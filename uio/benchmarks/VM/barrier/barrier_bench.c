@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ivshmem.h"
+#include "ivshmem_barrier.h"
+
+/*
+ * Barrier latency against the number of participating VMs.  "init" sets up
+ * a central and a dissemination barrier for <parties>, and a latch that
+ * holds everyone at the start line until all parties have attached.  Each
+ * party then runs <iterations> barriers back to back and reports the mean
+ * time per barrier and how often it slept or rang somebody.
+ *
+ * <spin> is how many polls a party makes before sleeping on its doorbell;
+ * 0 measures pure doorbell wakeups, a large value pure spinning.
+ *
+ *   barrier_bench <dev> init <parties>
+ *   barrier_bench <dev> central|dissem <iterations> [spin] [vector]
+ */
+
+#define BENCH_MAGIC 0x42415242
+#define WARMUP 100
+
+struct bench_ctl {
+    uint32_t magic;
+    struct ivshmem_latch start;
+    struct ivshmem_barrier central;
+    struct ivshmem_barrier dissem;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_sync_peer party, gate;
+    struct ivshmem_barrier * b;
+    struct bench_ctl * ctl;
+    long iterations, i;
+    uint64_t start, elapsed;
+    int vector = 0;
+
+    if (argc < 4) {
+        printf("USAGE: barrier_bench <filename> init <parties>\n"
+               "       barrier_bench <filename> central|dissem <iterations> [spin] [vector]\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        int parties = atoi(argv[3]);
+
+        if (parties < 1 || parties > IVSHMEM_SYNC_MAX_PARTIES) {
+            printf("1 to %d parties\n", IVSHMEM_SYNC_MAX_PARTIES);
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ivshmem_latch_init(&ctl->start, parties);
+        ivshmem_barrier_init(&ctl->central, IVSHMEM_BARRIER_CENTRAL, parties);
+        ivshmem_barrier_init(&ctl->dissem, IVSHMEM_BARRIER_DISSEMINATION,
+                             parties);
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (strcmp(argv[2], "central") == 0)
+        b = &ctl->central;
+    else if (strcmp(argv[2], "dissem") == 0)
+        b = &ctl->dissem;
+    else {
+        printf("unknown barrier %s\n", argv[2]);
+        exit(-1);
+    }
+    iterations = atol(argv[3]);
+    if (argc > 5)
+        vector = atoi(argv[5]);
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+            ivshmem_barrier_attach(&party, b, &dev, vector) < 0 ||
+            ivshmem_latch_attach(&gate, &ctl->start, &dev, vector) < 0) {
+        printf("run init first (%s)\n", strerror(errno));
+        exit(-1);
+    }
+    if (argc > 4)
+        party.spin = atoi(argv[4]);
+
+    ivshmem_latch_count_down(&gate, 1);
+    if (ivshmem_latch_wait(&gate) < 0) {
+        perror("ivshmem_latch_wait");
+        exit(-1);
+    }
+
+    for (i = 0; i < WARMUP; i++)
+        ivshmem_barrier_wait(&party);
+    party.sleeps = party.doorbells = 0;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        if (ivshmem_barrier_wait(&party) < 0) {
+            perror("ivshmem_barrier_wait");
+            exit(-1);
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("[BARRIER] %s party %d of %u: %.2f us/barrier, "
+           "%.2f sleeps/barrier, %.2f doorbells/barrier\n", argv[2], party.id,
+           b->nparties, elapsed / 1e3 / iterations,
+           (double)party.sleeps / iterations,
+           (double)party.doorbells / iterations);
+
+    ivshmem_latch_detach(&gate);
+    ivshmem_barrier_detach(&party);
+    ivshmem_close(&dev);
+
+    return 0;
+}
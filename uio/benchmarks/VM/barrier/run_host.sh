@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs barrier_bench between host processes joined through ivshmem_server
+# for 2..16 parties, each barrier, spinning first and sleeping at once.
+#
+#   ./run_host.sh [iterations]
+
+BENCH=./build/barrier_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/barrier_bench.sock
+ITER=${1:-10000}
+
+for B in central dissem; do
+    for SPIN in 4096 0; do
+        for P in ${PARTIES:-2 4 8 16}; do
+            $SERVER -p $SOCK -s barrier_bench -m 4 -n 1 > /dev/null &
+            SRV=$!
+            sleep 0.2
+
+            $BENCH $SOCK init $P
+            PIDS=
+            for i in $(seq $P); do
+                $BENCH $SOCK $B $ITER $SPIN > /tmp/barrier_bench.out.$i &
+                PIDS="$PIDS $!"
+            done
+            wait $PIDS
+
+            cat /tmp/barrier_bench.out.* | awk -v b=$B -v s=$SPIN -v p=$P '
+                { if ($7 > t) t = $7; sl += $9; db += $11 }
+                END { printf "%-7s spin %4d %2d parties: %8.2f us/barrier, %5.2f sleeps, %5.2f doorbells\n",
+                             b, s, p, t, sl / p, db / p }'
+
+            kill $SRV
+            wait $SRV 2>/dev/null
+            rm -f /tmp/barrier_bench.out.* /dev/shm/barrier_bench
+        done
+    done
+done
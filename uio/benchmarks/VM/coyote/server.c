@@ -17,8 +17,8 @@
 
 int main(int argc, char ** argv){
 
-    int fd, length=4*1024;
-    void * memptr, *regptr;
+    int length=4*1024;
+    struct ivshmem_dev dev;
     long * long_array;
     long param;
     int other;
@@ -30,7 +30,6 @@ int main(int argc, char ** argv){
         exit(-1);
     }
 
-    fd = open(argv[1], O_RDWR|O_NONBLOCK);
     printf("[DUMP] opening file %s\n", argv[1]);
 
     param = atol(argv[2]);
@@ -39,34 +38,22 @@ int main(int argc, char ** argv){
     length = CHUNK_SZ;
     printf("[DUMP] size is %d\n", length);
 
-    if ((regptr = mmap(NULL, 256, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 * getpagesize())) == (void *) -1)
-    {
-        printf("mmap failed (0x%p)\n", regptr);
-        close (fd);
-        exit (-1);
-    }
-
-    if ((memptr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 1 * getpagesize())) == (void *) -1)
-    {
-        printf("mmap failed (0x%p)\n", memptr);
-        close (fd);
+    if (ivshmem_open(&dev, argv[1], length, 0) < 0) {
+        perror("ivshmem_open");
         exit (-1);
     }
 
     srand(time(NULL));
 
     /* wake client */
-    ivshmem_send(regptr, MSI_VECTOR, other);
+    ivshmem_doorbell(&dev, other, MSI_VECTOR);
     /*
     printf("waiting\n");
-    rv = ivshmem_recv(fd);
+    rv = ivshmem_wait(&dev, MSI_VECTOR);
     printf("rv = %d\n", rv);
     */
 
-    printf("[DUMP] munmap is unmapping %p\n", memptr);
-    munmap(memptr, length);
-    munmap(regptr, 256);
-
-    close(fd);
+    printf("[DUMP] munmap is unmapping %p\n", dev.mem);
+    ivshmem_close(&dev);
 
 }
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+#include "ivshmem_buf.h"
+
+/*
+ * One producer delivering every message to each of several consumers, each
+ * reached through its own SPSC ring.  In "copy" mode the producer copies the
+ * payload into every consumer's ring, as ftp_send and ShmOutputStream do
+ * with their slots.  In "zc" mode it writes the payload once into a
+ * refcounted buffer from the shared heap and sends each consumer only a
+ * descriptor list; the last consumer to release a buffer frees it.
+ * Consumers sum every payload in place and check it.
+ *
+ *   fanout_bench <dev> init <consumers> <msg size> <count> copy|zc
+ *   fanout_bench <dev> prod
+ *   fanout_bench <dev> cons <index>
+ */
+
+#define BENCH_MAGIC 0x46414e4f
+#define MAX_CONSUMERS 8
+#define RING_OFFSET (64 * 1024)
+#define RING_BYTES (1024 * 1024)
+#define HEAP_OFFSET (16 * 1024 * 1024)
+#define VECTOR 0
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t zero_copy;
+    uint32_t nconsumers;
+    uint32_t msg_size;
+    uint64_t count;
+    int32_t prod_posn;
+    int32_t cons_posn[MAX_CONSUMERS];
+    uint32_t arrived __attribute__((aligned(64)));
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fill(uint64_t * p, size_t bytes, uint64_t seq)
+{
+    size_t i;
+
+    for (i = 0; i < bytes / 8; i++)
+        p[i] = seq + i;
+}
+
+/* the sum fill() leaves behind, so consumers can check what they got */
+static uint64_t expected_sum(size_t bytes, uint64_t seq)
+{
+    uint64_t n = bytes / 8;
+
+    return n * seq + n * (n - 1) / 2;
+}
+
+static uint64_t sum(const uint64_t * p, size_t bytes)
+{
+    uint64_t s = 0;
+    size_t i;
+
+    for (i = 0; i < bytes / 8; i++)
+        s += p[i];
+    return s;
+}
+
+static void * ring(struct ivshmem_dev * dev, int i)
+{
+    return (char *)dev->mem + RING_OFFSET + (size_t)i * RING_BYTES;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_spsc_end end[MAX_CONSUMERS];
+    struct ivshmem_slab_cache cache;
+    struct ivshmem_slab * heap;
+    struct ivshmem_sg_list list;
+    struct bench_ctl * ctl;
+    uint64_t * payload, seq, start, elapsed, bad = 0, s;
+    uint32_t i, n, len;
+    int consumer = -1;
+    void * slot;
+    ivshmem_slab_t h;
+
+    if (argc < 3) {
+        printf("USAGE: fanout_bench <filename> init <consumers> <msg size> <count> copy|zc\n"
+               "       fanout_bench <filename> prod\n"
+               "       fanout_bench <filename> cons <index>\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+    heap = (struct ivshmem_slab *)((char *)dev.mem + HEAP_OFFSET);
+
+    if (strcmp(argv[2], "init") == 0) {
+        if (argc != 7 || dev.size <= HEAP_OFFSET) {
+            printf("init needs <consumers> <msg size> <count> copy|zc, "
+                   "and more than %d MB of shared memory\n", HEAP_OFFSET >> 20);
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->nconsumers = atoi(argv[3]);
+        ctl->msg_size = atoi(argv[4]) & ~7;
+        ctl->count = atoll(argv[5]);
+        ctl->zero_copy = strcmp(argv[6], "zc") == 0;
+        ctl->arrived = 0;
+        if (ctl->nconsumers < 1 || ctl->nconsumers > MAX_CONSUMERS) {
+            printf("1 to %d consumers\n", MAX_CONSUMERS);
+            exit(-1);
+        }
+        for (i = 0; i < ctl->nconsumers; i++) {
+            if (!ivshmem_spsc_init(ring(&dev, i), RING_BYTES, ctl->zero_copy ?
+                        sizeof(struct ivshmem_sg_list) : ctl->msg_size)) {
+                printf("message too large for a ring\n");
+                exit(-1);
+            }
+        }
+        if (ctl->zero_copy)
+            ivshmem_slab_init(heap, dev.size - HEAP_OFFSET);
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    if (strcmp(argv[2], "cons") == 0) {
+        consumer = argc > 3 ? atoi(argv[3]) : 0;
+        if (consumer < 0 || consumer >= ctl->nconsumers) {
+            printf("consumer index out of range\n");
+            exit(-1);
+        }
+        ctl->cons_posn[consumer] = ivshmem_posn(&dev);
+    } else
+        ctl->prod_posn = ivshmem_posn(&dev);
+
+    /* everyone has published their position once all have arrived */
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) <
+                ctl->nconsumers + 1)
+        ivshmem_relax();
+
+    if (ctl->zero_copy && ivshmem_slab_attach(&cache, heap) < 0) {
+        perror("ivshmem_slab_attach");
+        exit(-1);
+    }
+    payload = malloc(ctl->msg_size);
+
+    if (consumer < 0) {
+        for (i = 0; i < ctl->nconsumers; i++)
+            ivshmem_spsc_attach(&end[i], ring(&dev, i), IVSHMEM_SPSC_PRODUCER,
+                                &dev, ctl->cons_posn[i], VECTOR, VECTOR);
+
+        start = now_ns();
+        for (seq = 0; seq < ctl->count; seq++) {
+            if (ctl->zero_copy) {
+                while (!(h = ivshmem_buf_alloc(&cache, ctl->msg_size))) {
+                    /* consumers still hold every buffer: wait for them */
+                    if (errno != ENOMEM) {
+                        perror("ivshmem_buf_alloc");
+                        exit(-1);
+                    }
+                    ivshmem_relax();
+                }
+                fill(ivshmem_buf_data(heap, h), ctl->msg_size, seq);
+                ivshmem_sg_init(&list);
+                ivshmem_sg_add(heap, &list, h, 0, ctl->msg_size);
+                ivshmem_buf_put(&cache, h);
+                ivshmem_sg_share(heap, &list, ctl->nconsumers - 1);
+                for (i = 0; i < ctl->nconsumers; i++)
+                    ivshmem_spsc_send(&end[i], &list, ivshmem_sg_bytes(&list));
+            } else {
+                /* stands in for the read() into the slot */
+                fill(payload, ctl->msg_size, seq);
+                for (i = 0; i < ctl->nconsumers; i++)
+                    ivshmem_spsc_send(&end[i], payload, ctl->msg_size);
+            }
+        }
+        elapsed = now_ns() - start;
+    } else {
+        ivshmem_spsc_attach(&end[0], ring(&dev, consumer),
+                            IVSHMEM_SPSC_CONSUMER, &dev, ctl->prod_posn,
+                            VECTOR, VECTOR);
+
+        start = now_ns();
+        for (seq = 0; seq < ctl->count; seq++) {
+            if (ctl->zero_copy) {
+                ivshmem_spsc_recv(&end[0], &list, sizeof(list));
+                for (s = 0, n = 0; n < list.n; n++)
+                    s += sum((uint64_t *)((char *)ivshmem_buf_data(heap,
+                                    list.sg[n].buf) + list.sg[n].off),
+                             list.sg[n].len);
+                len = list.total;
+                ivshmem_sg_release(&cache, &list);
+            } else {
+                while ((slot = ivshmem_spsc_peek(&end[0], &len)) == NULL)
+                    ivshmem_spsc_wait_data(&end[0]);
+                s = sum(slot, len);
+                ivshmem_spsc_consume(&end[0]);
+                ivshmem_spsc_release(&end[0]);
+            }
+            bad += len != ctl->msg_size || s != expected_sum(len, seq);
+        }
+        elapsed = now_ns() - start;
+    }
+
+    printf("[FANOUT] %s %s posn %d: %llu msgs of %u bytes in %.3f s, "
+           "%.0f MB/s, %llu bad\n", ctl->zero_copy ? "zc" : "copy",
+           argv[2], ivshmem_posn(&dev), (unsigned long long)ctl->count,
+           ctl->msg_size, elapsed / 1e9,
+           ctl->count * (double)ctl->msg_size / (elapsed / 1e3),
+           (unsigned long long)bad);
+
+    if (ctl->zero_copy)
+        ivshmem_slab_detach(&cache);
+    free(payload);
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs fanout_bench between host processes joined through ivshmem_server for
+# 1/2/4/8 consumers, copying and zero-copy.  Fails if any consumer saw a
+# corrupt payload.
+#
+#   ./run_host.sh [msg size] [count]
+
+BENCH=./build/fanout_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/fanout_bench.sock
+SIZE=${1:-16384}
+COUNT=${2:-20000}
+STATUS=0
+
+for MODE in copy zc; do
+    for C in ${CONSUMERS:-1 2 4 8}; do
+        $SERVER -p $SOCK -s fanout_bench -m 128 -n 1 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $C $SIZE $COUNT $MODE
+        PIDS=
+        for i in $(seq 0 $((C - 1))); do
+            $BENCH $SOCK cons $i > /tmp/fanout_bench.out.$i &
+            PIDS="$PIDS $!"
+        done
+        $BENCH $SOCK prod | sed "s/^/$C consumers: /"
+        wait $PIDS
+
+        cat /tmp/fanout_bench.out.* | sed "s/^/$C consumers: /"
+        # each consumer ends its report with "<n> bad", or died without one
+        if [ $(cat /tmp/fanout_bench.out.* | grep -c ' 0 bad$') -ne $C ]; then
+            echo "$MODE, $C consumers: corrupt payloads or a failed consumer" >&2
+            STATUS=1
+        fi
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /tmp/fanout_bench.out.* /dev/shm/fanout_bench
+    done
+done
+
+exit $STATUS
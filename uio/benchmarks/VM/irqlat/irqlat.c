@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "ivshmem.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    uint64_t * lat, start, sum;
+    cpu_set_t set;
+    int i, n, vector, cpu, self;
+
+    if (argc != 5) {
+        printf("USAGE: irqlat <filename> <iterations> <vector> <cpu>\n");
+        exit(-1);
+    }
+
+    n = atoi(argv[2]);
+    vector = atoi(argv[3]);
+    cpu = atoi(argv[4]);
+    if (n <= 0) {
+        printf("iterations must be positive\n");
+        exit(-1);
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("sched_setaffinity");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 0) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+
+    if (vector < 0 || vector >= dev.nvectors) {
+        printf("vector %d out of range (%d vectors)\n", vector, dev.nvectors);
+        exit(-1);
+    }
+
+    lat = malloc(n * sizeof(uint64_t));
+    self = ivshmem_posn(&dev);
+    printf("[IRQLAT] posn %d vector %d cpu %d, %d iterations\n",
+                self, vector, cpu, n);
+
+    for (i = 0; i < n; i++) {
+        start = now_ns();
+        ivshmem_doorbell(&dev, self, vector);
+        if (ivshmem_wait(&dev, vector) < 0) {
+            perror("ivshmem_wait");
+            exit(-1);
+        }
+        lat[i] = now_ns() - start;
+    }
+
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+    for (sum = 0, i = 0; i < n; i++)
+        sum += lat[i];
+
+    printf("[IRQLAT] mean %llu ns  min %llu  p50 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+            (unsigned long long)(sum / n), (unsigned long long)lat[0],
+            (unsigned long long)lat[n / 2],
+            (unsigned long long)lat[(int)(n * 0.99)],
+            (unsigned long long)lat[(int)(n * 0.999)],
+            (unsigned long long)lat[n - 1]);
+
+    free(lat);
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "ivshmem.h"
+#include "ivshmem_mutex.h"
+#include "ivshmem_qlock.h"
+
+/*
+ * Contention benchmark for locks in the shared region.  "init" lays out
+ * every lock and says how many peers will run; each peer (a process in a
+ * VM, or a host process on an ivshmem_server socket) then takes the lock
+ * <iterations> times, does <cs> pause loops inside and <think> outside.
+ *
+ * "spin" is the pthread_spinlock_t that tests/Spinlocks puts in the region,
+ * "mutex" is ivshmem_mutex, "ticket" and "mcs" the fair locks from
+ * ivshmem_qlock.h.  Besides throughput, every peer reports the CPU time it
+ * burnt and its average and longest wait for the lock; comparing peers
+ * shows how fair the lock is.  Run more peers than there are vCPUs to see
+ * what lock-holder preemption does to each.
+ *
+ *   lock_bench <dev> init <peers>
+ *   lock_bench <dev> spin|mutex|ticket|mcs <iterations> <cs> <think> [vector]
+ */
+
+#define BENCH_MAGIC 0x4c4f434b
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t npeers;
+    uint32_t arrived __attribute__((aligned(64)));
+    uint32_t finished;
+    uint64_t expected;
+    uint64_t counter __attribute__((aligned(64)));  /* protected by the lock */
+
+    pthread_spinlock_t spin __attribute__((aligned(64)));
+    struct ivshmem_mutex mutex __attribute__((aligned(64)));
+    struct ivshmem_ticket ticket;
+    struct ivshmem_mcs mcs;
+};
+
+struct lock_ops {
+    const char * name;
+    int (*attach)(struct bench_ctl * ctl, struct ivshmem_dev * dev, int vector);
+    void (*lock)(void);
+    void (*unlock)(void);
+    void (*report)(void);
+};
+
+static struct bench_ctl * ctl;
+
+static int spin_attach(struct bench_ctl * ctl, struct ivshmem_dev * dev,
+                       int vector)
+{
+    return 0;
+}
+
+static void spin_lock(void)
+{
+    pthread_spin_lock(&ctl->spin);
+}
+
+static void spin_unlock(void)
+{
+    pthread_spin_unlock(&ctl->spin);
+}
+
+static void spin_report(void)
+{
+    printf("\n");
+}
+
+static struct ivshmem_mutex_peer mutex_peer;
+
+static int mutex_attach(struct bench_ctl * ctl, struct ivshmem_dev * dev,
+                        int vector)
+{
+    return ivshmem_mutex_attach(&mutex_peer, &ctl->mutex, dev, vector);
+}
+
+static void mutex_lock(void)
+{
+    if (ivshmem_mutex_lock(&mutex_peer) < 0) {
+        perror("ivshmem_mutex_lock");
+        exit(-1);
+    }
+}
+
+static void mutex_unlock(void)
+{
+    ivshmem_mutex_unlock(&mutex_peer);
+}
+
+static void mutex_report(void)
+{
+    printf(", %lu contended, %lu sleeps, %lu doorbells, spin %u\n",
+           mutex_peer.contended, mutex_peer.sleeps, mutex_peer.doorbells,
+           ctl->mutex.spin);
+    ivshmem_mutex_detach(&mutex_peer);
+}
+
+static int ticket_attach(struct bench_ctl * ctl, struct ivshmem_dev * dev,
+                         int vector)
+{
+    return 0;
+}
+
+static void ticket_lock(void)
+{
+    ivshmem_ticket_lock(&ctl->ticket);
+}
+
+static void ticket_unlock(void)
+{
+    ivshmem_ticket_unlock(&ctl->ticket);
+}
+
+static struct ivshmem_mcs_peer mcs_peer;
+
+static int mcs_attach(struct bench_ctl * ctl, struct ivshmem_dev * dev,
+                      int vector)
+{
+    return ivshmem_mcs_attach(&mcs_peer, &ctl->mcs);
+}
+
+static void mcs_lock(void)
+{
+    ivshmem_mcs_lock(&mcs_peer);
+}
+
+static void mcs_unlock(void)
+{
+    ivshmem_mcs_unlock(&mcs_peer);
+}
+
+static void mcs_report(void)
+{
+    printf("\n");
+    ivshmem_mcs_detach(&mcs_peer);
+}
+
+static struct lock_ops locks[] = {
+    { "spin", spin_attach, spin_lock, spin_unlock, spin_report },
+    { "mutex", mutex_attach, mutex_lock, mutex_unlock, mutex_report },
+    { "ticket", ticket_attach, ticket_lock, ticket_unlock, spin_report },
+    { "mcs", mcs_attach, mcs_lock, mcs_unlock, mcs_report },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void work(long n)
+{
+    while (n-- > 0)
+        ivshmem_relax();
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct lock_ops * ops = NULL;
+    long iterations, cs, think, i;
+    uint64_t start, elapsed, t, wait, max_wait = 0, total_wait = 0;
+    double cpu;
+    int vector = 0;
+    unsigned k;
+
+    if (argc < 4) {
+        printf("USAGE: lock_bench <filename> init <peers>\n"
+               "       lock_bench <filename> <lock> <iterations> <cs> <think> [vector]\n"
+               "locks:");
+        for (k = 0; k < sizeof(locks) / sizeof(locks[0]); k++)
+            printf(" %s", locks[k].name);
+        printf("\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        ctl->magic = 0;
+        ctl->npeers = atoi(argv[3]);
+        ctl->arrived = ctl->finished = 0;
+        ctl->expected = ctl->counter = 0;
+        pthread_spin_init(&ctl->spin, PTHREAD_PROCESS_SHARED);
+        ivshmem_mutex_init(&ctl->mutex);
+        ivshmem_ticket_init(&ctl->ticket);
+        ivshmem_mcs_init(&ctl->mcs);
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    for (k = 0; k < sizeof(locks) / sizeof(locks[0]); k++)
+        if (strcmp(argv[2], locks[k].name) == 0)
+            ops = &locks[k];
+    if (ops == NULL || argc < 6) {
+        printf("unknown lock %s or missing arguments\n", argv[2]);
+        exit(-1);
+    }
+    iterations = atol(argv[3]);
+    cs = atol(argv[4]);
+    think = atol(argv[5]);
+    if (argc > 6)
+        vector = atoi(argv[6]);
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+            ops->attach(ctl, &dev, vector) < 0) {
+        printf("run init first (%s)\n", strerror(errno));
+        exit(-1);
+    }
+    __atomic_fetch_add(&ctl->expected, iterations, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < ctl->npeers)
+        ivshmem_relax();
+
+    cpu = cpu_seconds();
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        t = now_ns();
+        ops->lock();
+        wait = now_ns() - t;
+        if (wait > max_wait)
+            max_wait = wait;
+        total_wait += wait;
+
+        ctl->counter++;
+        work(cs);
+        ops->unlock();
+
+        work(think);
+    }
+    elapsed = now_ns() - start;
+    cpu = cpu_seconds() - cpu;
+
+    printf("[LOCKS] %s posn %d: %ld in %.3f s, %.0f/s, cpu %.3f s, "
+           "wait avg %.2f us max %.1f us", ops->name, ivshmem_posn(&dev),
+           iterations, elapsed / 1e9, iterations / (elapsed / 1e9), cpu,
+           total_wait / 1e3 / iterations, max_wait / 1e3);
+    ops->report();
+
+    if (__atomic_add_fetch(&ctl->finished, 1, __ATOMIC_ACQ_REL) == ctl->npeers)
+        printf("[LOCKS] counter %llu, expected %llu\n",
+               (unsigned long long)ctl->counter,
+               (unsigned long long)ctl->expected);
+
+    ivshmem_close(&dev);
+
+    return 0;
+}
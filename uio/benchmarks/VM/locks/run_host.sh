@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs lock_bench between host processes joined through ivshmem_server for
+# each lock and 2..16 peers, and sums up each run.  With more peers than
+# CPUs this shows what happens to each lock when its holder is preempted.
+#
+#   ./run_host.sh [iterations] [cs] [think] [locks...]
+
+BENCH=./build/lock_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/lock_bench.sock
+ITER=${1:-100000}
+CS=${2:-50}
+THINK=${3:-200}
+shift 3 2>/dev/null
+LOCKS=${*:-spin mutex ticket mcs}
+
+for L in $LOCKS; do
+    for P in ${PEERS:-2 4 8 16}; do
+        $SERVER -p $SOCK -s lock_bench -m 4 -n 1 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $P
+        PIDS=
+        for i in $(seq $P); do
+            $BENCH $SOCK $L $ITER $CS $THINK > /tmp/lock_bench.out.$i &
+            PIDS="$PIDS $!"
+        done
+        wait $PIDS
+
+        cat /tmp/lock_bench.out.* | grep posn | awk -v l=$L -v p=$P '
+            { n += $5; if ($7 > t) t = $7; cpu += $11;
+              if ($18 > max) max = $18; if (!min || $5 / $7 < min) min = $5 / $7;
+              if ($5 / $7 > top) top = $5 / $7 }
+            END { printf "%-6s %2d peers: %9.0f/s, cpu %6.2f s, max wait %9.1f us, slowest/fastest peer %.2f\n",
+                         l, p, n / t, cpu, max, min / top }'
+        grep -h counter /tmp/lock_bench.out.* | awk -F'[ ,]+' '$3 != $5 { print "  MISMATCH " $0 }'
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /tmp/lock_bench.out.* /dev/shm/lock_bench
+    done
+done
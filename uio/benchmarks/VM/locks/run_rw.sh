@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs rw_bench between host processes joined through ivshmem_server with
+# 1..8 readers and one writer, for each lock, and sums the reader rates.
+#
+#   ./run_rw.sh [seconds] [writer interval us] [locks...]
+
+BENCH=./build/rw_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/rw_bench.sock
+SECS=${1:-2}
+INTERVAL=${2:-1000}
+shift 2 2>/dev/null
+LOCKS=${*:-seqlock rwlock spin}
+
+for L in $LOCKS; do
+    for R in ${READERS:-1 2 4 8}; do
+        $SERVER -p $SOCK -s rw_bench -m 4 -n 1 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $((R + 1))
+        PIDS=
+        for i in $(seq $R); do
+            $BENCH $SOCK $L read $SECS > /tmp/rw_bench.out.$i &
+            PIDS="$PIDS $!"
+        done
+        $BENCH $SOCK $L write $SECS $INTERVAL > /tmp/rw_bench.out.w &
+        wait $PIDS $!
+
+        cat /tmp/rw_bench.out.* | awk -v l=$L -v r=$R '
+            $3 == "read" { rate += $10; torn += $11 }
+            $3 == "write" { w = $10 }
+            END { printf "%-7s %d readers: %10.0f reads/s, %6.0f writes/s, %d torn\n",
+                         l, r, rate, w, torn }'
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /tmp/rw_bench.out.* /dev/shm/rw_bench
+    done
+done
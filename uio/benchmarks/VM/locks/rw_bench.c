@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ivshmem.h"
+#include "ivshmem_rwlock.h"
+
+/*
+ * Reader scaling for read-mostly state.  "init" lays out a 64-byte record
+ * guarded by a seqlock and a 4K table guarded by the reader-writer lock
+ * (and, for comparison, by the pthread spinlock tests/Spinlocks uses), and
+ * says how many peers will run.  Readers read for <seconds> and report
+ * reads per second; an optional writer rewrites the data every <interval>
+ * microseconds.  Every word of the record and table holds the same value,
+ * so a reader that sees two different values has caught a torn write.
+ *
+ *   rw_bench <dev> init <peers>
+ *   rw_bench <dev> seqlock|rwlock|spin read <seconds>
+ *   rw_bench <dev> seqlock|rwlock|spin write <seconds> <interval us>
+ */
+
+#define BENCH_MAGIC 0x52574243
+#define RECORD_WORDS 8
+#define TABLE_WORDS 512
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t npeers;
+    uint32_t arrived __attribute__((aligned(64)));
+
+    struct ivshmem_seqlock seqlock;
+    uint64_t record[RECORD_WORDS] __attribute__((aligned(64)));
+
+    pthread_spinlock_t spin __attribute__((aligned(64)));
+    struct ivshmem_rwlock rwlock;
+    uint64_t table[TABLE_WORDS] __attribute__((aligned(64)));
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* every word equal, or the read was torn */
+static int consistent(const uint64_t * w, int n)
+{
+    int i;
+
+    for (i = 1; i < n; i++)
+        if (w[i] != w[0])
+            return 0;
+    return 1;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_rwlock_peer peer;
+    struct bench_ctl * ctl;
+    uint64_t record[RECORD_WORDS];
+    uint64_t start, deadline, t, n = 0, torn = 0, value = 0;
+    long interval = 0;
+    int lock, writer, i;
+
+    if (argc < 4) {
+        printf("USAGE: rw_bench <filename> init <peers>\n"
+               "       rw_bench <filename> seqlock|rwlock|spin read <seconds>\n"
+               "       rw_bench <filename> seqlock|rwlock|spin write <seconds> <interval us>\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        ctl->magic = 0;
+        ctl->npeers = atoi(argv[3]);
+        ctl->arrived = 0;
+        ivshmem_seqlock_init(&ctl->seqlock);
+        memset(ctl->record, 0, sizeof(ctl->record));
+        pthread_spin_init(&ctl->spin, PTHREAD_PROCESS_SHARED);
+        ivshmem_rwlock_init(&ctl->rwlock);
+        memset(ctl->table, 0, sizeof(ctl->table));
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (strcmp(argv[2], "seqlock") == 0)
+        lock = 0;
+    else if (strcmp(argv[2], "rwlock") == 0)
+        lock = 1;
+    else if (strcmp(argv[2], "spin") == 0)
+        lock = 2;
+    else {
+        printf("unknown lock %s\n", argv[2]);
+        exit(-1);
+    }
+    writer = argc > 3 && strcmp(argv[3], "write") == 0;
+    if (argc < 5 || (writer && argc < 6)) {
+        printf("missing arguments\n");
+        exit(-1);
+    }
+    if (writer)
+        interval = atol(argv[5]);
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+            ivshmem_rwlock_attach(&peer, &ctl->rwlock) < 0) {
+        printf("run init first (%s)\n", strerror(errno));
+        exit(-1);
+    }
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < ctl->npeers)
+        ivshmem_relax();
+
+    start = now_ns();
+    deadline = start + atol(argv[4]) * 1000000000ull;
+
+    if (writer) {
+        for (t = start; t < deadline; t = now_ns()) {
+            value++;
+            if (lock == 0) {
+                for (i = 0; i < RECORD_WORDS; i++)
+                    record[i] = value;
+                ivshmem_seqlock_write(&ctl->seqlock, ctl->record, record,
+                                      sizeof(record));
+            } else {
+                if (lock == 1)
+                    ivshmem_rwlock_write_lock(&peer);
+                else
+                    pthread_spin_lock(&ctl->spin);
+                for (i = 0; i < TABLE_WORDS; i++)
+                    ctl->table[i] = value;
+                if (lock == 1)
+                    ivshmem_rwlock_write_unlock(&peer);
+                else
+                    pthread_spin_unlock(&ctl->spin);
+            }
+            n++;
+            while (now_ns() < t + interval * 1000)
+                ivshmem_relax();
+        }
+    } else {
+        while ((n & 1023) || now_ns() < deadline) {
+            if (lock == 0) {
+                ivshmem_seqlock_read(&ctl->seqlock, record, ctl->record,
+                                     sizeof(record));
+                torn += !consistent(record, RECORD_WORDS);
+            } else {
+                if (lock == 1)
+                    ivshmem_rwlock_read_lock(&peer);
+                else
+                    pthread_spin_lock(&ctl->spin);
+                torn += !consistent(ctl->table, TABLE_WORDS);
+                if (lock == 1)
+                    ivshmem_rwlock_read_unlock(&peer);
+                else
+                    pthread_spin_unlock(&ctl->spin);
+            }
+            n++;
+        }
+    }
+    t = now_ns() - start;
+
+    printf("[RW] %s %s posn %d: %llu in %.3f s, %.0f/s, %llu torn\n",
+           argv[2], writer ? "write" : "read", ivshmem_posn(&dev),
+           (unsigned long long)n, t / 1e9, n / (t / 1e9),
+           (unsigned long long)torn);
+
+    ivshmem_rwlock_detach(&peer);
+    ivshmem_close(&dev);
+
+    return 0;
+}
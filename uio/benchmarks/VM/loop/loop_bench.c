@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+#include "ivshmem_loop.h"
+
+/*
+ * One thread on each side serving every channel through an ivshmem_loop.
+ * Each channel is a request ring and a response ring.  The server echoes
+ * requests; the client keeps depth requests in flight per channel until
+ * each has made its round trips, then rings the server's stop vector.
+ *
+ *   loop_bench <dev> init <channels> <msgs per channel> [depth]
+ *   loop_bench <dev> server
+ *   loop_bench <dev> client
+ */
+
+#define BENCH_MAGIC 0x4c4f4f50
+#define MAX_CHANNELS 1024
+#define RING_OFFSET (64 * 1024)
+#define RING_BYTES (8 * 1024)
+#define MSG_SIZE 64
+#define NVECTORS 2              /* ivshmem_server -n must match */
+#define VECTOR 0
+#define STOP_VECTOR 1
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t nchannels;
+    uint32_t msgs;
+    uint32_t depth;
+    int32_t server_posn;
+    int32_t client_posn;
+    uint32_t arrived __attribute__((aligned(64)));
+};
+
+struct channel {
+    struct ivshmem_loop_source src;
+    struct ivshmem_spsc_end in;
+    struct ivshmem_spsc_end out;
+    uint32_t sent;
+    uint32_t done;
+};
+
+static struct bench_ctl * ctl;
+static struct channel * channels;
+static uint64_t remaining;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void * ring(struct ivshmem_dev * dev, int i)
+{
+    return (char *)dev->mem + RING_OFFSET + (size_t)i * RING_BYTES;
+}
+
+static int echo(struct ivshmem_loop * loop, struct ivshmem_loop_source * src,
+                int budget)
+{
+
+    struct channel * ch = src->arg;
+    void * req, * resp;
+    uint32_t len;
+    int n;
+
+    for (n = 0; n < budget; n++) {
+        if ((req = ivshmem_spsc_peek(&ch->in, &len)) == NULL ||
+                (resp = ivshmem_spsc_reserve(&ch->out)) == NULL)
+            break;
+        memcpy(resp, req, len);
+        ivshmem_spsc_commit(&ch->out, len);
+        ivshmem_spsc_consume(&ch->in);
+    }
+
+    return n;
+}
+
+static int stop(struct ivshmem_loop * loop, struct ivshmem_loop_source * src,
+                int budget)
+{
+    ivshmem_loop_stop(loop);
+    return 0;
+}
+
+static int send_next(struct channel * ch)
+{
+    uint32_t * msg;
+
+    if (ch->sent == ctl->msgs || (msg = ivshmem_spsc_reserve(&ch->out)) == NULL)
+        return 0;
+    memset(msg, 0, MSG_SIZE);
+    msg[0] = ch->sent++;
+    ivshmem_spsc_commit(&ch->out, MSG_SIZE);
+    return 1;
+}
+
+static int reply(struct ivshmem_loop * loop, struct ivshmem_loop_source * src,
+                 int budget)
+{
+
+    struct channel * ch = src->arg;
+    uint32_t * msg, len;
+    int n;
+
+    for (n = 0; n < budget; n++) {
+        if ((msg = ivshmem_spsc_peek(&ch->in, &len)) == NULL)
+            break;
+        if (len != MSG_SIZE || msg[0] != ch->done) {
+            printf("channel %ld: got %u, expected %u\n",
+                   (long)(ch - channels), msg[0], ch->done);
+            return -EIO;
+        }
+        ch->done++;
+        ivshmem_spsc_consume(&ch->in);
+        send_next(ch);
+    }
+
+    remaining -= n;
+    if (remaining == 0)
+        ivshmem_loop_stop(loop);
+
+    return n;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_loop loop;
+    struct ivshmem_loop_source stop_src;
+    struct channel * ch;
+    uint64_t start, elapsed, doorbells = 0;
+    int i, server, r;
+
+    if (argc < 3) {
+        printf("USAGE: loop_bench <filename> init <channels> <msgs per channel> [depth]\n"
+               "       loop_bench <filename> server|client\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, NVECTORS) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        if (argc < 5) {
+            printf("init needs <channels> <msgs per channel>\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->nchannels = atoi(argv[3]);
+        ctl->msgs = atoi(argv[4]);
+        ctl->depth = argc > 5 ? atoi(argv[5]) : 1;
+        ctl->arrived = 0;
+        if (ctl->nchannels < 1 || ctl->nchannels > MAX_CHANNELS ||
+                RING_OFFSET + 2 * ctl->nchannels * RING_BYTES > dev.size) {
+            printf("1 to %d channels, and %d KB of shared memory each\n",
+                   MAX_CHANNELS, 2 * RING_BYTES / 1024);
+            exit(-1);
+        }
+        for (i = 0; i < 2 * ctl->nchannels; i++)
+            ivshmem_spsc_init(ring(&dev, i), RING_BYTES, MSG_SIZE);
+        if (ctl->depth < 1 ||
+                ctl->depth > ((struct ivshmem_spsc *)ring(&dev, 0))->nslots) {
+            printf("depth 1 to %u\n", ((struct ivshmem_spsc *)ring(&dev, 0))->nslots);
+            exit(-1);
+        }
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    server = strcmp(argv[2], "server") == 0;
+    if (server)
+        ctl->server_posn = ivshmem_posn(&dev);
+    else
+        ctl->client_posn = ivshmem_posn(&dev);
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < 2)
+        ivshmem_relax();
+
+    if (ivshmem_loop_init(&loop) < 0) {
+        perror("ivshmem_loop_init");
+        exit(-1);
+    }
+
+    /* channel i: requests in ring 2i, responses in ring 2i + 1 */
+    channels = ch = calloc(ctl->nchannels, sizeof(*ch));
+    for (i = 0; i < ctl->nchannels; i++) {
+        ivshmem_spsc_attach(&ch[i].in, ring(&dev, 2 * i + !server),
+                            IVSHMEM_SPSC_CONSUMER, &dev,
+                            server ? ctl->client_posn : ctl->server_posn,
+                            VECTOR, VECTOR);
+        ivshmem_spsc_attach(&ch[i].out, ring(&dev, 2 * i + server),
+                            IVSHMEM_SPSC_PRODUCER, &dev,
+                            server ? ctl->client_posn : ctl->server_posn,
+                            VECTOR, VECTOR);
+        ch[i].src.dev = &dev;
+        ch[i].src.vector = VECTOR;
+        ch[i].src.in = &ch[i].in;
+        ch[i].src.out = &ch[i].out;
+        ch[i].src.cb = server ? echo : reply;
+        ch[i].src.arg = &ch[i];
+        if (ivshmem_loop_add(&loop, &ch[i].src) < 0) {
+            perror("ivshmem_loop_add");
+            exit(-1);
+        }
+    }
+
+    if (server) {
+        /* the client rings STOP_VECTOR when it is done */
+        memset(&stop_src, 0, sizeof(stop_src));
+        stop_src.dev = &dev;
+        stop_src.vector = STOP_VECTOR;
+        stop_src.cb = stop;
+        ivshmem_loop_add(&loop, &stop_src);
+    } else {
+        remaining = (uint64_t)ctl->nchannels * ctl->msgs;
+        for (i = 0; i < ctl->nchannels; i++)
+            while (ch[i].sent < ctl->depth && send_next(&ch[i]))
+                ;
+    }
+
+    start = now_ns();
+    r = ivshmem_loop_run(&loop);
+    elapsed = now_ns() - start;
+    if (r < 0) {
+        printf("loop failed: %s\n", strerror(-r));
+        exit(-1);
+    }
+
+    if (server)
+        printf("[LOOP] server %u channels: %lu rounds, %lu sleeps, "
+               "%lu callbacks\n", ctl->nchannels, loop.rounds, loop.sleeps,
+               loop.calls);
+    else {
+        ivshmem_doorbell(&dev, ctl->server_posn, STOP_VECTOR);
+        for (i = 0; i < ctl->nchannels; i++)
+            doorbells += ch[i].out.doorbells;
+        printf("[LOOP] client %u channels depth %u: %llu round trips in "
+               "%.3f s, %.0f/s, %lu rounds, %lu sleeps, %.3f doorbells/msg\n",
+               ctl->nchannels, ctl->depth,
+               (unsigned long long)ctl->nchannels * ctl->msgs, elapsed / 1e9,
+               (double)ctl->nchannels * ctl->msgs / (elapsed / 1e9),
+               loop.rounds, loop.sleeps,
+               (double)doorbells / ((double)ctl->nchannels * ctl->msgs));
+    }
+
+    ivshmem_loop_destroy(&loop);
+    free(ch);
+    ivshmem_close(&dev);
+
+    return 0;
+}
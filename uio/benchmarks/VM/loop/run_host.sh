@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs loop_bench on the host between two processes joined through
+# ivshmem_server, each serving every channel from one thread, for a range
+# of channel counts and depths.
+#
+#   ./run_host.sh [round trips per run]
+
+BENCH=./build/loop_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/loop_bench.sock
+TOTAL=${1:-200000}
+
+for C in ${CHANNELS:-1 16 128 512}; do
+    for D in ${DEPTHS:-1 8}; do
+        $SERVER -p $SOCK -s loop_bench -m 64 -n 2 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $C $((TOTAL / C)) $D
+        $BENCH $SOCK server > /tmp/loop_bench.out.server &
+        PID=$!
+        $BENCH $SOCK client
+        wait $PID
+        cat /tmp/loop_bench.out.server
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /dev/shm/loop_bench
+    done
+done
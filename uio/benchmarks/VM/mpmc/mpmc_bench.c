@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ivshmem.h"
+#include "ivshmem_mpmc.h"
+
+/*
+ * Scaling benchmark for the MPMC queue.  One "init" run lays out the queue
+ * and says how many producers and consumers will take part; then every
+ * producer and consumer is its own process (in its own VM, or a host peer),
+ * all attached with the vector they sleep on.  Nobody starts timing until
+ * everyone has arrived, and the last producer to finish queues one empty
+ * message per consumer to stop them.
+ *
+ *   mpmc_bench <dev> init <slots> <msg size> <producers> <consumers> <count>
+ *   mpmc_bench <dev> prod|cons [vector]
+ */
+
+#define BENCH_MAGIC 0x42454e43
+#define QUEUE_OFFSET 4096
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t nprod, ncons;
+    uint32_t msg_size;
+    uint64_t count;             /* per producer */
+    uint32_t arrived __attribute__((aligned(64)));
+    uint32_t prod_done __attribute__((aligned(64)));
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void arrive(struct bench_ctl * ctl)
+{
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) <
+                ctl->nprod + ctl->ncons)
+        ;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_mpmc_end end;
+    struct bench_ctl * ctl;
+    uint64_t i, n, start, elapsed, sum = 0;
+    uint32_t len, j;
+    void * cell;
+    int vector;
+
+    if (argc < 3) {
+        printf("USAGE: mpmc_bench <filename> init <slots> <msg size> <producers> <consumers> <count>\n"
+               "       mpmc_bench <filename> prod|cons [vector]\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+        if (argc != 8) {
+            printf("init needs <slots> <msg size> <producers> <consumers> <count>\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->msg_size = atoi(argv[4]);
+        ctl->nprod = atoi(argv[5]);
+        ctl->ncons = atoi(argv[6]);
+        ctl->count = atoll(argv[7]);
+        ctl->arrived = ctl->prod_done = 0;
+        if (ivshmem_mpmc_init((char *)dev.mem + QUEUE_OFFSET,
+                    ivshmem_mpmc_bytes(atoi(argv[3]), ctl->msg_size),
+                    ctl->msg_size) == NULL) {
+            printf("queue does not fit\n");
+            exit(-1);
+        }
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    vector = argc > 3 ? atoi(argv[3]) : 0;
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+        ivshmem_mpmc_attach(&end, (char *)dev.mem + QUEUE_OFFSET, &dev,
+                            vector) < 0) {
+        printf("run init first (%s)\n", strerror(errno));
+        exit(-1);
+    }
+
+    arrive(ctl);
+    start = now_ns();
+    n = 0;
+
+    if (strcmp(argv[2], "prod") == 0) {
+        for (i = 0; i < ctl->count; i++) {
+            while ((cell = ivshmem_mpmc_reserve(&end)) == NULL)
+                ivshmem_mpmc_wait_space(&end);
+            memset(cell, i, ctl->msg_size);
+            ivshmem_mpmc_commit(&end, ctl->msg_size);
+        }
+        n = ctl->count;
+        elapsed = now_ns() - start;
+
+        /* the last producer out stops the consumers */
+        if (__atomic_add_fetch(&ctl->prod_done, 1, __ATOMIC_ACQ_REL) ==
+                ctl->nprod) {
+            for (j = 0; j < ctl->ncons; j++) {
+                while (ivshmem_mpmc_reserve(&end) == NULL)
+                    ivshmem_mpmc_wait_space(&end);
+                ivshmem_mpmc_commit(&end, 0);
+            }
+        }
+    } else {
+        for (;;) {
+            while ((cell = ivshmem_mpmc_claim(&end, &len)) == NULL)
+                ivshmem_mpmc_wait_data(&end);
+            if (len == 0) {
+                ivshmem_mpmc_done(&end);
+                break;
+            }
+            sum += ((uint8_t *)cell)[len - 1];
+            ivshmem_mpmc_done(&end);
+            n++;
+        }
+        elapsed = now_ns() - start;
+    }
+
+    printf("[MPMC] %s posn %d: %llu msgs in %.3f s, %.0f msgs/s, "
+           "%lu sleeps, %lu doorbells (%llx)\n", argv[2], ivshmem_posn(&dev),
+           (unsigned long long)n, elapsed / 1e9, n / (elapsed / 1e9),
+           end.sleeps, end.doorbells, (unsigned long long)sum);
+
+    ivshmem_mpmc_detach(&end);
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs mpmc_bench between host processes joined through ivshmem_server, for
+# every producer/consumer count combination, and prints the aggregate rate.
+#
+#   ./run_host.sh [count per producer] [msg size] [slots]
+
+BENCH=./build/mpmc_bench
+SERVER=../../../../ivshmem-server/ivshmem_server
+SOCK=/tmp/mpmc_bench.sock
+COUNT=${1:-1000000}
+SIZE=${2:-64}
+SLOTS=${3:-1024}
+
+for P in 1 2 4; do
+    for C in 1 2 4; do
+        $SERVER -p $SOCK -s mpmc_bench -m 16 -n 1 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $SLOTS $SIZE $P $C $COUNT
+        PIDS=
+        for i in $(seq $C); do
+            $BENCH $SOCK cons > /tmp/mpmc_cons.$i &
+            PIDS="$PIDS $!"
+        done
+        for i in $(seq $P); do
+            $BENCH $SOCK prod > /dev/null &
+            PIDS="$PIDS $!"
+        done
+        wait $PIDS
+
+        # the slowest consumer bounds the run
+        cat /tmp/mpmc_cons.* | awk -v p=$P -v c=$C -v n=$((P * COUNT)) '
+            { if ($8 > t) t = $8 }
+            END { printf "%d producers %d consumers: %.0f msgs/s\n", p, c, n / t }'
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /tmp/mpmc_cons.* /dev/shm/mpmc_bench
+    done
+done
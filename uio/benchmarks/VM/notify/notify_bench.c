@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "ivshmem.h"
+#include "ivshmem_notify.h"
+
+/*
+ * A sender posting events at a fixed rate to a receiver through
+ * ivshmem_notify, with a given doorbell batch and window.  The sender
+ * reports doorbells (exits) per second and the coalescing ratio; the
+ * receiver reports the latency from post to wakeup.  Latencies compare
+ * clocks of both sides, so they are only meaningful between host
+ * processes or VMs with a shared TSC clocksource.
+ *
+ *   notify_bench <dev> init <events/s> <count>
+ *   notify_bench <dev> recv [spin]
+ *   notify_bench <dev> send <batch> <window us>
+ */
+
+#define BENCH_MAGIC 0x4e4f5442
+#define NOTIFY_OFFSET 4096
+#define STAMP_OFFSET 8192
+#define STAMPS 65536
+#define VECTOR 0
+#define SLEEP_NS 20000          /* sleep rather than spin for longer gaps */
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t rate;
+    uint64_t count;
+    int32_t send_posn;
+    int32_t recv_posn;
+    uint32_t arrived __attribute__((aligned(64)));
+};
+
+static uint64_t now_ns(void)
+{
+    return ivshmem_notify_now();
+}
+
+static int cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void pause_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    if (ns < SLEEP_NS) {
+        ivshmem_relax();
+        return;
+    }
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_notifier s;
+    struct ivshmem_notify_waiter w;
+    struct ivshmem_notify * n;
+    struct bench_ctl * ctl;
+    volatile uint64_t * stamp;
+    uint64_t * lat, seq, start, elapsed, due, t, wakeups = 0;
+    int64_t left;
+    int got, sender;
+
+    if (argc < 3) {
+        printf("USAGE: notify_bench <filename> init <events/s> <count>\n"
+               "       notify_bench <filename> recv [spin]\n"
+               "       notify_bench <filename> send <batch> <window us>\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+    n = (struct ivshmem_notify *)((char *)dev.mem + NOTIFY_OFFSET);
+    stamp = (uint64_t *)((char *)dev.mem + STAMP_OFFSET);
+
+    if (strcmp(argv[2], "init") == 0) {
+        if (argc != 5) {
+            printf("init needs <events/s> <count>\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->rate = atoi(argv[3]);
+        ctl->count = atoll(argv[4]);
+        ctl->arrived = 0;
+        ivshmem_notify_init(n);
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    sender = strcmp(argv[2], "send") == 0;
+    if (sender && argc != 5) {
+        printf("send needs <batch> <window us>\n");
+        exit(-1);
+    }
+    if (sender)
+        ctl->send_posn = ivshmem_posn(&dev);
+    else {
+        /* before the sender can post anything */
+        ivshmem_notify_attach_waiter(&w, n, &dev, VECTOR);
+        ctl->recv_posn = ivshmem_posn(&dev);
+    }
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < 2)
+        ivshmem_relax();
+
+    if (sender) {
+        ivshmem_notify_attach_sender(&s, n, &dev, ctl->recv_posn, VECTOR,
+                                     atoi(argv[3]), atoll(argv[4]) * 1000);
+
+        start = now_ns();
+        for (seq = 0; seq < ctl->count; ) {
+            t = now_ns();
+            due = start + seq * 1000000000ull / ctl->rate;
+            if (t < due) {
+                /* the window may run out before the next event is due */
+                left = ivshmem_notify_poll(&s);
+                pause_ns(left >= 0 && left < due - t ? left : due - t);
+                continue;
+            }
+            stamp[seq % STAMPS] = t;
+            ivshmem_notify_post(&s, 1);
+            seq++;
+        }
+        ivshmem_notify_flush(&s);
+        elapsed = now_ns() - start;
+
+        printf("[NOTIFY] send batch %u window %llu us at %u/s: %lu events, "
+               "%lu doorbells, %.0f doorbells/s, %.1f events/doorbell, "
+               "%lu kicks skipped\n", s.batch,
+               (unsigned long long)s.window_ns / 1000, ctl->rate, s.posts,
+               s.doorbells, s.doorbells / (elapsed / 1e9),
+               ivshmem_notify_ratio(&s), s.kicks - s.doorbells);
+    } else {
+        if (argc > 3)
+            w.spin = atoi(argv[3]);
+        lat = malloc(ctl->count * sizeof(*lat));
+
+        for (seq = 0; seq < ctl->count; ) {
+            if ((got = ivshmem_notify_wait(&w)) < 0) {
+                perror("ivshmem_notify_wait");
+                exit(-1);
+            }
+            t = now_ns();
+            wakeups++;
+            while (got-- && seq < ctl->count) {
+                lat[seq] = t - stamp[seq % STAMPS];
+                seq++;
+            }
+        }
+
+        qsort(lat, ctl->count, sizeof(*lat), cmp_u64);
+        printf("[NOTIFY] recv: %llu events in %lu wakeups, %lu sleeps, "
+               "latency us p50 %.1f p99 %.1f max %.1f\n",
+               (unsigned long long)ctl->count, wakeups, w.sleeps,
+               lat[ctl->count / 2] / 1e3, lat[ctl->count * 99 / 100] / 1e3,
+               lat[ctl->count - 1] / 1e3);
+        free(lat);
+    }
+
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs notify_bench on the host between two processes joined through
+# ivshmem_server, sweeping the doorbell batch and window at a fixed event
+# rate.
+#
+#   ./run_host.sh [events/s] [count]
+
+BENCH=./build/notify_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/notify_bench.sock
+RATE=${1:-50000}
+COUNT=${2:-50000}
+
+echo "batch window_us doorbells/s events/doorbell p50_us p99_us"
+for B in ${BATCHES:-1 4 16 64}; do
+    for W in ${WINDOWS:-0 20 100 500}; do
+        $SERVER -p $SOCK -s notify_bench -m 4 -n 1 > /dev/null &
+        SRV=$!
+        sleep 0.2
+
+        $BENCH $SOCK init $RATE $COUNT
+        # let the server finish with init leaving before the others join
+        sleep 0.1
+        $BENCH $SOCK recv > /tmp/notify_bench.out.recv &
+        PID=$!
+        $BENCH $SOCK send $B $W > /tmp/notify_bench.out.send
+        wait $PID
+
+        S=$(awk '{ print $14, $16 }' /tmp/notify_bench.out.send)
+        R=$(awk '{ print $13, $15 }' /tmp/notify_bench.out.recv)
+        echo "$B $W $S $R"
+
+        kill $SRV
+        wait $SRV 2>/dev/null
+        rm -f /dev/shm/notify_bench
+    done
+done
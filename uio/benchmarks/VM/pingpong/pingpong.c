@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "ivshmem.h"
+#include "ivshmem_notify.h"
+
+/*
+ * Round-trip latency between two peers.  The client writes a message of
+ * the given size into the ping area and the server copies it back into
+ * the pong area, once per round trip, for every wake mode and size given
+ * at init:
+ *
+ *   irq     the writer rings a doorbell for every message and the reader
+ *           blocks in ivshmem_wait()
+ *   poll    the reader spins on a sequence number, nobody rings
+ *   hybrid  ivshmem_notify: the reader spins for a while, then sleeps,
+ *           and the writer rings only a reader that is asleep
+ *
+ * Each round trip is recorded in a log-linear histogram, HDR style, with
+ * under 1% error at any magnitude.  The client prints a JSON array with
+ * one object per (mode, size) on stdout and a summary line per run on
+ * stderr.  Both sides can be pinned to a CPU.
+ *
+ *   pingpong <dev> init <round trips> [sizes] [modes] [spin]
+ *   pingpong <dev> server [cpu]
+ *   pingpong <dev> client [cpu]
+ *
+ * sizes and modes are comma separated, e.g. 64,4096 and irq,hybrid.
+ */
+
+#define BENCH_MAGIC 0x50494e47
+#define LANE_OFFSET 4096        /* ping lane, pong lane a page later */
+#define DATA_OFFSET (1 << 20)   /* ping data, pong data MAX_SIZE later */
+#define MAX_SIZE (1 << 20)
+#define MAX_RUNS 16
+#define VECTOR 0
+
+#define SUB_BITS 7              /* 128 buckets per power of two */
+#define SUB (1 << SUB_BITS)
+#define NBUCKETS ((65 - SUB_BITS) * SUB)
+
+enum { MODE_IRQ, MODE_POLL, MODE_HYBRID, NMODES };
+static const char * mode_names[NMODES] = { "irq", "poll", "hybrid" };
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t iters;
+    uint32_t warmup;
+    uint32_t spin;
+    uint32_t nsizes;
+    uint32_t nmodes;
+    uint32_t sizes[MAX_RUNS];
+    uint32_t modes[NMODES];
+    int32_t server_posn;
+    int32_t client_posn;
+    uint32_t arrived __attribute__((aligned(64)));
+};
+
+/* one direction */
+struct lane {
+    uint32_t seq __attribute__((aligned(64)));
+    uint32_t len;
+    struct ivshmem_notify n;
+};
+
+struct end {
+    struct ivshmem_dev * dev;
+    int peer;
+    struct lane * out;
+    struct lane * in;
+    char * out_data;
+    char * in_data;
+    uint32_t sent;
+    uint32_t seen;
+    struct ivshmem_notifier s;
+    struct ivshmem_notify_waiter w;
+};
+
+struct hist {
+    uint64_t count[NBUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Values below 2 * SUB get a bucket each.  Above that, each power of two
+ * is cut into SUB buckets, so a bucket is never wider than 1/SUB of what
+ * it holds.
+ */
+static int hist_index(uint64_t v)
+{
+    int shift;
+
+    if (v < 2 * SUB)
+        return v;
+    shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return (shift + 1) * SUB + (int)(v >> shift) - SUB;
+}
+
+/* the highest value that lands in bucket i */
+static uint64_t hist_value(int i)
+{
+    int shift;
+
+    if (i < 2 * SUB)
+        return i;
+    shift = i / SUB - 1;
+    return ((uint64_t)(i % SUB + SUB + 1) << shift) - 1;
+}
+
+static void hist_record(struct hist * h, uint64_t v)
+{
+    h->count[hist_index(v)]++;
+    h->total++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t hist_percentile(const struct hist * h, double p)
+{
+    uint64_t want = (uint64_t)(p / 100 * h->total + 0.5), seen = 0;
+    int i;
+
+    if (want < 1)
+        want = 1;
+    for (i = 0; i < NBUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= want)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+static void pin(const char * arg)
+{
+    cpu_set_t set;
+    int cpu = atoi(arg);
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("sched_setaffinity");
+        exit(-1);
+    }
+}
+
+static int parse_list(char * arg, uint32_t * out, int max, int modes)
+{
+    char * tok;
+    int n = 0, m;
+
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == max)
+            return -1;
+        if (!modes) {
+            out[n++] = atoi(tok);
+            continue;
+        }
+        for (m = 0; m < NMODES && strcmp(tok, mode_names[m]); m++)
+            ;
+        if (m == NMODES)
+            return -1;
+        out[n++] = m;
+    }
+
+    return n;
+}
+
+static void post(struct end * e, int mode, uint32_t len)
+{
+    e->out->len = len;
+    if (mode == MODE_HYBRID) {
+        ivshmem_notify_post(&e->s, 1);
+        return;
+    }
+    __atomic_store_n(&e->out->seq, ++e->sent, __ATOMIC_RELEASE);
+    if (mode == MODE_IRQ)
+        ivshmem_doorbell(e->dev, e->peer, VECTOR);
+}
+
+/* wait for the next message and return its length */
+static uint32_t receive(struct end * e, int mode)
+{
+    uint32_t seq;
+
+    switch (mode) {
+    case MODE_HYBRID:
+        if (ivshmem_notify_wait(&e->w) < 0) {
+            perror("ivshmem_notify_wait");
+            exit(-1);
+        }
+        break;
+    case MODE_IRQ:
+        /* a doorbell left over from a hybrid run wakes us early */
+        while ((seq = __atomic_load_n(&e->in->seq, __ATOMIC_ACQUIRE)) == e->seen)
+            if (ivshmem_wait(e->dev, VECTOR) < 0) {
+                perror("ivshmem_wait");
+                exit(-1);
+            }
+        e->seen = seq;
+        break;
+    default:
+        while ((seq = __atomic_load_n(&e->in->seq, __ATOMIC_ACQUIRE)) == e->seen)
+            ivshmem_relax();
+        e->seen = seq;
+    }
+
+    return e->in->len;
+}
+
+static void print_run(const struct hist * h, int first, int mode, uint32_t size,
+                      unsigned long doorbells, unsigned long sleeps)
+{
+    int i;
+
+    printf("%s  {\"mode\": \"%s\", \"size\": %u, \"round_trips\": %llu, "
+           "\"doorbells\": %lu, \"sleeps\": %lu,\n"
+           "   \"min_ns\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, "
+           "\"p90_ns\": %llu, \"p99_ns\": %llu, \"p99_9_ns\": %llu, "
+           "\"p99_99_ns\": %llu, \"max_ns\": %llu,\n"
+           "   \"histogram\": [", first ? "" : ",\n", mode_names[mode], size,
+           (unsigned long long)h->total, doorbells, sleeps,
+           (unsigned long long)h->min, (double)h->sum / h->total,
+           (unsigned long long)hist_percentile(h, 50),
+           (unsigned long long)hist_percentile(h, 90),
+           (unsigned long long)hist_percentile(h, 99),
+           (unsigned long long)hist_percentile(h, 99.9),
+           (unsigned long long)hist_percentile(h, 99.99),
+           (unsigned long long)h->max);
+
+    /* [highest ns in bucket, count] for the buckets in use */
+    for (first = 1, i = 0; i < NBUCKETS; i++) {
+        if (!h->count[i])
+            continue;
+        printf("%s[%llu, %llu]", first ? "" : ", ",
+               (unsigned long long)hist_value(i), (unsigned long long)h->count[i]);
+        first = 0;
+    }
+    printf("]}");
+    fflush(stdout);
+
+    fprintf(stderr, "[PINGPONG] %-6s %7u bytes: %llu round trips, ns p50 %llu "
+            "p99 %llu p99.9 %llu max %llu, %lu doorbells\n", mode_names[mode],
+            size, (unsigned long long)h->total,
+            (unsigned long long)hist_percentile(h, 50),
+            (unsigned long long)hist_percentile(h, 99),
+            (unsigned long long)hist_percentile(h, 99.9),
+            (unsigned long long)h->max, doorbells);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct bench_ctl * ctl;
+    struct lane * lane[2];
+    struct end e;
+    struct hist * h;
+    char * buf;
+    uint64_t t;
+    uint32_t i, len, size, msg = 0;
+    unsigned long doorbells, sleeps;
+    int m, r, mode, server;
+
+    if (argc < 3) {
+        printf("USAGE: pingpong <filename> init <round trips> [sizes] [modes] [spin]\n"
+               "       pingpong <filename> server|client [cpu]\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+    lane[0] = (struct lane *)((char *)dev.mem + LANE_OFFSET);
+    lane[1] = (struct lane *)((char *)dev.mem + LANE_OFFSET + 4096);
+
+    if (strcmp(argv[2], "init") == 0) {
+        char sizes[] = "8,64,512,4096,65536", modes[] = "irq,poll,hybrid";
+
+        if (argc < 4) {
+            printf("init needs <round trips>\n");
+            exit(-1);
+        }
+        if (dev.size < DATA_OFFSET + 2 * MAX_SIZE) {
+            printf("need %d MB of shared memory\n", (DATA_OFFSET + 2 * MAX_SIZE) >> 20);
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->iters = atoi(argv[3]);
+        ctl->warmup = ctl->iters / 10;
+        r = parse_list(argc > 4 ? argv[4] : sizes, ctl->sizes, MAX_RUNS, 0);
+        if (r < 0) {
+            printf("at most %d sizes\n", MAX_RUNS);
+            exit(-1);
+        }
+        ctl->nsizes = r;
+        r = parse_list(argc > 5 ? argv[5] : modes, ctl->modes, NMODES, 1);
+        if (r < 0) {
+            printf("modes are irq, poll and hybrid\n");
+            exit(-1);
+        }
+        ctl->nmodes = r;
+        ctl->spin = argc > 6 ? atoi(argv[6]) : IVSHMEM_NOTIFY_SPIN;
+        ctl->arrived = 0;
+        for (i = 0; i < ctl->nsizes; i++)
+            if (ctl->sizes[i] < sizeof(uint32_t) || ctl->sizes[i] > MAX_SIZE) {
+                printf("sizes %zu to %d\n", sizeof(uint32_t), MAX_SIZE);
+                exit(-1);
+            }
+        if (ctl->iters < 1 || ctl->nsizes < 1 || ctl->nmodes < 1) {
+            printf("nothing to do\n");
+            exit(-1);
+        }
+        for (i = 0; i < 2; i++) {
+            lane[i]->seq = 0;
+            ivshmem_notify_init(&lane[i]->n);
+        }
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    if (argc > 3)
+        pin(argv[3]);
+
+    /* the client pings on lane 0, the server pongs on lane 1 */
+    server = strcmp(argv[2], "server") == 0;
+    memset(&e, 0, sizeof(e));
+    e.dev = &dev;
+    e.out = lane[server];
+    e.in = lane[!server];
+    e.out_data = (char *)dev.mem + DATA_OFFSET + server * MAX_SIZE;
+    e.in_data = (char *)dev.mem + DATA_OFFSET + !server * MAX_SIZE;
+    /* before the other side can post anything */
+    ivshmem_notify_attach_waiter(&e.w, &e.in->n, &dev, VECTOR);
+    e.w.spin = ctl->spin;
+    if (server)
+        ctl->server_posn = ivshmem_posn(&dev);
+    else
+        ctl->client_posn = ivshmem_posn(&dev);
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < 2)
+        ivshmem_relax();
+
+    e.peer = server ? ctl->client_posn : ctl->server_posn;
+    ivshmem_notify_attach_sender(&e.s, &e.out->n, &dev, e.peer, VECTOR, 1, 0);
+
+    buf = malloc(MAX_SIZE);
+    h = malloc(sizeof(*h));
+    if (!server)
+        printf("[\n");
+
+    for (m = 0; m < ctl->nmodes; m++) {
+        mode = ctl->modes[m];
+        for (r = 0; r < ctl->nsizes; r++) {
+            size = ctl->sizes[r];
+            memset(h, 0, sizeof(*h));
+            h->min = UINT64_MAX;
+            doorbells = e.s.doorbells;
+            sleeps = e.w.sleeps;
+
+            for (i = 0; i < ctl->warmup + ctl->iters; i++) {
+                if (server) {
+                    len = receive(&e, mode);
+                    memcpy(e.out_data, e.in_data, len);
+                    post(&e, mode, len);
+                    continue;
+                }
+
+                t = now_ns();
+                memset(buf, 0, size);
+                *(uint32_t *)buf = ++msg;
+                memcpy(e.out_data, buf, size);
+                post(&e, mode, size);
+                len = receive(&e, mode);
+                memcpy(buf, e.in_data, len);
+                t = now_ns() - t;
+
+                if (len != size || *(uint32_t *)buf != msg) {
+                    fprintf(stderr, "round trip %u: got %u bytes of %u, "
+                            "expected %u bytes of %u\n", msg, len,
+                            *(uint32_t *)buf, size, msg);
+                    exit(-1);
+                }
+                if (i >= ctl->warmup)
+                    hist_record(h, t);
+                if (i + 1 == ctl->warmup) {
+                    doorbells = e.s.doorbells;
+                    sleeps = e.w.sleeps;
+                }
+            }
+
+            if (!server)
+                print_run(h, m == 0 && r == 0, mode, size,
+                          mode == MODE_IRQ ? ctl->iters :
+                                  e.s.doorbells - doorbells,
+                          e.w.sleeps - sleeps);
+        }
+    }
+
+    if (!server)
+        printf("\n]\n");
+    free(h);
+    free(buf);
+    ivshmem_close(&dev);
+
+    return 0;
+}
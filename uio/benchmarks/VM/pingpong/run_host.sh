@@ -0,0 +1,27 @@
+#!/bin/sh
+# Runs pingpong on the host between two processes joined through
+# ivshmem_server, for every wake mode and size, and leaves the JSON in
+# /tmp/pingpong.json.
+#
+#   ./run_host.sh [round trips] [server cpu] [client cpu]
+
+BENCH=./build/pingpong
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/pingpong.sock
+COUNT=${1:-1000000}
+
+$SERVER -p $SOCK -s pingpong -m 4 -n 1 > /dev/null &
+SRV=$!
+sleep 0.2
+
+$BENCH $SOCK init $COUNT ${SIZES:-8,64,512,4096,65536} ${MODES:-irq,poll,hybrid}
+# let the server finish with init leaving before the others join
+sleep 0.1
+$BENCH $SOCK server ${2:--1} &
+PID=$!
+$BENCH $SOCK client ${3:--1} > /tmp/pingpong.json
+wait $PID
+
+kill $SRV
+wait $SRV 2>/dev/null
+rm -f /dev/shm/pingpong
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "ivshmem.h"
+#include "ivshmem_rpc.h"
+
+/*
+ * Round trips of an echo call, over ivshmem RPC rings and, for comparison,
+ * over loopback TCP with the same framing.  The client keeps depth calls
+ * in flight and times each one from send to response.
+ *
+ *   rpc_bench <dev> server <clients> <workers>
+ *   rpc_bench <dev> client <calls> <size> [depth]
+ *   rpc_bench tcp-server <port>
+ *   rpc_bench tcp-client <port> <calls> <size> [depth]
+ *
+ * Servers run until interrupted.
+ */
+
+#define NVECTORS 4              /* ivshmem_server -n must match */
+#define RING_BYTES (256 * 1024)
+#define MAX_MSG 4096
+#define METHOD_ECHO 1
+#define VECTOR 0
+
+static volatile sig_atomic_t done;
+
+static void on_signal(int sig)
+{
+    done = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char * how, uint32_t size, int depth, uint64_t * rtt,
+                   uint64_t n, uint64_t elapsed, uint64_t bad)
+{
+    qsort(rtt, n, sizeof(*rtt), cmp_u64);
+    printf("[RPC] %s size %u depth %d: %llu calls in %.3f s, %.0f calls/s, "
+           "rtt us p50 %.2f p99 %.2f p99.9 %.2f max %.2f, %llu bad\n",
+           how, size, depth, (unsigned long long)n, elapsed / 1e9,
+           n / (elapsed / 1e9), rtt[n / 2] / 1e3, rtt[n * 99 / 100] / 1e3,
+           rtt[n * 999 / 1000] / 1e3, rtt[n - 1] / 1e3,
+           (unsigned long long)bad);
+}
+
+static int echo(void * arg, uint16_t method, const void * req, uint32_t len,
+                void * resp, uint32_t max)
+{
+    if (method != METHOD_ECHO)
+        return -ENOSYS;
+    if (len > max)
+        return -EMSGSIZE;
+    memcpy(resp, req, len);
+    return len;
+}
+
+static void run_server(const char * path, int nclients, int nworkers)
+{
+
+    static struct ivshmem_rpc_server s;
+    int t;
+
+    if (ivshmem_rpc_server_start(&s, path, 0, 0, nclients, nworkers,
+                                 RING_BYTES, MAX_MSG, echo, NULL) < 0) {
+        perror("ivshmem_rpc_server_start");
+        exit(-1);
+    }
+    printf("[RPC] serving %d clients with %d workers\n", nclients, nworkers);
+    fflush(stdout);
+
+    while (!done)
+        pause();
+
+    ivshmem_rpc_server_stop(&s);
+    for (t = 0; t < nworkers; t++)
+        printf("[RPC] worker %d: %lu calls, %lu sleeps\n", t,
+               s.worker[t].calls, s.worker[t].sleeps);
+}
+
+static void run_client(const char * path, uint64_t calls, uint32_t size,
+                       int depth)
+{
+
+    struct ivshmem_dev dev;
+    struct ivshmem_rpc_client c;
+    uint64_t * sent, * rtt, n, next = 0, bad = 0, start;
+    uint8_t * req, * resp;
+    uint32_t id;
+    int len;
+
+    if (ivshmem_open(&dev, path, 0, NVECTORS) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    while (ivshmem_rpc_connect(&c, dev.mem, &dev, VECTOR) < 0) {
+        if (errno != EAGAIN) {
+            perror("ivshmem_rpc_connect");
+            exit(-1);
+        }
+        usleep(1000);
+    }
+    if (size < sizeof(uint64_t) || size > ivshmem_rpc_max_payload(&c) ||
+            depth < 1 || depth > ivshmem_rpc_window(&c)) {
+        printf("size 8 to %u, depth 1 to %u\n", ivshmem_rpc_max_payload(&c),
+               ivshmem_rpc_window(&c));
+        exit(-1);
+    }
+
+    sent = calloc(depth, sizeof(*sent));
+    rtt = malloc(calls * sizeof(*rtt));
+    req = calloc(1, size);
+    resp = malloc(size);
+
+    start = now_ns();
+    for (n = 0; n < calls; n++) {
+        /* top the window up, then take the oldest response */
+        while (next < calls && next - n < depth) {
+            memcpy(req, &next, sizeof(next));
+            sent[next % depth] = now_ns();
+            if (ivshmem_rpc_send(&c, METHOD_ECHO, req, size,
+                                 next + 1 == calls || next - n + 1 == depth) < 0) {
+                perror("ivshmem_rpc_send");
+                exit(-1);
+            }
+            next++;
+        }
+        if ((len = ivshmem_rpc_recv(&c, &id, resp, size)) < 0) {
+            perror("ivshmem_rpc_recv");
+            exit(-1);
+        }
+        rtt[n] = now_ns() - sent[n % depth];
+        bad += len != size || id != (uint32_t)n ||
+               memcmp(resp, &n, sizeof(n)) != 0;
+    }
+
+    report("shm", size, depth, rtt, calls, now_ns() - start, bad);
+
+    ivshmem_rpc_disconnect(&c);
+    free(sent);
+    free(rtt);
+    free(req);
+    free(resp);
+    ivshmem_close(&dev);
+}
+
+/* TCP frames are the same header preceded by the payload length */
+struct tcp_frame {
+    uint32_t len;
+    struct ivshmem_rpc_hdr hdr;
+};
+
+static int read_full(int fd, void * buf, size_t len)
+{
+
+    char * p = buf;
+    ssize_t r;
+
+    while (len) {
+        if ((r = read(fd, p, len)) <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void * buf, size_t len)
+{
+
+    const char * p = buf;
+    ssize_t r;
+
+    while (len) {
+        if ((r = write(fd, p, len)) <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static void nodelay(int fd)
+{
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static void * tcp_conn(void * arg)
+{
+
+    int fd = (long)arg;
+    struct tcp_frame * f = malloc(sizeof(*f) + MAX_MSG);
+    int r;
+
+    while (read_full(fd, f, sizeof(*f)) == 0 && f->len <= MAX_MSG &&
+           read_full(fd, f->hdr.data, f->len) == 0) {
+        /* echo in place, like the shm handler writing its response slot */
+        r = echo(NULL, f->hdr.method, f->hdr.data, f->len, f->hdr.data,
+                 MAX_MSG);
+        f->hdr.status = r < 0 ? -r : 0;
+        f->len = r < 0 ? 0 : r;
+        if (write_full(fd, f, sizeof(*f) + f->len) < 0)
+            break;
+    }
+
+    free(f);
+    close(fd);
+    return NULL;
+}
+
+static void run_tcp_server(int port)
+{
+
+    struct sockaddr_in addr;
+    pthread_t thread;
+    int fd, conn, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(fd, 64) < 0) {
+        perror("bind");
+        exit(-1);
+    }
+    printf("[RPC] serving TCP on port %d\n", port);
+    fflush(stdout);
+
+    while (!done) {
+        if ((conn = accept(fd, NULL, NULL)) < 0)
+            continue;
+        nodelay(conn);
+        pthread_create(&thread, NULL, tcp_conn, (void *)(long)conn);
+        pthread_detach(thread);
+    }
+    close(fd);
+}
+
+static void run_tcp_client(int port, uint64_t calls, uint32_t size, int depth)
+{
+
+    struct sockaddr_in addr;
+    struct tcp_frame * f = calloc(1, sizeof(*f) + size);
+    uint64_t * sent, * rtt, n, next = 0, bad = 0, start;
+    int fd;
+
+    if (size < sizeof(uint64_t) || size > MAX_MSG || depth < 1) {
+        printf("size 8 to %d, depth at least 1\n", MAX_MSG);
+        exit(-1);
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(-1);
+    }
+    nodelay(fd);
+
+    sent = calloc(depth, sizeof(*sent));
+    rtt = malloc(calls * sizeof(*rtt));
+
+    start = now_ns();
+    for (n = 0; n < calls; n++) {
+        while (next < calls && next - n < depth) {
+            f->len = size;
+            f->hdr.id = next;
+            f->hdr.method = METHOD_ECHO;
+            f->hdr.status = 0;
+            memcpy(f->hdr.data, &next, sizeof(next));
+            sent[next % depth] = now_ns();
+            if (write_full(fd, f, sizeof(*f) + size) < 0) {
+                perror("write");
+                exit(-1);
+            }
+            next++;
+        }
+        if (read_full(fd, f, sizeof(*f)) < 0 || f->len > size ||
+                read_full(fd, f->hdr.data, f->len) < 0) {
+            perror("read");
+            exit(-1);
+        }
+        rtt[n] = now_ns() - sent[n % depth];
+        bad += f->len != size || f->hdr.id != (uint32_t)n ||
+               memcmp(f->hdr.data, &n, sizeof(n)) != 0;
+    }
+
+    report("tcp", size, depth, rtt, calls, now_ns() - start, bad);
+
+    close(fd);
+    free(sent);
+    free(rtt);
+    free(f);
+}
+
+int main(int argc, char ** argv){
+
+    struct sigaction sa;
+
+    if (argc < 3) {
+        printf("USAGE: rpc_bench <filename> server <clients> <workers>\n"
+               "       rpc_bench <filename> client <calls> <size> [depth]\n"
+               "       rpc_bench tcp-server <port>\n"
+               "       rpc_bench tcp-client <port> <calls> <size> [depth]\n");
+        exit(-1);
+    }
+
+    /* no SA_RESTART, so pause() and accept() return on a signal */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (strcmp(argv[1], "tcp-server") == 0)
+        run_tcp_server(atoi(argv[2]));
+    else if (strcmp(argv[1], "tcp-client") == 0 && argc >= 5)
+        run_tcp_client(atoi(argv[2]), atoll(argv[3]), atoi(argv[4]),
+                       argc > 5 ? atoi(argv[5]) : 1);
+    else if (strcmp(argv[2], "server") == 0 && argc == 5) {
+        if (atoi(argv[4]) > NVECTORS) {
+            printf("at most %d workers\n", NVECTORS);
+            exit(-1);
+        }
+        run_server(argv[1], atoi(argv[3]), atoi(argv[4]));
+    } else if (strcmp(argv[2], "client") == 0 && argc >= 5)
+        run_client(argv[1], atoll(argv[3]), atoi(argv[4]),
+                   argc > 5 ? atoi(argv[5]) : 1);
+    else {
+        printf("bad arguments\n");
+        exit(-1);
+    }
+
+    return 0;
+}
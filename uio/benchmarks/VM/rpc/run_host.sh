@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs rpc_bench on the host: echo calls over ivshmem RPC rings between
+# processes joined through ivshmem_server, then the same calls over
+# loopback TCP, at depth 1 and pipelined.
+#
+#   ./run_host.sh [calls] [size]
+
+BENCH=./build/rpc_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/rpc_bench.sock
+PORT=${PORT:-7777}
+CALLS=${1:-100000}
+SIZE=${2:-64}
+
+$SERVER -p $SOCK -s rpc_bench -m 64 -n 4 > /dev/null &
+SRV=$!
+sleep 0.2
+
+$BENCH $SOCK server ${CLIENTS:-4} ${WORKERS:-1} > /tmp/rpc_bench.out.server &
+RPC=$!
+sleep 0.2
+for DEPTH in ${DEPTHS:-1 4 16}; do
+    $BENCH $SOCK client $CALLS $SIZE $DEPTH
+done
+kill $RPC
+wait $RPC
+cat /tmp/rpc_bench.out.server
+
+kill $SRV
+wait $SRV 2>/dev/null
+rm -f /dev/shm/rpc_bench
+
+$BENCH tcp-server $PORT > /dev/null &
+TCP=$!
+sleep 0.2
+for DEPTH in ${DEPTHS:-1 4 16}; do
+    $BENCH tcp-client $PORT $CALLS $SIZE $DEPTH
+done
+kill $TCP
+wait $TCP 2>/dev/null
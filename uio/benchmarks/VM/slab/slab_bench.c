@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ivshmem.h"
+#include "ivshmem_slab.h"
+
+/*
+ * Allocation throughput of the shared slab allocator with several peers
+ * hammering it at once.  "init" lays out the heap and says how many peers
+ * will run; each peer then allocates a batch of randomly sized objects,
+ * touches them and frees them again, <rounds> times over.
+ *
+ * In "local" mode every peer frees its own objects.  In "shared" mode each
+ * object is swapped into a random slot of a table in the region and the
+ * object found there is freed instead, so most frees are of memory another
+ * peer allocated.
+ *
+ *   slab_bench <dev> init <heap MB> <peers>
+ *   slab_bench <dev> local|shared <rounds> <min size> <max size> [batch]
+ */
+
+#define BENCH_MAGIC 0x534c4253
+#define HEAP_OFFSET 65536
+#define NSWAP 1024
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t npeers;
+    uint32_t arrived __attribute__((aligned(64)));
+    ivshmem_slab_t swap[NSWAP] __attribute__((aligned(64)));
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t * s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    struct ivshmem_slab_cache cache;
+    struct ivshmem_slab * heap;
+    struct bench_ctl * ctl;
+    ivshmem_slab_t * batch, h;
+    uint32_t seed, minsz, maxsz, size;
+    uint64_t start, elapsed, ops = 0;
+    long rounds, r, nbatch = 64, i;
+    int shared;
+
+    if (argc < 4) {
+        printf("USAGE: slab_bench <filename> init <heap MB> <peers>\n"
+               "       slab_bench <filename> local|shared <rounds> <min size> <max size> [batch]\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+    heap = (struct ivshmem_slab *)((char *)dev.mem + HEAP_OFFSET);
+
+    if (strcmp(argv[2], "init") == 0) {
+        size_t bytes = (size_t)atoi(argv[3]) << 20;
+
+        if (argc != 5 || bytes + HEAP_OFFSET > dev.size ||
+                ivshmem_slab_init(heap, bytes) == NULL) {
+            printf("heap does not fit\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->npeers = atoi(argv[4]);
+        ctl->arrived = 0;
+        memset(ctl->swap, 0, sizeof(ctl->swap));
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        printf("[SLAB] %u chunks of %d KB\n", heap->nchunks,
+               IVSHMEM_SLAB_CHUNK / 1024);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (argc < 6) {
+        printf("local|shared need <rounds> <min size> <max size>\n");
+        exit(-1);
+    }
+    shared = strcmp(argv[2], "shared") == 0;
+    rounds = atol(argv[3]);
+    minsz = atoi(argv[4]);
+    maxsz = atoi(argv[5]);
+    if (argc > 6)
+        nbatch = atol(argv[6]);
+    if (minsz == 0 || maxsz < minsz || maxsz > IVSHMEM_SLAB_MAX_SIZE) {
+        printf("sizes must be within 1..%u\n", IVSHMEM_SLAB_MAX_SIZE);
+        exit(-1);
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC ||
+        ivshmem_slab_attach(&cache, heap) < 0) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    batch = malloc(nbatch * sizeof(*batch));
+    seed = 2463534242u + ivshmem_posn(&dev);
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < ctl->npeers)
+        ;
+
+    start = now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < nbatch; i++) {
+            size = minsz + xorshift(&seed) % (maxsz - minsz + 1);
+            if ((batch[i] = ivshmem_slab_alloc(&cache, size)) == 0) {
+                printf("alloc of %u failed: %s\n", size, strerror(errno));
+                exit(-1);
+            }
+            *(uint32_t *)ivshmem_slab_ptr(heap, batch[i]) = size;
+        }
+        for (i = 0; i < nbatch; i++) {
+            h = batch[i];
+            if (shared)
+                h = __atomic_exchange_n(&ctl->swap[xorshift(&seed) % NSWAP],
+                                        h, __ATOMIC_ACQ_REL);
+            ivshmem_slab_free(&cache, h);
+        }
+        ops += nbatch;
+    }
+    elapsed = now_ns() - start;
+
+    printf("[SLAB] %s posn %d: %llu alloc+free in %.3f s, %.1f M/s, "
+           "%.4f depot trips/op, %lu chunks carved\n", argv[2],
+           ivshmem_posn(&dev), (unsigned long long)ops, elapsed / 1e9,
+           ops / (elapsed / 1e3), (double)(cache.depot_gets + cache.depot_puts) / ops,
+           cache.chunks);
+
+    ivshmem_slab_detach(&cache);
+    free(batch);
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Runs stream_bench on the host between two processes joined through
+# ivshmem_server, for each thread count, every copy routine and size.
+#
+#   ./run_host.sh [MB per thread] [first send cpu] [first recv cpu]
+
+BENCH=./build/stream_bench
+SERVER=${SERVER:-../../../../ivshmem-server/ivshmem_server}
+SOCK=/tmp/stream_bench.sock
+MB=${1:-256}
+
+for T in ${THREADS:-1 2 4}; do
+    $SERVER -p $SOCK -s stream_bench -m ${REGION_MB:-256} -n 1 > /dev/null &
+    SRV=$!
+    sleep 0.2
+
+    $BENCH $SOCK init $T $MB ${SIZES:-64,256,1K,4K,16K,64K,256K,1M,4M,16M} \
+        ${COPIES:-libc,movsb,nt,word}
+    # let the server finish with init leaving before the others join
+    sleep 0.1
+    $BENCH $SOCK send ${2:--1} &
+    PID=$!
+    $BENCH $SOCK recv ${3:--1}
+    wait $PID
+
+    kill $SRV
+    wait $SRV 2>/dev/null
+    rm -f /dev/shm/stream_bench
+done
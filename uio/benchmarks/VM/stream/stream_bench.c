@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+
+/*
+ * Streaming bandwidth through the region.  Each of the sender's threads
+ * copies messages into an SPSC ring of its own, and the receiver's
+ * thread with the same index copies them out again.  Both sides poll; no
+ * doorbells are involved.  One run per copy routine and message size,
+ * each printing GB/s and CPU cycles per byte on either side:
+ *
+ *   libc    memcpy()
+ *   movsb   rep movsb (x86)
+ *   nt      SSE2 non-temporal stores, bypassing the cache (x86)
+ *   word    one 8-byte load and store at a time, which is what an
+ *           uncached mapping is limited to
+ *
+ *   stream_bench <dev> init <threads> <MB per thread> [sizes] [copies]
+ *   stream_bench <dev> send|recv [first cpu]
+ *
+ * sizes take K and M suffixes, e.g. 64,4K,16M.  With a first cpu, thread
+ * i is pinned to first cpu + i.
+ */
+
+#define BENCH_MAGIC 0x5354524d
+#define RING_OFFSET 4096
+#define MAX_THREADS 64
+#define MAX_RUNS 32
+#define MIN_MSGS 4
+
+enum { COPY_LIBC, COPY_MOVSB, COPY_NT, COPY_WORD, NCOPIES };
+static const char * copy_names[NCOPIES] = { "libc", "movsb", "nt", "word" };
+
+struct bench_ctl {
+    uint32_t magic;
+    uint32_t nthreads;
+    uint64_t bytes;             /* per thread and run */
+    uint32_t nsizes;
+    uint32_t ncopies;
+    uint32_t sizes[MAX_RUNS];
+    uint32_t copies[NCOPIES];
+    int32_t send_posn;
+    int32_t recv_posn;
+    uint32_t arrived __attribute__((aligned(64)));
+    uint32_t ready __attribute__((aligned(64)));    /* runs laid out */
+    uint32_t sent;              /* runs the sender has finished */
+    uint64_t send_cycles;       /* ... and what the last one cost */
+    uint32_t done __attribute__((aligned(64)));     /* runs received */
+};
+
+struct worker {
+    pthread_t thread;
+    int cpu;
+    struct ivshmem_spsc_end end;
+    char * buf;
+    uint32_t size;
+    uint64_t msgs;
+    int copy;
+    uint64_t start;
+    uint64_t end_ns;
+    uint64_t cycles;
+};
+
+static struct ivshmem_dev dev;
+static struct bench_ctl * ctl;
+static size_t ring_bytes;
+static int sender;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* TSC cycles; elsewhere ns stand in for them */
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static void copy_word(void * dst, const void * src, size_t n)
+{
+    volatile uint64_t * d = dst;
+    const volatile uint64_t * s = src;
+    size_t i;
+
+    for (i = 0; i < n / 8; i++)
+        d[i] = s[i];
+    memcpy((char *)dst + (n & ~7ul), (const char *)src + (n & ~7ul), n & 7);
+}
+
+#if defined(__x86_64__)
+static void copy_movsb(void * dst, const void * src, size_t n)
+{
+    __asm__ __volatile__("rep movsb"
+                         : "+D" (dst), "+S" (src), "+c" (n) : : "memory");
+}
+
+static void copy_nt(void * dst, const void * src, size_t n)
+{
+    char * d = dst;
+    const char * s = src;
+    size_t head = -(uintptr_t)d & 15;
+
+    if (head > n)
+        head = n;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    memcpy(d, s, n);
+    /* streaming stores are weakly ordered: drain them before publishing */
+    _mm_sfence();
+}
+#endif
+
+static int copy_available(int copy)
+{
+#if defined(__x86_64__)
+    return 1;
+#else
+    return copy == COPY_LIBC || copy == COPY_WORD;
+#endif
+}
+
+static void copy(int how, void * dst, const void * src, size_t n)
+{
+    switch (how) {
+#if defined(__x86_64__)
+    case COPY_MOVSB:
+        copy_movsb(dst, src, n);
+        break;
+    case COPY_NT:
+        copy_nt(dst, src, n);
+        break;
+#endif
+    case COPY_WORD:
+        copy_word(dst, src, n);
+        break;
+    default:
+        memcpy(dst, src, n);
+    }
+}
+
+/* what the region is mapped as, for the report */
+static const char * mapping(void)
+{
+    static char buf[64];
+    char cached = '?', huge = '?';
+    FILE * f;
+
+    if (dev.type == IVSHMEM_HOST)
+        return "host-shm";
+    if (dev.type == IVSHMEM_KVM)
+        return "kvm";
+
+    if ((f = fopen("/sys/module/uio_ivshmem/parameters/bar2_cached", "r"))) {
+        cached = fgetc(f);
+        fclose(f);
+    }
+    if ((f = fopen("/sys/module/uio_ivshmem/parameters/bar2_huge", "r"))) {
+        huge = fgetc(f);
+        fclose(f);
+    }
+    snprintf(buf, sizeof(buf), "%s%s", cached == 'N' ? "uc" : "wb",
+             cached == 'N' ? "" : huge == 'Y' ? "-huge" : "-4k");
+    return buf;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        perror("sched_setaffinity");
+}
+
+static void * run_thread(void * arg)
+{
+
+    struct worker * w = arg;
+    uint64_t i, c;
+    uint32_t len;
+    void * p;
+
+    pin(w->cpu);
+    w->start = now_ns();
+    c = cycles();
+
+    for (i = 0; i < w->msgs; i++) {
+        if (sender) {
+            while ((p = ivshmem_spsc_reserve(&w->end)) == NULL)
+                ivshmem_relax();
+            copy(w->copy, p, w->buf, w->size);
+            ivshmem_spsc_commit(&w->end, w->size);
+            ivshmem_spsc_flush(&w->end);
+        } else {
+            while ((p = ivshmem_spsc_peek(&w->end, &len)) == NULL)
+                ivshmem_relax();
+            copy(w->copy, w->buf, p, len);
+            ivshmem_spsc_consume(&w->end);
+            ivshmem_spsc_release(&w->end);
+        }
+    }
+
+    w->cycles = cycles() - c;
+    w->end_ns = now_ns();
+    return NULL;
+}
+
+static void * ring(int i)
+{
+    return (char *)dev.mem + RING_OFFSET + i * ring_bytes;
+}
+
+static uint32_t parse_size(const char * s)
+{
+    char * end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if (*end == 'K' || *end == 'k')
+        v <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        v <<= 20;
+    return v;
+}
+
+static int parse_list(char * arg, uint32_t * out, int max, int copies)
+{
+    char * tok;
+    int n = 0, c;
+
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == max)
+            return -1;
+        if (!copies) {
+            out[n++] = parse_size(tok);
+            continue;
+        }
+        for (c = 0; c < NCOPIES && strcmp(tok, copy_names[c]); c++)
+            ;
+        if (c == NCOPIES || !copy_available(c))
+            return -1;
+        out[n++] = c;
+    }
+
+    return n;
+}
+
+int main(int argc, char ** argv){
+
+    struct worker * w;
+    uint64_t bytes, first, last, sum, recv_cycles;
+    uint32_t size, run = 0, i;
+    int c, r, cpu;
+
+    if (argc < 3) {
+        printf("USAGE: stream_bench <filename> init <threads> <MB per thread> [sizes] [copies]\n"
+               "       stream_bench <filename> send|recv [first cpu]\n");
+        exit(-1);
+    }
+
+    if (ivshmem_open(&dev, argv[1], 0, 1) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+    ctl = dev.mem;
+
+    if (strcmp(argv[2], "init") == 0) {
+#if defined(__x86_64__)
+        char copies[] = "libc,movsb,nt,word";
+#else
+        char copies[] = "libc,word";
+#endif
+        char sizes[] = "64,256,1K,4K,16K,64K,256K,1M,4M,16M";
+
+        if (argc < 5) {
+            printf("init needs <threads> <MB per thread>\n");
+            exit(-1);
+        }
+        ctl->magic = 0;
+        ctl->nthreads = atoi(argv[3]);
+        ctl->bytes = (uint64_t)atoi(argv[4]) << 20;
+        r = parse_list(argc > 5 ? argv[5] : sizes, ctl->sizes, MAX_RUNS, 0);
+        c = parse_list(argc > 6 ? argv[6] : copies, ctl->copies, NCOPIES, 1);
+        if (ctl->nthreads < 1 || ctl->nthreads > MAX_THREADS || r < 1 || c < 1) {
+            printf("1 to %d threads, up to %d sizes, copies %s\n",
+                   MAX_THREADS, MAX_RUNS, copies);
+            exit(-1);
+        }
+        ctl->nsizes = r;
+        ctl->ncopies = c;
+        for (i = 0; i < ctl->nsizes; i++)
+            if (ctl->sizes[i] == 0) {
+                printf("sizes must not be 0\n");
+                exit(-1);
+            }
+        ctl->arrived = ctl->ready = ctl->sent = ctl->done = 0;
+        __atomic_store_n(&ctl->magic, BENCH_MAGIC, __ATOMIC_RELEASE);
+        ivshmem_close(&dev);
+        return 0;
+    }
+
+    if (__atomic_load_n(&ctl->magic, __ATOMIC_ACQUIRE) != BENCH_MAGIC) {
+        printf("run init first\n");
+        exit(-1);
+    }
+    sender = strcmp(argv[2], "send") == 0;
+    cpu = argc > 3 ? atoi(argv[3]) : -1;
+    if (sender)
+        ctl->send_posn = ivshmem_posn(&dev);
+    else
+        ctl->recv_posn = ivshmem_posn(&dev);
+
+    __atomic_fetch_add(&ctl->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&ctl->arrived, __ATOMIC_ACQUIRE) < 2)
+        ivshmem_relax();
+
+    ring_bytes = ((dev.size - RING_OFFSET) / ctl->nthreads) & ~63ul;
+    w = calloc(ctl->nthreads, sizeof(*w));
+    if (!sender)
+        printf("[STREAM] %u threads per side, %s mapping, %s per byte\n",
+               ctl->nthreads, mapping(),
+#if defined(__x86_64__)
+               "cycles"
+#else
+               "ns"
+#endif
+               );
+
+    for (c = 0; c < ctl->ncopies; c++) {
+        for (r = 0; r < ctl->nsizes; r++) {
+            size = ctl->sizes[r];
+
+            /* a run needs two slots per thread */
+            if (ivshmem_spsc_bytes(2, size) > ring_bytes) {
+                if (!sender)
+                    printf("[STREAM] %-5s %8u bytes: does not fit, "
+                           "%zu bytes per ring\n", copy_names[ctl->copies[c]],
+                           size, ring_bytes);
+                continue;
+            }
+
+            /* the sender lays the rings out once the last run is drained */
+            if (sender) {
+                while (__atomic_load_n(&ctl->done, __ATOMIC_ACQUIRE) != run)
+                    ivshmem_relax();
+                for (i = 0; i < ctl->nthreads; i++)
+                    ivshmem_spsc_init(ring(i), ring_bytes, size);
+                __atomic_store_n(&ctl->ready, run + 1, __ATOMIC_RELEASE);
+            } else {
+                while (__atomic_load_n(&ctl->ready, __ATOMIC_ACQUIRE) != run + 1)
+                    ivshmem_relax();
+            }
+
+            for (i = 0; i < ctl->nthreads; i++) {
+                w[i].cpu = cpu < 0 ? -1 : cpu + i;
+                w[i].size = size;
+                w[i].copy = ctl->copies[c];
+                w[i].msgs = ctl->bytes / size;
+                if (w[i].msgs < MIN_MSGS)
+                    w[i].msgs = MIN_MSGS;
+                w[i].buf = realloc(w[i].buf, size);
+                memset(w[i].buf, i + 1, size);
+                ivshmem_spsc_attach(&w[i].end, ring(i), sender ?
+                                    IVSHMEM_SPSC_PRODUCER : IVSHMEM_SPSC_CONSUMER,
+                                    &dev, sender ? ctl->recv_posn : ctl->send_posn,
+                                    0, 0);
+                if (pthread_create(&w[i].thread, NULL, run_thread, &w[i])) {
+                    perror("pthread_create");
+                    exit(-1);
+                }
+            }
+
+            first = UINT64_MAX;
+            last = sum = 0;
+            for (i = 0; i < ctl->nthreads; i++) {
+                pthread_join(w[i].thread, NULL);
+                if (w[i].start < first)
+                    first = w[i].start;
+                if (w[i].end_ns > last)
+                    last = w[i].end_ns;
+                sum += w[i].cycles;
+            }
+
+            if (sender) {
+                ctl->send_cycles = sum;
+                __atomic_store_n(&ctl->sent, ++run, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            recv_cycles = sum;
+            while (__atomic_load_n(&ctl->sent, __ATOMIC_ACQUIRE) != run + 1)
+                ivshmem_relax();
+            bytes = w[0].msgs * size * ctl->nthreads;
+            printf("[STREAM] %-5s %8u bytes: %.3f GB/s, send %.3f recv %.3f "
+                   "per byte\n", copy_names[ctl->copies[c]], size,
+                   bytes / (double)(last - first),
+                   (double)ctl->send_cycles / bytes, (double)recv_cycles / bytes);
+            fflush(stdout);
+            __atomic_store_n(&ctl->done, ++run, __ATOMIC_RELEASE);
+        }
+    }
+
+    for (i = 0; i < ctl->nthreads; i++)
+        free(w[i].buf);
+    free(w);
+    ivshmem_close(&dev);
+
+    return 0;
+}
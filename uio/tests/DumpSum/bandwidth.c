@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+/*
+ * Measures read, write, copy and SHA-1 bandwidth over the shared memory
+ * region.  Run once with the driver loaded as "bar2_cached=0" and once with
+ * the defaults to see the difference the write-back mapping makes.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char * what, long bytes, int passes, double secs)
+{
+    printf("[BW] %-6s %10.1f MB/s\n", what,
+                (double)bytes * passes / secs / (1024 * 1024));
+}
+
+int main(int argc, char ** argv){
+
+    long size, words, i;
+    int fd, pass, passes;
+    volatile uint64_t * region;
+    uint64_t sum;
+    void * buf;
+    double start;
+    unsigned char md[SHA_DIGEST_LENGTH];
+
+    if (argc != 4){
+        fprintf(stderr, "USAGE: bandwidth <file> <size in MB> <passes>\n");
+        exit(-1);
+    }
+
+    size = atol(argv[2]) * 1024 * 1024;
+    passes = atoi(argv[3]);
+    words = size / sizeof(uint64_t);
+
+    if ((fd = open(argv[1], O_RDWR)) < 0){
+        fprintf(stderr, "ERROR: cannot open file\n");
+        exit(-1);
+    }
+
+    /* With UIO drivers, the offset selects the memory region beginning at 0 and counting by page offsets */
+    if ((region = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd,
+                            1 * getpagesize())) == MAP_FAILED){
+        fprintf(stderr, "ERROR: cannot mmap file\n");
+        exit(-1);
+    }
+
+    buf = malloc(size);
+    memset(buf, 0, size);
+
+    printf("[BW] %ld MB, %d passes\n", size / (1024 * 1024), passes);
+
+    /* touch every page first so faults are not part of the numbers */
+    for (i = 0, sum = 0; i < words; i += 512)
+        sum += region[i];
+
+    start = now();
+    for (pass = 0; pass < passes; pass++)
+        for (i = 0; i < words; i++)
+            sum += region[i];
+    report("read", size, passes, now() - start);
+
+    start = now();
+    for (pass = 0; pass < passes; pass++)
+        for (i = 0; i < words; i++)
+            region[i] = i + pass;
+    report("write", size, passes, now() - start);
+
+    start = now();
+    for (pass = 0; pass < passes; pass++)
+        memcpy(buf, (void *)region, size);
+    report("copy", size, passes, now() - start);
+
+    start = now();
+    for (pass = 0; pass < passes; pass++)
+        SHA1((unsigned char *)region, size, md);
+    report("sha1", size, passes, now() - start);
+
+    /* keep the read loop from being optimised away */
+    if (sum == 1)
+        printf("\n");
+
+    free(buf);
+    munmap((void *)region, size);
+    close(fd);
+
+    return 0;
+}
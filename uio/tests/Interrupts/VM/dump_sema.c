@@ -17,20 +17,20 @@
 
 int main(int argc, char ** argv){
 
-    int fd, length=4*1024;
-    void * memptr, *regptr;
+    int length=4*1024;
+    struct ivshmem_dev dev;
+    void * memptr;
     long * long_array;
     long num_chunks;
     int other;
     int i, j, k;
-    int count;
+    int count, got;
 
     if (argc != 4){
         printf("USAGE: dump_sema <filename> <num chunks> <other vm>\n");
         exit(-1);
     }
 
-    fd=open(argv[1], O_RDWR|O_NONBLOCK);
     printf("[DUMP] opening file %s\n", argv[1]);
 
     num_chunks=atol(argv[2]);
@@ -39,29 +39,19 @@ int main(int argc, char ** argv){
     length=num_chunks*CHUNK_SZ;
     printf("[DUMP] size is %d\n", length);
 
-    if ((regptr = mmap(NULL, 256, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 * getpagesize())) == (void *) -1)
-    {
-        printf("mmap failed (0x%p)\n", regptr);
-        close (fd);
-        exit (-1);
-    }
-
-    if ((memptr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 1 * getpagesize())) == (void *) -1)
-    {
-        printf("mmap failed (0x%p)\n", memptr);
-        close (fd);
+    if (ivshmem_open(&dev, argv[1], length, 0) < 0) {
+        perror("ivshmem_open");
         exit (-1);
     }
+    memptr = dev.mem;
 
     srand(time(NULL));
     long_array=(long *)memptr;
 
     count = num_chunks;
     for (k = 0; k < 2; k++){
-        int oldrv = -1;
 
         for (j = 0; j < num_chunks; j++){
-            int rv;
             SHA_CTX context;
             unsigned char md[20];
             long offset = j*(CHUNK_SZ/sizeof(long));
@@ -70,18 +60,14 @@ int main(int argc, char ** argv){
 
             SHA1_Init(&context);
 
-            do {
-                rv = ivshmem_recv(fd);
-
-                if (rv > 0) {
-                    if (oldrv == -1)
-                        oldrv = rv - 1;
-                    count += rv - oldrv;
-                    printf("rv = %d\n", rv);
+            /* poll our vector's count rather than sleep */
+            while (count <= 0) {
+                if ((got = ivshmem_trywait(&dev, MSI_VECTOR)) < 0) {
+                    perror("ivshmem_trywait");
+                    exit (-1);
                 }
-
-                oldrv = rv;
-            } while (count <= 0);
+                count += got;
+            }
 
             for (i = 0; i < CHUNK_SZ/sizeof(long); i++){
                 long_array[offset + i]=rand();
@@ -89,7 +75,7 @@ int main(int argc, char ** argv){
 
             SHA1_Update(&context, memptr + CHUNK_SZ*j, CHUNK_SZ);
             count--;
-            ivshmem_send(regptr, MSI_VECTOR, other);
+            ivshmem_doorbell(&dev, other, MSI_VECTOR);
 
             SHA1_Final(md, &context);
 
@@ -104,9 +90,6 @@ int main(int argc, char ** argv){
     }
 
     printf("[DUMP] munmap is unmapping %p\n", memptr);
-    munmap(memptr, length);
-    munmap(regptr, 256);
-
-    close(fd);
+    ivshmem_close(&dev);
 
 }
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ivshmem.h"
+#include "ivshmem_spsc.h"
+
+/*
+ * Moves count messages of msg_size bytes from prod to cons, either through
+ * an SPSC ring or the way dump_sema/sum_sema do it: one chunk in a fixed
+ * place, a doorbell to say it is there and a doorbell back to say it has
+ * been read.
+ *
+ *   ring    stream through a ring of <slots> slots, doorbells suppressed
+ *   rtt     one message at a time through a ring, answered on a second one
+ *   chunk   chunk + doorbell + acknowledging doorbell
+ *
+ * The consumer sleeps on vector 0, the producer on vector 1.  Start cons
+ * first: it lays out the rings.
+ */
+
+#define CONS_VECTOR 0
+#define PROD_VECTOR 1
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char * mode, long count, uint32_t size,
+                   uint64_t elapsed, unsigned long doorbells, uint64_t * rtt)
+{
+    printf("[SPSC] %s: %ld x %u bytes in %.3f s, %.0f msgs/s, %.1f MB/s, "
+           "%.3f doorbells/msg\n", mode, count, size, elapsed / 1e9,
+           count / (elapsed / 1e9),
+           (double)count * size / (elapsed / 1e9) / (1024 * 1024),
+           (double)doorbells / count);
+
+    if (rtt) {
+        qsort(rtt, count, sizeof(uint64_t), cmp_u64);
+        printf("[SPSC] rtt ns: p50 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+               (unsigned long long)rtt[count / 2],
+               (unsigned long long)rtt[(long)(count * 0.99)],
+               (unsigned long long)rtt[(long)(count * 0.999)],
+               (unsigned long long)rtt[count - 1]);
+    }
+}
+
+/* read every word, so the consumer pays for the data it is handed */
+static uint64_t touch(const void * buf, uint32_t len)
+{
+    const uint64_t * p = buf;
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < len / sizeof(uint64_t); i++)
+        sum += p[i];
+
+    return sum;
+}
+
+static int attach(struct ivshmem_spsc_end * end, void * mem, int role,
+                  struct ivshmem_dev * dev, int peer, int peer_vector,
+                  int vector)
+{
+    while (ivshmem_spsc_attach(end, mem, role, dev, peer, peer_vector,
+                               vector) < 0) {
+        if (errno != EAGAIN)
+            return -1;
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+static void run_chunk(struct ivshmem_dev * dev, int prod, int peer,
+                      uint32_t size, long count)
+{
+    uint64_t * rtt, start, t;
+    uint64_t sum = 0;
+    long i;
+
+    rtt = malloc(count * sizeof(uint64_t));
+    start = now_ns();
+
+    for (i = 0; i < count; i++) {
+        if (prod) {
+            t = now_ns();
+            memset(dev->mem, i, size);
+            ivshmem_doorbell(dev, peer, CONS_VECTOR);
+            ivshmem_wait(dev, PROD_VECTOR);
+            rtt[i] = now_ns() - t;
+        } else {
+            ivshmem_wait(dev, CONS_VECTOR);
+            sum += touch(dev->mem, size);
+            ivshmem_doorbell(dev, peer, PROD_VECTOR);
+        }
+    }
+
+    if (prod)
+        report("chunk", count, size, now_ns() - start, 2 * count, rtt);
+    else
+        printf("[SPSC] consumer done (%llx)\n", (unsigned long long)sum);
+    free(rtt);
+}
+
+static void run_ring(struct ivshmem_dev * dev, int prod, int peer,
+                     uint32_t size, long count, uint32_t slots)
+{
+    struct ivshmem_spsc_end end;
+    uint64_t start, sum = 0;
+    uint32_t len;
+    void * slot;
+    long i;
+
+    if (!prod && ivshmem_spsc_init(dev->mem,
+                        ivshmem_spsc_bytes(slots, size), size) == NULL) {
+        fprintf(stderr, "ring does not fit\n");
+        exit(-1);
+    }
+
+    if (attach(&end, dev->mem, prod ? IVSHMEM_SPSC_PRODUCER :
+               IVSHMEM_SPSC_CONSUMER, dev, peer,
+               prod ? CONS_VECTOR : PROD_VECTOR,
+               prod ? PROD_VECTOR : CONS_VECTOR) < 0) {
+        perror("attach");
+        exit(-1);
+    }
+
+    start = now_ns();
+    for (i = 0; i < count; i++) {
+        if (prod) {
+            while ((slot = ivshmem_spsc_reserve(&end)) == NULL)
+                ivshmem_spsc_wait_space(&end);
+            memset(slot, i, size);
+            ivshmem_spsc_commit(&end, size);
+            ivshmem_spsc_flush(&end);
+        } else {
+            while ((slot = ivshmem_spsc_peek(&end, &len)) == NULL)
+                ivshmem_spsc_wait_data(&end);
+            sum += touch(slot, len);
+            ivshmem_spsc_consume(&end);
+            ivshmem_spsc_release(&end);
+        }
+    }
+
+    if (prod)
+        report("ring", count, size, now_ns() - start, end.doorbells, NULL);
+    else
+        printf("[SPSC] consumer done, %.3f doorbells/msg (%llx)\n",
+               (double)end.doorbells / count, (unsigned long long)sum);
+}
+
+static void run_rtt(struct ivshmem_dev * dev, int prod, int peer,
+                    uint32_t size, long count)
+{
+    struct ivshmem_spsc_end req, resp;
+    size_t bytes = ivshmem_spsc_bytes(2, size);
+    void * back = (char *)dev->mem + ((bytes + 4095) & ~4095ul);
+    uint64_t * rtt, start, t;
+    char * buf;
+    long i;
+
+    if (!prod) {
+        ivshmem_spsc_init(dev->mem, bytes, size);
+        ivshmem_spsc_init(back, bytes, size);
+    }
+
+    if (attach(&req, dev->mem, prod ? IVSHMEM_SPSC_PRODUCER :
+               IVSHMEM_SPSC_CONSUMER, dev, peer,
+               prod ? CONS_VECTOR : PROD_VECTOR,
+               prod ? PROD_VECTOR : CONS_VECTOR) < 0 ||
+        attach(&resp, back, prod ? IVSHMEM_SPSC_CONSUMER :
+               IVSHMEM_SPSC_PRODUCER, dev, peer,
+               prod ? CONS_VECTOR : PROD_VECTOR,
+               prod ? PROD_VECTOR : CONS_VECTOR) < 0) {
+        perror("attach");
+        exit(-1);
+    }
+
+    buf = malloc(size);
+    rtt = malloc(count * sizeof(uint64_t));
+    memset(buf, 0x5a, size);
+
+    start = now_ns();
+    for (i = 0; i < count; i++) {
+        if (prod) {
+            t = now_ns();
+            ivshmem_spsc_send(&req, buf, size);
+            ivshmem_spsc_recv(&resp, buf, size);
+            rtt[i] = now_ns() - t;
+        } else {
+            ivshmem_spsc_recv(&req, buf, size);
+            ivshmem_spsc_send(&resp, buf, size);
+        }
+    }
+
+    if (prod)
+        report("rtt", count, size, now_ns() - start,
+               req.doorbells + resp.doorbells, rtt);
+    else
+        printf("[SPSC] consumer done\n");
+
+    free(rtt);
+    free(buf);
+}
+
+int main(int argc, char ** argv){
+
+    struct ivshmem_dev dev;
+    uint32_t size, slots;
+    long count;
+    int prod, peer;
+
+    if (argc < 7) {
+        printf("USAGE: spsc_bench <filename> prod|cons <other vm> ring|rtt|chunk <msg size> <count> [slots]\n");
+        exit(-1);
+    }
+
+    prod = strcmp(argv[2], "prod") == 0;
+    peer = atoi(argv[3]);
+    size = atoi(argv[5]);
+    count = atol(argv[6]);
+    slots = argc > 7 ? atoi(argv[7]) : 256;
+
+    if (count <= 0 || size == 0) {
+        printf("count and message size must be positive\n");
+        exit(-1);
+    }
+
+    /* host peers need the server's -n; 2 vectors is all we use */
+    if (ivshmem_open(&dev, argv[1], 0, 2) < 0) {
+        perror("ivshmem_open");
+        exit(-1);
+    }
+
+    if (dev.nvectors < 2) {
+        printf("need 2 vectors, device has %d\n", dev.nvectors);
+        exit(-1);
+    }
+
+    printf("[SPSC] posn %d, %s of %s, peer %d\n", ivshmem_posn(&dev),
+           argv[2], argv[4], peer);
+
+    if (strcmp(argv[4], "chunk") == 0)
+        run_chunk(&dev, prod, peer, size, count);
+    else if (strcmp(argv[4], "rtt") == 0)
+        run_rtt(&dev, prod, peer, size, count);
+    else
+        run_ring(&dev, prod, peer, size, count, slots);
+
+    ivshmem_close(&dev);
+
+    return 0;
+}
@@ -7,7 +7,6 @@
 #include <openssl/sha.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/select.h>
 #include <errno.h>
 #include "ivshmem.h"
 
@@ -15,13 +14,12 @@
 #define MSI_VECTOR 0 /* the default vector */
 
 
-int do_select(int fd);
-
 int main(int argc, char ** argv){
 
     long num_chunks, length;
-    void * memptr, *regptr;
-    int i,fd,j, k;
+    struct ivshmem_dev dev;
+    void * memptr;
+    int i,j, k;
     int other, count;
 
     if (argc != 4){
@@ -29,7 +27,6 @@ int main(int argc, char ** argv){
         exit(-1);
     }
 
-    fd=open(argv[1], O_RDWR);
     printf("[SUM] opening file %s\n", argv[1]);
     num_chunks=atol(argv[2]);
     other = atoi(argv[3]);
@@ -37,27 +34,19 @@ int main(int argc, char ** argv){
     length=num_chunks*CHUNK_SZ;
     printf("[SUM] length is %ld\n", length);
 
-    if ((regptr = mmap(NULL, 256, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 * getpagesize())) == (void *) -1){
-        printf("mmap failed (0x%p)\n", regptr);
-        close (fd);
-        exit (-1);
-    }
-
-    if ((memptr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 1 * getpagesize())) == (void *) -1){
-        printf("mmap failed (0x%p)\n", memptr);
-        close (fd);
+    if (ivshmem_open(&dev, argv[1], length, 0) < 0) {
+        perror("ivshmem_open");
         exit (-1);
     }
+    memptr = dev.mem;
 
     printf("[SUM] reading %ld chunks\n", num_chunks);
 
     count = 0;
     for (k = 0; k < 2; k++){
-        int oldrv = -1;
 
         for (j = 0; j < num_chunks; j++) {
 
-            int rv;
             SHA_CTX context;
             unsigned char md[20];
 
@@ -65,23 +54,14 @@ int main(int argc, char ** argv){
 
             SHA1_Init(&context);
 
-            if (count <= 0) {
-                do_select(fd);
-                rv = ivshmem_recv(fd);
-
-                if (rv > 0)  {
-                    if (oldrv == -1)
-                        oldrv = rv - 1; // read returns the total # of interrupts
-                                    // ever which would lead to overflow
-                    count += rv - oldrv;
-                    printf("rv = %d\n", rv);
-                    oldrv = rv;
-                }
+            /* only interrupts on our vector mean a chunk is ready */
+            while (count <= 0) {
+                count += ivshmem_wait(&dev, MSI_VECTOR);
             }
 
             SHA1_Update(&context,memptr + CHUNK_SZ*j, CHUNK_SZ);
             count--;
-            ivshmem_send(regptr, MSI_VECTOR, other);
+            ivshmem_doorbell(&dev, other, MSI_VECTOR);
 
             SHA1_Final(md,&context);
 
@@ -98,23 +78,7 @@ int main(int argc, char ** argv){
 
 //    printf("md is *%20s*\n", md);
 
-    munmap(memptr, length);
-    munmap(regptr, 256);
-    close(fd);
+    ivshmem_close(&dev);
 
     printf("[SUM] Exiting...\n");
 }
-
-int do_select (int fd) {
-
-    fd_set readset;
-
-    FD_ZERO(&readset);
-    /* conn socket is in Live_vms at posn 0 */
-    FD_SET(fd, &readset);
-
-    select(fd + 1, &readset, NULL, NULL, NULL);
-
-    return 1;
-
-}
@@ -10,14 +10,6 @@
 #include <errno.h>
 #include "ivshmem.h"
 
-enum ivshmem_registers {
-    IntrMask = 0,
-    IntrStatus = 4,
-    IVPosition = 8,
-    Doorbell = 12,
-    IVLiveList = 16
-};
-
 int main(int argc, char ** argv){
 
     void * memptr;